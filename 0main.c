@@ -1,5 +1,6 @@
 #include <reef.h>
 
+#include "global.h"
 #include "rpi.h"
 #include "net.h"
 #include "client.h"
@@ -25,6 +26,7 @@ bool  g_dumpsend = false;
 bool  g_dumprecv = false;
 const char *g_cpuid = NULL;
 int g_efd = 0;
+uint64_t g_wakeups[WAKE_MAX] = {0};
 
 static void _got_system_message(int sig)
 {
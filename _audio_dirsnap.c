@@ -0,0 +1,157 @@
+/*
+ * 媒体库目录快照
+ * 记录每个目录（相对 basedir，以 / 结尾，根目录为 ""）的修改时间、目录项数及目录项名字的哈希，
+ * 保存在 basedir/dirsnap.cache。重新扫描时只 stat 各目录：
+ *   修改时间没变的目录不再列出，也不检查其中的文件；
+ *   变了的目录重新列出，与媒体库比较得出新增、删除的文件，名字哈希也没变时不做比较；
+ *   stat 失败的目录，其中的曲目全部删除；新出现的子目录整个扫描。
+ * 目录项增删改名才会改变目录修改时间，文件内容的修改同以前一样不在扫描范围内
+ */
+#define DIRSNAP_VERSION 1
+#define DIRSNAP_RACY 2      /* 秒，刚修改过的目录（FAT 时间精度 2 秒）下次仍需列出 */
+
+typedef struct {
+    int64_t sec;
+    long nsec;
+    uint32_t count;             /* 目录项数，文件与子目录 */
+    uint64_t hash;              /* 目录项名字哈希之和，与顺序无关 */
+} DirSnap;
+
+static void _dirsnap_free(void *key, void *val)
+{
+    free(key);
+    mos_free(val);
+}
+
+static void _dirsnap_key_free(void *key, void *val)
+{
+    free(key);
+}
+
+static void _dirsnap_free_names(void *key, void *val)
+{
+    free(key);
+    MHASH *names = val;
+    mhash_destroy(&names);
+}
+
+static MHASH* _dirsnap_create()
+{
+    MHASH *snap;
+    mhash_init(&snap, mhash_str_hash, mhash_str_comp, _dirsnap_free);
+
+    return snap;
+}
+
+/* FNV-1a */
+static uint64_t _dirsnap_name_hash(const char *name, char type)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= (uint8_t)type;
+    h *= 0x100000001b3ULL;
+
+    return h;
+}
+
+static void _dirsnap_record(MHASH *snap, const char *subdir, const struct stat *st, uint32_t count, uint64_t hash)
+{
+    DirSnap *item = mhash_lookup(snap, (void*)subdir);
+    if (!item) {
+        item = mos_calloc(1, sizeof(DirSnap));
+        mhash_insert(snap, strdup(subdir), item);
+    }
+
+    if (st->st_mtim.tv_sec >= time(NULL) - DIRSNAP_RACY) {
+        item->sec = 0;
+        item->nsec = 0;
+    } else {
+        item->sec = st->st_mtim.tv_sec;
+        item->nsec = st->st_mtim.tv_nsec;
+    }
+    item->count = count;
+    item->hash = hash;
+}
+
+static bool _dirsnap_same(const DirSnap *item, const struct stat *st)
+{
+    return item->sec != 0 && item->sec == st->st_mtim.tv_sec && item->nsec == st->st_mtim.tv_nsec;
+}
+
+/* 没有快照或格式不对时返回 NULL */
+static MHASH* _dirsnap_load(DommeStore *plan)
+{
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%sdirsnap.cache", plan->basedir);
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return NULL;
+
+    char line[PATH_MAX + 128];
+    int version = 0;
+    if (!fgets(line, sizeof(line), fp) || sscanf(line, "dirsnap %d", &version) != 1 ||
+        version != DIRSNAP_VERSION) {
+        mtc_mt_warn("%s version mismatch, full scan", filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    MHASH *snap = _dirsnap_create();
+    while (fgets(line, sizeof(line), fp)) {
+        intmax_t sec;
+        long nsec;
+        unsigned int count;
+        uintmax_t hash;
+        int pos = 0;
+        if (sscanf(line, "%jd %ld %u %jx %n", &sec, &nsec, &count, &hash, &pos) != 4 || pos == 0) continue;
+
+        char *path = line + pos;
+        path[strcspn(path, "\n")] = '\0';
+
+        DirSnap *item = mos_calloc(1, sizeof(DirSnap));
+        item->sec = sec;
+        item->nsec = nsec;
+        item->count = count;
+        item->hash = hash;
+        mhash_insert(snap, strdup(path), item);
+    }
+    fclose(fp);
+
+    mtc_mt_dbg("%d directories in %s", mhash_length(snap), filename);
+
+    return snap;
+}
+
+static bool _dirsnap_save(MHASH *snap, DommeStore *plan)
+{
+    char filename[PATH_MAX], tmpname[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%sdirsnap.cache", plan->basedir);
+    snprintf(tmpname, sizeof(tmpname), "%sdirsnap.cache.tmp", plan->basedir);
+
+    FILE *fp = fopen(tmpname, "w");
+    if (!fp) {
+        mtc_mt_warn("open %s failure %s", tmpname, strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "dirsnap %d\n", DIRSNAP_VERSION);
+
+    char *key;
+    DirSnap *item;
+    MHASH_ITERATE(snap, key, item) {
+        fprintf(fp, "%jd %ld %u %jx %s\n", (intmax_t)item->sec, item->nsec, item->count,
+                (uintmax_t)item->hash, key);
+    }
+
+    if (fclose(fp) != 0 || rename(tmpname, filename) != 0) {
+        mtc_mt_warn("save %s failure %s", filename, strerror(errno));
+        remove(tmpname);
+        return false;
+    }
+
+    return true;
+}
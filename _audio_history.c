@@ -0,0 +1,137 @@
+/*
+ * 播放历史
+ * 定长环形缓冲，按槽位保存曲目 ID（定长，不再逐首 strdup），配合哈希查找曲目最近一次播放的记录。
+ * 记录以递增序号编址，序号对容量取模即为槽位；写满后覆盖最早的记录。
+ * 再次播放的曲目作为新记录追加，哈希指向最新的一条；淘汰记录时只在哈希仍指向它时才删除。
+ * 上一首、下一首沿游标移动，均为 O(1)，沿游标到达的曲目不再追加。
+ * 保存在 history.json 中（不写 runtime.json，以免与其他线程竞争 g_runtime），重启后继续可用
+ */
+#define HISTORY_SAVE_INTERVAL 60    /* 秒，切歌频繁时不必每首都写盘 */
+
+PlayHistory* historyCreate(uint32_t size)
+{
+    if (size == 0) size = 1;
+
+    PlayHistory *history = mos_calloc(1, sizeof(PlayHistory));
+    history->ids = mos_calloc(size, LEN_DOMMEID);
+    history->size = size;
+    history->first = history->last = history->cursor = 0;
+    history->savetime = 0;
+    history->dirty = false;
+    mhash_init(&history->members, mhash_str_hash, mhash_str_comp, NULL);
+
+    return history;
+}
+
+void historyFree(PlayHistory *history)
+{
+    if (!history) return;
+
+    mhash_destroy(&history->members);
+    mos_free(history->ids);
+    mos_free(history);
+}
+
+static void _history_append(PlayHistory *history, const char *id)
+{
+    /* 哈希中存 序号 + 1，以免与 NULL 混淆 */
+    if (history->last - history->first == history->size) {
+        char *oldest = history->ids[history->first % history->size];
+        if ((uintptr_t)mhash_lookup(history->members, oldest) == history->first + 1)
+            mhash_remove(history->members, oldest);
+        history->first++;
+    }
+
+    if (mhash_lookup(history->members, (void*)id)) mhash_remove(history->members, (void*)id);
+
+    char *slot = history->ids[history->last % history->size];
+    strncpy(slot, id, LEN_DOMMEID - 1);
+    slot[LEN_DOMMEID-1] = '\0';
+    mhash_insert(history->members, slot, (void*)(uintptr_t)(history->last + 1));
+
+    history->cursor = history->last++;
+}
+
+/* 记录开始播放的曲目，即游标处的曲目（沿历史前后移动、拖动、继续播放）时不追加 */
+void historyPush(PlayHistory *history, const char *id)
+{
+    if (!history || !id || !*id) return;
+
+    if (history->cursor >= history->first && history->cursor < history->last &&
+        !strcmp(history->ids[history->cursor % history->size], id)) return;
+
+    _history_append(history, id);
+    history->dirty = true;
+}
+
+/* 游标前一首，已是最早的记录时返回 NULL */
+const char* historyPrev(PlayHistory *history)
+{
+    if (!history || history->last == history->first || history->cursor <= history->first) return NULL;
+
+    history->cursor--;
+
+    return history->ids[history->cursor % history->size];
+}
+
+/* 沿历史退回后，游标后一首，已是最新的记录时返回 NULL */
+const char* historyNext(PlayHistory *history)
+{
+    if (!history || history->last == history->first || history->cursor + 1 >= history->last) return NULL;
+
+    history->cursor++;
+
+    return history->ids[history->cursor % history->size];
+}
+
+/* 读取 history.json，没有时读取旧版本保存在 runtime.json 中的历史 */
+void historyLoad(PlayHistory *history)
+{
+    if (!history) return;
+
+    MDF *datanode;
+    mdf_init(&datanode);
+
+    MDF *node = datanode;
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%shistory.json", g_location);
+    if (access(filename, F_OK) == 0) {
+        MERR *err = mdf_json_import_file(datanode, filename);
+        TRACE_NOK_MT(err);
+    } else node = mdf_get_node(g_runtime, "history");
+
+    MDF *cnode = mdf_node_child(node);
+    while (cnode) {
+        char *id = mdf_get_value(cnode, NULL, NULL);
+        if (id && *id) _history_append(history, id);
+
+        cnode = mdf_node_next(cnode);
+    }
+    history->dirty = false;
+
+    mdf_destroy(&datanode);
+
+    mtc_mt_dbg("%u tracks in history", history->last - history->first);
+}
+
+/* 有变化时写入 history.json，force 为 false 时限制写盘频率 */
+void historySave(PlayHistory *history, bool force)
+{
+    if (!history || !history->dirty) return;
+    time_t now = time(NULL);
+    if (!force && now - history->savetime < HISTORY_SAVE_INTERVAL) return;
+
+    MDF *node;
+    mdf_init(&node);
+    for (uint32_t seq = history->first; seq != history->last; seq++) {
+        MDF *cnode = mdf_insert_node(node, NULL, -1);
+        mdf_set_value(cnode, NULL, history->ids[seq % history->size]);
+    }
+    mdf_object_2_array(node, NULL);
+
+    mdf_json_export_filef(node, "%shistory.json", g_location);
+    mdf_destroy(&node);
+
+    history->savetime = now;
+    history->dirty = false;
+}
@@ -0,0 +1,200 @@
+/*
+ * 媒体 ID
+ * 版本 1：整个文件（MP3 去掉 ID3）的 MD5，FLAC 取 streaminfo 中的 MD5。大库首次索引时读盘数小时
+ * 版本 2：音频数据长度 + 头、尾及中间均匀分布若干块的 XXH64 采样指纹，只读取数百 KB。
+ *        可选排除标签区域（audio.id_skip_tags），修改标签后 ID 不变。
+ * 各块单独计算哈希后再合并，块与块之间没有依赖，大文件一次性 fadvise 所有采样区域，让读盘并发进行
+ * 已存入 music.db 的 ID 在 music.db.idv 中记录了版本，不会重新计算，手机端保存的旧 ID 依然有效
+ */
+#define MEDIA_ID_MD5 1
+#define MEDIA_ID_SAMPLED 2
+
+#define ID_EDGE_BLOCK (64 * 1024)
+#define ID_MID_BLOCK (16 * 1024)
+#define ID_MID_COUNT 8
+#define ID_PREFETCH_SIZE (4 * 1024 * 1024)
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t _xxh_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _xxh_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t _xxh_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t _xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = _xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t _xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= _xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/* 小端机器上的 XXH64 */
+static uint64_t _xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data, *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        const uint8_t *limit = end - 32;
+        do {
+            v1 = _xxh_round(v1, _xxh_read64(p));
+            v2 = _xxh_round(v2, _xxh_read64(p + 8));
+            v3 = _xxh_round(v3, _xxh_read64(p + 16));
+            v4 = _xxh_round(v4, _xxh_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = _xxh_rotl(v1, 1) + _xxh_rotl(v2, 7) + _xxh_rotl(v3, 12) + _xxh_rotl(v4, 18);
+        h = _xxh_merge(h, v1);
+        h = _xxh_merge(h, v2);
+        h = _xxh_merge(h, v3);
+        h = _xxh_merge(h, v4);
+    } else h = seed + XXH_PRIME64_5;
+
+    h += len;
+
+    while (p + 8 <= end) {
+        h ^= _xxh_round(0, _xxh_read64(p));
+        h = _xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= (uint64_t)_xxh_read32(p) * XXH_PRIME64_1;
+        h = _xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = _xxh_rotl(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/*
+ * 计算文件 [start, end) 区间的版本 2 指纹，输出 16 位十六进制串
+ * end 为 0 时取文件末尾
+ */
+bool mediaFingerprint(const char *filename, uint64_t start, uint64_t end, char id[33])
+{
+    struct stat fs;
+    uint64_t offsets[ID_MID_COUNT + 2];
+    size_t lens[ID_MID_COUNT + 2];
+    int count = 0;
+
+    memset(id, 0x0, 33);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        mtc_mt_warn("open %s failure %s", filename, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &fs) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if (end == 0 || end > (uint64_t)fs.st_size) end = fs.st_size;
+    if (start >= end) start = 0;
+    uint64_t size = end - start;
+
+    if (size <= 2 * ID_EDGE_BLOCK + ID_MID_COUNT * ID_MID_BLOCK) {
+        offsets[count] = start;
+        lens[count++] = size;
+    } else {
+        offsets[count] = start;
+        lens[count++] = ID_EDGE_BLOCK;
+
+        uint64_t span = size - 2 * ID_EDGE_BLOCK;
+        for (int i = 0; i < ID_MID_COUNT; i++) {
+            offsets[count] = start + ID_EDGE_BLOCK + span * (2 * i + 1) / (2 * ID_MID_COUNT) - ID_MID_BLOCK / 2;
+            lens[count++] = ID_MID_BLOCK;
+        }
+
+        offsets[count] = end - ID_EDGE_BLOCK;
+        lens[count++] = ID_EDGE_BLOCK;
+
+        /* 采样点彼此离得远，内核预读帮不上忙，先把所有请求发出去 */
+        if (size >= ID_PREFETCH_SIZE) {
+            for (int i = 0; i < count; i++) posix_fadvise(fd, offsets[i], lens[i], POSIX_FADV_WILLNEED);
+        }
+    }
+
+    /* 小文件整个读入，最大也只有 ID_EDGE_BLOCK * 2 + ID_MID_BLOCK * ID_MID_COUNT */
+    size_t maxlen = 0;
+    for (int i = 0; i < count; i++) if (lens[i] > maxlen) maxlen = lens[i];
+    uint8_t *buf = mos_calloc(1, maxlen > 0 ? maxlen : 1);
+
+    uint64_t sums[ID_MID_COUNT + 3];
+    sums[0] = size;
+    for (int i = 0; i < count; i++) {
+        size_t got = 0;
+        while (got < lens[i]) {
+            ssize_t rv = pread(fd, buf + got, lens[i] - got, offsets[i] + got);
+            if (rv <= 0) {
+                if (rv < 0 && errno == EINTR) continue;
+                mtc_mt_warn("read %s failure %s", filename, strerror(errno));
+                mos_free(buf);
+                close(fd);
+                return false;
+            }
+            got += rv;
+        }
+
+        sums[i + 1] = _xxh64(buf, lens[i], i);
+    }
+
+    mos_free(buf);
+    close(fd);
+
+    uint64_t h = _xxh64(sums, (count + 1) * sizeof(uint64_t), MEDIA_ID_SAMPLED);
+    snprintf(id, 33, "%016jx", (uintmax_t)h);
+
+    return true;
+}
+
+int mediaIdVersion()
+{
+    int version = mdf_get_int_value(g_config, "audio.id_version", MEDIA_ID_SAMPLED);
+
+    return version == MEDIA_ID_MD5 ? MEDIA_ID_MD5 : MEDIA_ID_SAMPLED;
+}
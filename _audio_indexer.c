@@ -1,8 +1,3 @@
-struct indexer_arg {
-    DommeStore *plan;
-    MLIST *files;
-};
-
 static int _scan_directory(const struct dirent *ent)
 {
     if ((ent->d_name[0] == '.' && ent->d_name[1] == 0) ||
@@ -12,67 +7,82 @@ static int _scan_directory(const struct dirent *ent)
     else return 0;
 }
 
-static int _scan_music(const struct dirent *ent)
+/*
+ * 扫描时判断文件是否已知
+ * 已索引文件直接以 DommeFile 为键，按 (dir, name) 哈希、比较，不必为每首曲目拼接、复制全路径；
+ * 查找时用栈上的 DommeFile 只填 dir、name
+ */
+struct scan_known {
+    MHASH *files;
+    MHASH *notmedia;            /* 非媒体文件全路径，键为 notmedialist 中的字符串 */
+    MLIST *notmedialist;        /* 写回 notMusic.cache */
+};
+
+static uint32_t _known_hash(const void *a)
 {
-    if (ent->d_type == DT_REG &&
-        strcmp(ent->d_name, "music.db") &&
-        strcmp(ent->d_name, "notMusic.cache")) return 1;
-    else return 0;
+    const DommeFile *mfile = a;
+    uint32_t h = 2166136261u;
+
+    for (const char *p = mfile->dir; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+    for (const char *p = mfile->name; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+
+    return h;
 }
 
-static void _scan_for_files(DommeStore *plan, const char *subdir,
-                            MLIST *filesok, MLIST *filesnew, MLIST *filesNotMedia)
+/* 沿用 mhash_str_comp 的返回约定 */
+static int _known_comp(const void *a, const void *b)
 {
-    struct dirent **deps = NULL, **feps = NULL;
+    const DommeFile *fa = a, *fb = b;
 
-    mtc_mt_dbg("scan directory %s", subdir);
+    if (strcmp(fa->dir, fb->dir)) return mhash_str_comp(fa->dir, fb->dir);
 
-    if (!mlist_search(plan->dirs, &subdir, _strcompare)) mlist_append(plan->dirs, strdup(subdir));
+    return mhash_str_comp(fa->name, fb->name);
+}
 
-    char fullpath[PATH_MAX] = {0};
-    snprintf(fullpath, sizeof(fullpath), "%s%s", plan->basedir, subdir);
+static void _known_init(struct scan_known *known, DommeStore *plan, bool fresh)
+{
+    DommeFile *mfile;
+    char *key, *path;
 
-    int n = scandir(fullpath, &feps, _scan_music, alphasort);
-    for (int i = 0; i < n; i++) {
-        char filename[PATH_MAX], *ptr = filename;
-        snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, subdir, feps[i]->d_name);
-        if (!mlist_search(filesok, &ptr, _strcompare) &&
-            !mlist_search(filesNotMedia, &ptr, _strcompare)) {
-            ASSET_TYPE ftype = assetType(filename);
-            if (ftype == ASSET_AUDIO) {
-                MediaNode *mnode = mediaOpen(filename);
-                if (mnode) {
-                    mnode->driver->close(mnode);
-                    mlist_append(filesnew, strdup(filename));
-                    goto nextfile;
-                }
-            } else if (ftype == ASSET_CUE) {
-                CueSheet *centry = cueOpen(filename);
-                if (centry) {
-                    cueFree(centry);
-                    mlist_append(filesnew, strdup(filename));
-                    goto nextfile;
-                }
-            }
+    mhash_init(&known->files, _known_hash, _known_comp, NULL);
+    mhash_init(&known->notmedia, mhash_str_hash, mhash_str_comp, NULL);
+    known->notmedialist = NULL;
 
-            mlist_append(filesNotMedia, strdup(filename));
-        }
+    if (!fresh) {
+        MHASH_ITERATE(plan->mfiles, key, mfile) mhash_insert(known->files, mfile, (void*)1);
 
-    nextfile:
-        free(feps[i]);
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%snotMusic.cache", plan->basedir);
+        known->notmedialist = mlist_build_from_textfile(filename, PATH_MAX);
     }
-    mos_free(feps);
+    if (!known->notmedialist) mlist_init(&known->notmedialist, free);
 
-    n = scandir(fullpath, &deps, _scan_directory, alphasort);
-    for (int i = 0; i < n; i++) {
-        char dirname[PATH_MAX];
-        snprintf(dirname, sizeof(dirname), "%s%s/", subdir, deps[i]->d_name);
+    MLIST_ITERATE(known->notmedialist, path) mhash_insert(known->notmedia, path, (void*)1);
+}
 
-        _scan_for_files(plan, dirname, filesok, filesnew, filesNotMedia);
+static void _known_destroy(struct scan_known *known)
+{
+    mhash_destroy(&known->files);
+    mhash_destroy(&known->notmedia);
+    mlist_destroy(&known->notmedialist);
+}
 
-        free(deps[i]);
-    }
-    mos_free(deps);
+static bool _known_file(struct scan_known *known, const char *subdir, const char *name, const char *filename)
+{
+    if (!known) return false;
+
+    DommeFile key = {.dir = (char*)subdir, .name = (char*)name};
+
+    return mhash_lookup(known->files, &key) || mhash_lookup(known->notmedia, (void*)filename);
+}
+
+static void _known_notmedia(struct scan_known *known, const char *filename)
+{
+    if (!known) return;
+
+    char *path = strdup(filename);
+    mlist_append(known->notmedialist, path);
+    mhash_insert(known->notmedia, path, (void*)1);
 }
 
 static struct watcher* _add_watch(DommeStore *plan, char *subdir, int efd, struct watcher *seed)
@@ -178,14 +188,11 @@ static bool _extract_filename(char *filename, DommeStore *plan, char **path, cha
         return true;
     }
 
-    char dir[PATH_MAX], *ptr = dir;
+    char dir[PATH_MAX];
     snprintf(dir, sizeof(dir), "%.*s", (int)(q - p + 1), p);
-    char *addr = mlist_search(plan->dirs, &ptr, _strcompare);
-    if (!addr) return false;
-
-    *path = *(char**)addr;
+    *path = dommeStoreDir(plan, dir, false);
 
-    return true;
+    return *path != NULL;
 }
 
 /* 告诉所有在线用户哥在忙着索引文件 */
@@ -281,127 +288,206 @@ static void _onStoreChange(AudioEntry *me, DommeStore *plan)
     fclose(fp);
 }
 
-static void* _index_music(void *arg)
+/*
+ * 索引单个音频文件，ainfo 为调用者提供的缓冲
+ * 探测缓存中已有完整信息（以前索引过，如重建数据库、文件改名）时不再打开文件
+ */
+static DommeFile* _index_audio(const char *filename, char *fpath, const char *fname, ArtInfo *ainfo)
 {
-    struct indexer_arg *arga = arg;
-    DommeStore *plan = arga->plan;
-    char *filename = NULL;
-    char *fpath, *fname;
+    ProbeInfo probe;
+    char mediaid[LEN_DOMMEID] = {0};
+    uint8_t idver = 0;
+
+    if (probeInfoGet(filename, &probe) && probe.idver > 0) {
+        memcpy(ainfo, &probe.ainfo, sizeof(ArtInfo));
+        memcpy(mediaid, probe.id, LEN_DOMMEID);
+        idver = probe.idver;
+    } else {
+        MediaNode *mnode = mediaOpen(filename);
+        if (!mnode) return NULL;
+
+        ArtInfo *info = mnode->driver->art_info_get(mnode);
+        const char *id = mediaIdGet(mnode);
+        if (!info || !id) {
+            mnode->driver->close(mnode);
+            return NULL;
+        }
 
-    DommeFile *mfile;
-    MediaNode *mnode;
-    ArtInfo *ainfo;
-    CueSheet *centry;
+        memcpy(ainfo, info, sizeof(ArtInfo));
+        memcpy(mediaid, id, LEN_DOMMEID);
+        idver = mnode->idver;
 
-    int indexcount = 0;
-    static int threadsn = 0;
-    char threadname[24];
-    snprintf(threadname, sizeof(threadname), "indexer%02d", threadsn++);
-    int loglevel = mtc_level_str2int(mdf_get_value(g_config, "trace.worker", "debug"));
-    mtc_mt_initf(threadname, loglevel, g_log_tostdout ? "-" : "%slog/%s.log", g_location, threadname);
+        /* 定位索引要读整个文件，等到首次定位时再生成 */
+        probeMediaSet(mnode);
+        mnode->driver->close(mnode);
+
+        /* 读过的部分（标签、ID）以后用不到，不要挤掉正在用的缓存 */
+        ioDropFile(filename);
+    }
+
+    DommeFile *mfile = mos_calloc(1, sizeof(DommeFile));
+    memcpy(mfile->id, mediaid, LEN_DOMMEID);
+    mfile->id[LEN_DOMMEID-1] = '\0';
+    mfile->idver = idver;
+    mfile->index = 0;
+    mfile->length = ainfo->length;
+    mfile->dir = fpath;
+    mfile->name = strdup(fname);
+    mfile->title = strdup(ainfo->title);
+    mfile->sn = atoi(ainfo->track);
+
+    return mfile;
+}
+
+/*
+ * 索引线程本地的结果缓冲
+ * 探测得到的曲目先攒在各线程自己的缓冲中，攒够 INDEX_BATCH 首（或线程空闲、结束时）
+ * 才取一次 m_indexer_lock 成批加入媒体库，艺术家、专辑按批解析
+ */
+#define INDEX_BATCH 64
+
+typedef struct {
+    DommeTrackAdd *adds;
+    uint32_t count;
+    uint32_t size;
+} IndexBatch;
 
-    mtc_mt_dbg("I am %s", threadname);
+/* 扩容失败时释放 mfile 并返回 false，batch 中已有的曲目不受影响 */
+static bool _batch_add(IndexBatch *batch, DommeFile *mfile, const char *artist, const char *album, const char *year)
+{
+    if (batch->count == batch->size) {
+        uint32_t size = batch->size ? batch->size * 2 : INDEX_BATCH;
+        DommeTrackAdd *adds = mos_calloc(size, sizeof(DommeTrackAdd));
+        if (!adds) {
+            mtc_mt_warn("index batch grow to %u failure, drop %s", size, mfile->name);
+            DommeFileFree(mfile);
+            return false;
+        }
+        if (batch->count > 0) memcpy(adds, batch->adds, batch->count * sizeof(DommeTrackAdd));
+        mos_free(batch->adds);
+        batch->adds = adds;
+        batch->size = size;
+    }
+
+    DommeTrackAdd *add = &batch->adds[batch->count++];
+    add->mfile = mfile;
+    add->artist = strdup(artist ? artist : "");
+    add->album = strdup(album ? album : "");
+    add->year = strdup(year ? year : "");
+
+    return true;
+}
+
+/* 加入媒体库，返回加入的曲目数 */
+static int _batch_merge(DommeStore *plan, IndexBatch *batch)
+{
+    if (batch->count == 0) return 0;
 
     pthread_mutex_lock(&m_indexer_lock);
-    filename = mlist_popx(arga->files);
+    int added = dommeStoreAddTracks(plan, batch->adds, batch->count);
     pthread_mutex_unlock(&m_indexer_lock);
 
-    while (filename) {
-        mfile = NULL;
-        mnode = NULL;
-        ainfo = NULL;
-        centry = NULL;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        mos_free(batch->adds[i].artist);
+        mos_free(batch->adds[i].album);
+        mos_free(batch->adds[i].year);
+    }
+    batch->count = 0;
 
-        if (!_extract_filename(filename, plan, &fpath, &fname)) {
-            mtc_mt_dbg("extract %s failure", filename);
-            goto nextone;
-        }
+    return added;
+}
 
-        ASSET_TYPE ftype = assetType(filename);
-        switch (ftype) {
-        case ASSET_AUDIO:
-            mnode = mediaOpen(filename);
-            if (mnode != NULL) {
-                ainfo = mnode->driver->art_info_get(mnode);
-                if (ainfo) {
-                    mfile = mos_calloc(1, sizeof(DommeFile));
-
-                    memcpy(mfile->id, mnode->md5, LEN_DOMMEID);
-                    mfile->id[LEN_DOMMEID-1] = '\0';
-                    mfile->index = 0;
-                    mfile->length = ainfo->length;
-                    mfile->dir = fpath;
-                    mfile->name = strdup(fname);
-                    mfile->title = strdup(ainfo->title);
-                    mfile->sn = atoi(ainfo->track);
-                    mfile->touched = false;
-
-                    mtc_mt_dbg("%s %s: %s %s %s %s", filename, mfile->id,
-                               ainfo->artist, ainfo->title, ainfo->album, ainfo->track);
-                    //mtc_mt_dbg("%s %s", filename, mfile->id);
-                }
-            }
-            break;
-        case ASSET_CUE:
-            centry = cueOpen(filename);
-            break;
-        default:
-            break;
-        }
+static void _batch_free(IndexBatch *batch)
+{
+    mos_free(batch->adds);
+    batch->count = batch->size = 0;
+}
+
+/*
+ * 探测单个文件（fpath 为 plan->dirs 中的目录），得到的曲目放入 batch，返回曲目数，不是媒体文件时返回 -1
+ * 音频须能打开，CUE 须能解析，探测结果缓存，文件没变化时不再重复
+ */
+static int _index_file(IndexBatch *batch, char *fpath, const char *fname, const char *filename)
+{
+    DommeFile *mfile = NULL;
+    CueSheet *centry = NULL;
+    ArtInfo ainfo;
+    int indexcount = 0;
 
-    nextone:
-        pthread_mutex_lock(&m_indexer_lock);
+    ASSET_TYPE ftype = probeAssetType(filename, NULL);
+    switch (ftype) {
+    case ASSET_AUDIO:
+        mfile = _index_audio(filename, fpath, fname, &ainfo);
         if (mfile) {
-            dommeStoreAddTrack(plan, mfile, ainfo->artist, ainfo->album, ainfo->year);
-            indexcount++;
-        } else if (centry) {
-            //cueDump(centry);
-            CueTrack *track;
-            MLIST_ITERATE(centry->tracks, track) {
-                mfile = mos_calloc(1, sizeof(DommeFile));
-
-                memcpy(mfile->id, track->md5, LEN_DOMMEID);
-                mfile->id[LEN_DOMMEID-1] = '\0';
-                mfile->index = track->index1;
-                mfile->length = centry->length;
-                mfile->dir = fpath;
-                mfile->name = strdup(centry->filename);
-                mfile->title = strdup(track->title);
-                mfile->sn = track->sn;
-                mfile->touched = false;
-
-                mtc_mt_dbg("%s %s: %s %s %s %d", filename, mfile->id,
-                           centry->artist, centry->album, track->title, mfile->sn);
-                //mtc_mt_dbg("%s %s", filename, mfile->id);
-
-                dommeStoreAddTrack(plan, mfile, centry->artist, centry->album, centry->date);
-                indexcount++;
-            }
+            mtc_mt_dbg("%s %s: %s %s %s %s", filename, mfile->id,
+                       ainfo.artist, ainfo.title, ainfo.album, ainfo.track);
+        }
+        break;
+    case ASSET_CUE:
+        /* 按文件头认定的 CUE 脚本，解析不了的当作非媒体文件 */
+        centry = cueOpen(filename);
+        if (!centry) return -1;
+        break;
+    default:
+        return -1;
+    }
 
-            /* 将CUE脚本文件自身加入store, 以防止每次启动都会对其解析 */
+    if (mfile) {
+        if (_batch_add(batch, mfile, ainfo.artist, ainfo.album, ainfo.year)) indexcount++;
+    } else if (centry) {
+        //cueDump(centry);
+        CueTrack *track;
+        MLIST_ITERATE(centry->tracks, track) {
             mfile = mos_calloc(1, sizeof(DommeFile));
-            memcpy(mfile->id, centry->md5, LEN_DOMMEID);
+
+            memcpy(mfile->id, track->md5, LEN_DOMMEID);
             mfile->id[LEN_DOMMEID-1] = '\0';
-            mfile->index = 0;
-            mfile->length = 0;
+            mfile->index = track->index1;
+            mfile->length = centry->length;
             mfile->dir = fpath;
-            mfile->name = strdup(fname);
-            mfile->title = strdup("未知曲目.");
-            mfile->sn = 0;
-            mfile->touched = true;
-            dommeStoreAddTrack(plan, mfile, "未知艺术家", "未知专辑", "");
+            mfile->name = strdup(centry->filename);
+            mfile->title = strdup(track->title);
+            mfile->sn = track->sn;
+
+            mtc_mt_dbg("%s %s: %s %s %s %d", filename, mfile->id,
+                       centry->artist, centry->album, track->title, mfile->sn);
 
-            cueFree(centry);
+            if (_batch_add(batch, mfile, centry->artist, centry->album, centry->date)) indexcount++;
         }
 
-        if (mnode) mnode->driver->close(mnode);
-        filename = mlist_popx(arga->files);
-        pthread_mutex_unlock(&m_indexer_lock);
+        /* 将CUE脚本文件自身加入store, 以防止每次启动都会对其解析 */
+        mfile = mos_calloc(1, sizeof(DommeFile));
+        memcpy(mfile->id, centry->md5, LEN_DOMMEID);
+        mfile->id[LEN_DOMMEID-1] = '\0';
+        mfile->index = 0;
+        mfile->length = 0;
+        mfile->dir = fpath;
+        mfile->name = strdup(fname);
+        mfile->title = strdup("未知曲目.");
+        mfile->sn = 0;
+        _batch_add(batch, mfile, "未知艺术家", "未知专辑", "");
     }
 
-    mtc_mt_dbg("%s done with %d tracks indexed.", threadname, indexcount);
+    if (centry) cueFree(centry);
 
-    return NULL;
+    return indexcount;
+}
+
+#include "_audio_walker.c"
+
+/* 目录 subdir 下不在 names 中的曲目（names 为 NULL 时为全部）放入 filesc */
+static void _scan_dir_removed(DommeStore *plan, const char *subdir, MHASH *names, MLIST *filesc)
+{
+    DommeDir *ddir = mhash_lookup(plan->dirindex, (void*)subdir);
+    if (!ddir) return;
+
+    char *name;
+    DommeFile *mfile;
+    MHASH_ITERATE(ddir->files, name, mfile) {
+        if (names && mhash_lookup(names, name)) continue;
+
+        for (DommeFile *item = mfile; item; item = item->twin) mlist_append(filesc, item);
+    }
 }
 
 /*
@@ -411,115 +497,93 @@ static void* _index_music(void *arg)
 bool indexerScan(DommeStore *plan, bool fresh, AudioEntry *me)
 {
     char filename[PATH_MAX];
-    MLIST *filesa, *filesb, *filesc, *filesd;
+    MLIST *filesc;
+    struct scan_known known;    /* 数据库中原有文件，及非媒体文件（用于加速启动） */
     DommeFile *mfile;
     char *key;
     bool ret = fresh; /* 对于新建索引，返回 true */
 
     mtc_mt_dbg("scan library %s...", plan->basedir);
 
-    mlist_init(&filesa, free);  /* 保存数据库中原有文件列表 */
-    mlist_init(&filesb, free);  /* 保存数据库中没有，媒体库中有的文件列表 （新增） */
-    mlist_init(&filesc, free);  /* 保存数据库中有，媒体库中没有的文件列表 （删除） */
-    filesd = NULL;              /* 保存数据库中没有，媒体库中有的非媒体文件列表 （用于加速启动） */
+    mlist_init(&filesc, NULL);  /* 保存数据库中有，媒体库中没有的曲目 DommeFile* （删除） */
+
+    /* 目录快照，没有时（新建索引、首次使用快照）整个扫描并建立快照 */
+    MHASH *snap = fresh ? NULL : _dirsnap_load(plan);
+    bool incremental = snap != NULL;
+    if (!snap) snap = _dirsnap_create();
 
     /*
-     * 1. 已索引文件名保存至列表 filesa
+     * 1. 已索引文件、非媒体文件放入哈希集合
      */
-    if (!fresh) {
+    _known_init(&known, plan, fresh);
+
+    /* 没有快照时逐个检查是否已删除 */
+    if (!fresh && !incremental) {
         MHASH_ITERATE(plan->mfiles, key, mfile) {
             snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, mfile->dir, mfile->name);
-            mlist_append(filesa, strdup(filename));
-
-            if (access(filename, F_OK) != 0) mlist_append(filesc, strdup(filename));
+            if (access(filename, F_OK) != 0) mlist_append(filesc, mfile);
         }
-
-        /* 1.1 读取非媒体文件 */
-        snprintf(filename, sizeof(filename), "%snotMusic.cache", plan->basedir);
-        filesd = mlist_build_from_textfile(filename, PATH_MAX);
-        if (!filesd) mlist_init(&filesd, free);
     }
 
-    int nonmediaCount = mlist_length(filesd);
+    int nonmediaCount = mlist_length(known.notmedialist);
 
     /*
-     * 2. 找出所有待检测文件保存至列表 filesb, 同时把所有目录更新至 plan->dirs，方便后续使用
+     * 2. 并行遍历目录，新文件边发现边探测、索引，同时把所有目录更新至 plan->dirs，方便后续使用
      */
-    _scan_for_files(plan, "", filesa, filesb, filesd);
+    Walker *w = _walk_create(plan, &known, snap);
+    if (incremental) {
+        DirSnap *item;
+        MLIST *dirs;
+        mlist_init(&dirs, NULL);
+        MHASH_ITERATE(snap, key, item) mlist_append(dirs, key);
+        /* 遍历中会增删快照，先取出已知目录 */
+        MLIST_ITERATE(dirs, key) _walk_seed(w, WALK_CHECK, key);
+        mlist_destroy(&dirs);
+    } else _walk_seed(w, WALK_DIR, "");
+
+    _walk_run(w, me);
+    if (w->found > 0) ret = true;
+
+    /* 3. 消失的目录，及变了的目录中不复存在的曲目 */
+    if (mhash_length(w->gone) > 0 || mhash_length(w->changed) > 0) {
+        mtc_mt_dbg("%d directories gone, %d changed", mhash_length(w->gone), mhash_length(w->changed));
+
+        /* 只看这些目录下的曲目，不必遍历整个媒体库 */
+        void *val;
+        MHASH_ITERATE(w->gone, key, val) _scan_dir_removed(plan, key, NULL, filesc);
+
+        MHASH *names;
+        MHASH_ITERATE(w->changed, key, names) _scan_dir_removed(plan, key, names, filesc);
+    }
+    _walk_free(w);
 
-    if (mlist_length(filesd) > nonmediaCount) {
+    if (mlist_length(known.notmedialist) > nonmediaCount) {
         snprintf(filename, sizeof(filename), "%snotMusic.cache", plan->basedir);
-        mlist_write_textfile(filesd, filename);
+        mlist_write_textfile(known.notmedialist, filename);
     }
 
-    if (mlist_length(filesb) > 0) {
-        mtc_mt_dbg("got %d files to index", mlist_length(filesb));
-
-        _onStoreIndexing(me);
-
-        /*
-         * 3. 探测文件
-         */
-        struct indexer_arg arga = {plan, filesb};
-
-        int pnum = sysconf(_SC_NPROCESSORS_ONLN);
-        if (pnum <= 0) pnum = 2;
-        pthread_t **threads = mos_calloc(pnum, sizeof(pthread_t*));
-        for (int i = 0; i < pnum; i++) {
-            threads[i] = mos_calloc(1, sizeof(pthread_t));
-            pthread_create(threads[i], NULL, _index_music, &arga);
-        }
-
-        int joinnum = 0;
-        while (joinnum < pnum) {
-            for (int i = 0; i < pnum; i++) {
-                if (threads[i]) {
-                    struct timespec timeout;
-                    clock_gettime(CLOCK_REALTIME, &timeout);
-                    timeout.tv_sec += 3;
-                    int rv = pthread_timedjoin_np(*threads[i], NULL ,&timeout);
-                    if (rv == 0) {
-                        free(threads[i]);
-                        threads[i] = NULL;
-
-                        joinnum++;
-                    } else _onStoreIndexing(me);
-                }
-            }
-        }
-        mos_free(threads);
-
-        ret = true;
-
-        _onStoreIndexDone(me);
-    }
+    /* 以 DommeFile 为键，删除曲目之前销毁 */
+    _known_destroy(&known);
 
     /*
      * 处理已删除的媒体文件
      */
     if (mlist_length(filesc) > 0) {
-        char *delfile, *fpath, *fname;
-        MLIST_ITERATE(filesc, delfile) {
-            if (!_extract_filename(delfile, plan, &fpath, &fname)) {
-                mtc_mt_warn("%s not valid file", delfile);
-                continue;
-            }
+        mtc_mt_dbg("%d tracks removed", mlist_length(filesc));
 
-            MHASH_ITERATE(plan->mfiles, key, mfile) {
-                if (!strcmp(fpath, mfile->dir) && !strcmp(fname, mfile->name)) {
-                    mhash_remove(plan->mfiles, key);
-                    break;
-                }
-            }
+        MLIST_ITERATE(filesc, mfile) {
+            dommeStoreRemoveTrack(plan, mfile);
         }
 
         ret = true;
     }
 
-    mlist_destroy(&filesa);
-    mlist_destroy(&filesb);
+    _dirsnap_save(snap, plan);
+    mhash_destroy(&snap);
+
     mlist_destroy(&filesc);
-    mlist_destroy(&filesd);
+
+    probeCacheSave(NULL);
 
     return ret;
 }
@@ -530,39 +594,18 @@ bool indexerScan(DommeStore *plan, bool fresh, AudioEntry *me)
  */
 void indexerScanSubdirectory(DommeStore *plan, const char *subpath)
 {
-    MLIST *files;
-
     mtc_mt_dbg("scan library %s with subdirectory %s...", plan->name, subpath);
 
     char filename[PATH_MAX];
     snprintf(filename, sizeof(filename), "%s%smusic.db", plan->basedir, subpath);
     if (remove(filename) != 0) mtc_mt_warn("remove %s failure %s", filename, strerror(errno));
 
-    mlist_init(&files, free);
+    Walker *w = _walk_create(plan, NULL, NULL);
+    _walk_seed(w, WALK_DIR, subpath);
+    _walk_run(w, NULL);
+    _walk_free(w);
 
-    _scan_for_files(plan, subpath, NULL, files, NULL);
-
-    if (mlist_length(files) > 0) {
-        mtc_mt_dbg("got %d files to index", mlist_length(files));
-
-        struct indexer_arg arga = {plan, files};
-
-        int pnum = sysconf(_SC_NPROCESSORS_ONLN);
-        if (pnum <= 0) pnum = 2;
-        pthread_t **threads = mos_calloc(pnum, sizeof(pthread_t*));
-        for (int i = 0; i < pnum; i++) {
-            threads[i] = mos_calloc(1, sizeof(pthread_t));
-            pthread_create(threads[i], NULL, _index_music, &arga);
-        }
-
-        for (int i = 0; i < pnum; i++) {
-            pthread_join(*threads[i], NULL);
-            mos_free(threads[i]);
-        }
-        mos_free(threads);
-    }
-
-    mlist_destroy(&files);
+    probeCacheSave(NULL);
 }
 
 /*
@@ -577,9 +620,8 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
     DommeFile *mfile;
     DommeStore *plan;
 
-    MediaNode *mnode;
     CueSheet *centry;
-    ArtInfo *ainfo;
+    ArtInfo ainfo;
 
     /* Loop while events can be read from inotify file descriptor. */
     for (;;) {
@@ -614,7 +656,7 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
 
             if (event->mask & IN_ISDIR) {
                 /* 目录动作 */
-                char pathname[PATH_MAX] = {0}, *key = pathname;
+                char pathname[PATH_MAX] = {0};
                 char fullname[PATH_MAX] = {0};
                 snprintf(pathname, PATH_MAX, "%s%s/", arg->path, event->name);
                 snprintf(fullname, PATH_MAX, "%s%s%s/", plan->basedir, arg->path, event->name);
@@ -622,9 +664,9 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                 if (event->mask & IN_CREATE) {
                     mtc_mt_dbg("%s%s CREATE directory %s", plan->basedir, arg->path, event->name);
 
-                    if (!mlist_search(plan->dirs, &key, _strcompare)) {
+                    if (!dommeStoreDir(plan, pathname, false)) {
                         mtc_mt_dbg("append dir %s", pathname);
-                        mlist_append(plan->dirs, strdup(pathname));
+                        dommeStoreDir(plan, pathname, true);
                     }
 
                     int wd = inotify_add_watch(efd, fullname,
@@ -664,9 +706,9 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                 } else if (event->mask & IN_MOVED_TO) {
                     mtc_mt_dbg("%s%s MOVED IN directory %s", plan->basedir, arg->path, event->name);
 
-                    if (!mlist_search(plan->dirs, &key, _strcompare)) {
+                    if (!dommeStoreDir(plan, pathname, false)) {
                         mtc_mt_dbg("append dir %s", pathname);
-                        mlist_append(plan->dirs, strdup(pathname));
+                        dommeStoreDir(plan, pathname, true);
                     }
 
                     int wd = inotify_add_watch(efd, fullname,
@@ -685,7 +727,7 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
 
                     indexerScanSubdirectory(plan, pathname);
 
-                    arg->on_dirty = g_ctime;
+                    arg->on_dirty = time(NULL);
                 } else mtc_mt_warn("%s unknown event %s %d", arg->path, event->name, event->mask);
             } else if (event->len > 0) {
                 /* 文件动作 */
@@ -694,13 +736,11 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                 snprintf(filename, PATH_MAX, "%s%s%s", plan->basedir, arg->path, event->name);
 
                 if (event->mask & IN_CLOSE_WRITE || event->mask & IN_MOVED_TO) {
-                    if (event->name[0] == '.' || !strcmp(event->name, "music.db")) continue;
+                    if (event->name[0] == '.' || !strncmp(event->name, "music.db", 8)) continue;
 
                     mtc_mt_dbg("%s%s CREATE file %s", plan->basedir, arg->path, event->name);
 
                     mfile = NULL;
-                    mnode = NULL;
-                    ainfo = NULL;
                     centry = NULL;
 
                     if (!_extract_filename(filename, plan, &fpath, &fname)) {
@@ -708,31 +748,15 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                         continue;
                     }
 
-                    ASSET_TYPE ftype = assetType(filename);
+                    ASSET_TYPE ftype = probeAssetType(filename, NULL);
                     if (ftype == ASSET_AUDIO) {
-                        mnode = mediaOpen(filename);
-                        if (mnode != NULL) {
-                            ainfo = mnode->driver->art_info_get(mnode);
-                            if (ainfo) {
-                                mfile = mos_calloc(1, sizeof(DommeFile));
-
-                                memcpy(mfile->id, mnode->md5, LEN_DOMMEID);
-                                mfile->id[LEN_DOMMEID-1] = '\0';
-                                mfile->index = 0;
-                                mfile->length = ainfo->length;
-                                mfile->dir = fpath;
-                                mfile->name = strdup(event->name);
-                                mfile->title = strdup(ainfo->title);
-                                mfile->sn = atoi(ainfo->track);
-                                mfile->touched = false;
-                            }
-                        }
-                    } else if (ftype == ASSET_CUE) centry = cueOpen(filename);
-
-                    if (mnode) mnode->driver->close(mnode);
+                        mfile = _index_audio(filename, fpath, event->name, &ainfo);
+                    } else if (ftype == ASSET_CUE) {
+                        centry = cueOpen(filename);
+                    }
 
                     if (mfile)
-                        dommeStoreAddTrack(plan, mfile, ainfo->artist, ainfo->album, ainfo->year);
+                        dommeStoreAddTrack(plan, mfile, ainfo.artist, ainfo.album, ainfo.year);
                     else if (centry) {
                         CueTrack *track;
                         MLIST_ITERATE(centry->tracks, track) {
@@ -746,7 +770,6 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                             mfile->name = strdup(centry->filename);
                             mfile->title = strdup(track->title);
                             mfile->sn = track->sn;
-                            mfile->touched = false;
 
                             mtc_mt_dbg("%s %s: %s %s %s %d", filename, mfile->id,
                                        centry->artist, centry->album, track->title, mfile->sn);
@@ -766,7 +789,6 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                         mfile->name = strdup(fname);
                         mfile->title = strdup("未知曲目.");
                         mfile->sn = 0;
-                        mfile->touched = true;
                         dommeStoreAddTrack(plan, mfile, "未知艺术家", "未知专辑", "");
 
                         cueFree(centry);
@@ -777,7 +799,7 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                         _onStoreIndexing(me);
                     }
 
-                    arg->on_dirty = g_ctime;
+                    arg->on_dirty = time(NULL);
                 } else if (event->mask & IN_DELETE) {
                     mtc_mt_dbg("%s%s DELETE file %s", plan->basedir, arg->path, event->name);
 
@@ -786,15 +808,12 @@ struct watcher* indexerWatch(int efd, struct watcher *seeds, AudioEntry *me)
                         continue;
                     }
 
-                    char *key;
-                    MHASH_ITERATE(plan->mfiles, key, mfile) {
-                        if (!strcmp(fpath, mfile->dir) && !strcmp(fname, mfile->name)) {
-                            mhash_remove(plan->mfiles, key);
-                            break;
-                        }
+                    /* CUE 整轨文件的所有分轨一并删除 */
+                    while ((mfile = dommeStoreFindPath(plan, fpath, fname)) != NULL) {
+                        dommeStoreRemoveTrack(plan, mfile);
                     }
 
-                    arg->on_dirty = g_ctime;
+                    arg->on_dirty = time(NULL);
                 }
             } else mtc_mt_warn("file event %d with name NLL", event->mask);
         }
@@ -817,6 +836,224 @@ void watcherFree(struct watcher *arg)
     }
 }
 
+#define DIRTY_DELAY 20       /* 目录变化平息后多少秒保存媒体库 */
+
+#define BENCH_DIRS 10000         /* 1000 位艺术家，每位 10 张专辑 */
+#define BENCH_TRACKS_PER_DIR 10
+#define BENCH_LEGACY_LOOKUPS 1000 /* 逐一比较太慢，只查这么多，按比例估算 */
+#define BENCH_MERGE_TRACKS 40000
+#define BENCH_PROBE_ROUNDS 20000  /* 模拟探测一个文件的计算量 */
+
+static double _bench_seconds(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+struct bench_merge_arg {
+    DommeStore *plan;
+    char *dir;
+    uint32_t first;
+    uint32_t count;
+    bool batched;
+};
+
+/* 模拟索引线程：探测（纯计算）后逐首持锁加入，或攒在本地成批加入 */
+static void* _bench_merge_worker(void *arg)
+{
+    struct bench_merge_arg *barg = arg;
+    IndexBatch batch = {NULL, 0, 0};
+    char artist[32], album[32];
+
+    for (uint32_t i = barg->first; i < barg->first + barg->count; i++) {
+        uint64_t h = i;
+        for (int r = 0; r < BENCH_PROBE_ROUNDS; r++) h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        DommeFile *mfile = mos_calloc(1, sizeof(DommeFile));
+        snprintf(mfile->id, LEN_DOMMEID, "%010u", i);
+        mfile->dir = barg->dir;
+        mfile->name = strdup("track.flac");
+        mfile->title = strdup("track");
+        mfile->length = h & 0xFF;
+
+        snprintf(artist, sizeof(artist), "artist%04u", i / 100);
+        snprintf(album, sizeof(album), "album%02u", i / 10 % 10);
+
+        if (barg->batched) {
+            _batch_add(&batch, mfile, artist, album, "2000");
+            if (batch.count >= INDEX_BATCH) _batch_merge(barg->plan, &batch);
+        } else {
+            pthread_mutex_lock(&m_indexer_lock);
+            dommeStoreAddTrack(barg->plan, mfile, artist, album, "2000");
+            pthread_mutex_unlock(&m_indexer_lock);
+        }
+    }
+
+    _batch_merge(barg->plan, &batch);
+    _batch_free(&batch);
+
+    return NULL;
+}
+
+/* nthread 个线程索引 BENCH_MERGE_TRACKS 首曲目的耗时 */
+static double _bench_merge(int nthread, bool batched)
+{
+    DommeStore *plan = dommeStoreCreate();
+    plan->basedir = strdup("/bench/library/");
+    char *dir = dommeStoreDir(plan, "album/", true);
+
+    pthread_t *threads = mos_calloc(nthread, sizeof(pthread_t));
+    struct bench_merge_arg *args = mos_calloc(nthread, sizeof(struct bench_merge_arg));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nthread; i++) {
+        args[i].plan = plan;
+        args[i].dir = dir;
+        args[i].first = BENCH_MERGE_TRACKS / nthread * i;
+        args[i].count = i == nthread - 1 ? BENCH_MERGE_TRACKS - args[i].first : BENCH_MERGE_TRACKS / nthread;
+        args[i].batched = batched;
+        pthread_create(&threads[i], NULL, _bench_merge_worker, &args[i]);
+    }
+    for (int i = 0; i < nthread; i++) pthread_join(threads[i], NULL);
+    double elapsed = _bench_seconds(&start);
+
+    if (plan->count_track != BENCH_MERGE_TRACKS) mtc_mt_warn("%u tracks merged", plan->count_track);
+
+    mos_free(threads);
+    mos_free(args);
+    dommeStoreFree(plan);
+
+    return elapsed;
+}
+
+/*
+ * trace.benchmark 打开时输出：
+ *   重新扫描 10 万首曲目的媒体库时，判断文件是否已索引的耗时，对比原先的全路径列表 + mlist_search；
+ *   1 至 CPU 数个线程索引时，逐首持锁加入媒体库与线程本地成批加入的耗时
+ */
+void indexerBenchmark()
+{
+    DommeStore *plan = dommeStoreCreate();
+    plan->basedir = strdup("/bench/library/");
+
+    uint32_t total = BENCH_DIRS * BENCH_TRACKS_PER_DIR;
+    char filename[PATH_MAX], *key, *ptr = filename;
+    DommeFile *mfile;
+
+    for (int d = 0; d < BENCH_DIRS; d++) {
+        char *dir = mos_calloc(1, 32);
+        snprintf(dir, 32, "artist%04d/album%02d/", d / 10, d % 10);
+        mlist_append(plan->dirs, dir);
+
+        for (int t = 0; t < BENCH_TRACKS_PER_DIR; t++) {
+            mfile = mos_calloc(1, sizeof(DommeFile));
+            snprintf(mfile->id, LEN_DOMMEID, "%010d", d * BENCH_TRACKS_PER_DIR + t);
+            mfile->dir = dir;
+            mfile->name = mos_calloc(1, 32);
+            snprintf(mfile->name, 32, "%02d - track.flac", t + 1);
+            mfile->title = strdup("track");
+            mhash_insert(plan->mfiles, mfile->id, mfile);
+        }
+    }
+
+    struct timespec start;
+
+    /* 原先：拼接全路径放入列表，扫描到的每个文件逐一比较 */
+    MLIST *filesok;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mlist_init(&filesok, free);
+    MHASH_ITERATE(plan->mfiles, key, mfile) {
+        snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, mfile->dir, mfile->name);
+        mlist_append(filesok, strdup(filename));
+    }
+    double legacybuild = _bench_seconds(&start);
+
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_LEGACY_LOOKUPS; i++) {
+        int d = i * (BENCH_DIRS / BENCH_LEGACY_LOOKUPS);
+        snprintf(filename, sizeof(filename), "%sartist%04d/album%02d/%02d - track.flac",
+                 plan->basedir, d / 10, d % 10, i % BENCH_TRACKS_PER_DIR + 1);
+        if (mlist_search(filesok, &ptr, _strcompare)) found++;
+    }
+    double legacylookup = _bench_seconds(&start) * total / BENCH_LEGACY_LOOKUPS;
+    mlist_destroy(&filesok);
+
+    /* 现在：以 DommeFile 为键的哈希集合 */
+    struct scan_known known;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    _known_init(&known, plan, false);
+    double hashbuild = _bench_seconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *dir;
+    MLIST_ITERATE(plan->dirs, dir) {
+        for (int t = 0; t < BENCH_TRACKS_PER_DIR; t++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%02d - track.flac", t + 1);
+            snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, dir, name);
+            if (_known_file(&known, dir, name, filename)) found++;
+        }
+    }
+    double hashlookup = _bench_seconds(&start);
+    _known_destroy(&known);
+
+    mtc_mt_dbg("rescan %u tracks: list build %.3fs lookup %.1fs (estimated), hash build %.3fs lookup %.3fs, %d found",
+               total, legacybuild, legacylookup, hashbuild, hashlookup, found);
+
+    dommeStoreFree(plan);
+
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 2;
+    for (int nthread = 1; ; nthread *= 2) {
+        if (nthread > ncpu) nthread = ncpu;
+
+        double locked = _bench_merge(nthread, false);
+        double batched = _bench_merge(nthread, true);
+        mtc_mt_dbg("index %u tracks with %d threads: per-track lock %.3fs, batched %.3fs",
+                   BENCH_MERGE_TRACKS, nthread, locked, batched);
+
+        if (nthread == ncpu) break;
+    }
+}
+
+/* 保存变化已平息的媒体库，返回距下一个需要保存的毫秒数，-1 为没有 */
+static int _dirty_dump(AudioEntry *me)
+{
+    time_t now = time(NULL), deadline = 0;
+
+    struct watcher *item = me->seeds;
+    while (item) {
+        if (item->on_dirty && now - item->on_dirty >= DIRTY_DELAY) {
+            dommeStoreDumpFilef(item->plan, "%smusic.db", item->plan->basedir);
+            probeCacheSave(me->plans);
+
+            /* 通知所有已连接客户端，更新媒体数据库 */
+            _onStoreChange(me, item->plan);
+
+            _onStoreIndexDone(me);
+            item->on_dirty = 0;
+
+            /* 避免重复 dump */
+            struct watcher *next = item->next;
+            while (next) {
+                if (next->plan == item->plan) next->on_dirty = 0;
+
+                next = next->next;
+            }
+        } else if (item->on_dirty && (deadline == 0 || item->on_dirty + DIRTY_DELAY < deadline)) {
+            deadline = item->on_dirty + DIRTY_DELAY;
+        }
+
+        item = item->next;
+    }
+
+    return deadline ? (deadline - now) * 1000 : -1;
+}
+
 void* dommeIndexerStart(void *arg)
 {
     AudioEntry *me = (AudioEntry*)arg;
@@ -827,6 +1064,10 @@ void* dommeIndexerStart(void *arg)
 
     mtc_mt_dbg("I am audio indexer");
 
+    outputYieldCPU(me);
+
+    if (mdf_get_bool_value(g_config, "trace.benchmark", false)) indexerBenchmark();
+
     char *libroot = mdf_get_value(g_config, "libraryRoot", NULL);
     if (!libroot) {
         mtc_mt_err("library root path not found");
@@ -879,7 +1120,9 @@ void* dommeIndexerStart(void *arg)
 
     mdf_destroy(&config);
 
-    if (mdf_get_bool_value(g_runtime, "autoplay", false)) me->act = ACT_PLAY;
+    if (mdf_get_bool_value(g_runtime, "autoplay", false)) _set_act(me, ACT_PLAY);
+
+    probeCacheSave(me->plans);
 
     /* me->plans 已是最新的索引文件，并都已吐出至music.db，poll 和 ionotify 监控目录变化 */
     mtc_mt_dbg("plans DONE. monitor file system...");
@@ -902,46 +1145,21 @@ void* dommeIndexerStart(void *arg)
         fds[0].events = POLLIN;
         int nfd = 1;
 
+        int timeout = -1;
         while (me->running) {
-            int poll_num = poll(fds, nfd, 1000);
+            /* 没有待保存的媒体库时一直等待目录变化 */
+            int poll_num = poll(fds, nfd, timeout);
             if (poll_num == -1 && errno != EINTR) {
                 mtc_mt_err("poll error %s", strerror(errno));
                 return NULL;
             }
 
-            if (poll_num > 0) {
-                if (fds[0].revents & POLLIN) {
-                    pthread_mutex_lock(&me->index_lock);
-                    me->seeds = indexerWatch(me->efd, me->seeds, me);
-                    pthread_mutex_unlock(&me->index_lock);
-                }
-            } else if (poll_num == 0) {
-                /* timeout */
-                pthread_mutex_lock(&me->index_lock);
-                struct watcher *item = me->seeds;
-                while (item) {
-                    if (item->on_dirty && g_ctime > item->on_dirty && g_ctime - item->on_dirty > 19) {
-                        dommeStoreDumpFilef(item->plan, "%smusic.db", item->plan->basedir);
-
-                        /* 通知所有已连接客户端，更新媒体数据库 */
-                        _onStoreChange(me, item->plan);
-
-                        _onStoreIndexDone(me);
-                        item->on_dirty = 0;
-
-                        /* 避免重复 dump */
-                        struct watcher *next = item->next;
-                        while (next) {
-                            if (next->plan == item->plan) next->on_dirty = 0;
-
-                            next = next->next;
-                        }
-                    }
+            WAKEUP(WAKE_INDEXER);
 
-                    item = item->next;
-                }
-                pthread_mutex_unlock(&me->index_lock);
-            }
+            pthread_mutex_lock(&me->index_lock);
+            if (poll_num > 0 && (fds[0].revents & POLLIN)) me->seeds = indexerWatch(me->efd, me->seeds, me);
+            timeout = _dirty_dump(me);
+            pthread_mutex_unlock(&me->index_lock);
         }
     } else mtc_mt_err("no directory need to watch");
 
@@ -111,7 +111,6 @@ DommeAlbum* albumCreate(char *title)
     DommeAlbum *disk = mos_calloc(1, sizeof(DommeAlbum));
     disk->title = strdup(title);
     disk->year = NULL;
-    disk->pos = 0;
     mlist_init(&disk->tracks, NULL);
 
     return disk;
@@ -133,7 +132,6 @@ DommeArtist* artistCreate(char *name)
 
     DommeArtist *artist = mos_calloc(1, sizeof(DommeArtist));
     artist->name = strdup(name);
-    artist->pos = 0;
     artist->count_track = 0;
     mlist_init(&artist->albums, albumFree);
 
@@ -149,6 +147,83 @@ void artistFree(void *p)
     mos_free(artist);
 }
 
+static void _dir_free(void *key, void *val)
+{
+    /* key 即 path，归 plan->dirs */
+    DommeDir *ddir = val;
+    mhash_destroy(&ddir->files);
+    mos_free(ddir);
+}
+
+static DommeDir* _dir_index(DommeStore *plan, char *path)
+{
+    DommeDir *ddir = mos_calloc(1, sizeof(DommeDir));
+    ddir->path = path;
+    mhash_init(&ddir->files, mhash_str_hash, mhash_str_comp, NULL);
+    mhash_insert(plan->dirindex, path, ddir);
+
+    return ddir;
+}
+
+/* 目录在 plan->dirs 中的字符串，没有时 create 为 true 则加入，否则返回 NULL */
+char* dommeStoreDir(DommeStore *plan, const char *dir, bool create)
+{
+    if (!plan || !dir) return NULL;
+
+    DommeDir *ddir = mhash_lookup(plan->dirindex, (void*)dir);
+    if (ddir) return ddir->path;
+    if (!create) return NULL;
+
+    ddir = _dir_index(plan, strdup(dir));
+    mlist_append(plan->dirs, ddir->path);
+
+    return ddir->path;
+}
+
+/* 目录 dir 下文件 name 对应的曲目，CUE 整轨文件的其余分轨经 twin 取得 */
+DommeFile* dommeStoreFindPath(DommeStore *plan, const char *dir, const char *name)
+{
+    if (!plan || !dir || !name) return NULL;
+
+    DommeDir *ddir = mhash_lookup(plan->dirindex, (void*)dir);
+    if (!ddir) return NULL;
+
+    return mhash_lookup(ddir->files, (void*)name);
+}
+
+/* 加入路径索引，mfile->dir 换成 plan->dirs 中的字符串 */
+static void _path_link(DommeStore *plan, DommeFile *mfile)
+{
+    mfile->dir = dommeStoreDir(plan, mfile->dir, true);
+
+    DommeDir *ddir = mhash_lookup(plan->dirindex, mfile->dir);
+    DommeFile *head = mhash_lookup(ddir->files, mfile->name);
+    if (head) {
+        mfile->twin = head->twin;
+        head->twin = mfile;
+    } else {
+        mfile->twin = NULL;
+        mhash_insert(ddir->files, mfile->name, mfile);
+    }
+}
+
+static void _path_unlink(DommeStore *plan, DommeFile *mfile)
+{
+    DommeDir *ddir = mhash_lookup(plan->dirindex, mfile->dir);
+    if (!ddir) return;
+
+    DommeFile *head = mhash_lookup(ddir->files, mfile->name);
+    if (head == mfile) {
+        /* 键为 mfile 自己的文件名，换成下一首的 */
+        mhash_remove(ddir->files, mfile->name);
+        if (mfile->twin) mhash_insert(ddir->files, mfile->twin->name, mfile->twin);
+    } else {
+        while (head && head->twin != mfile) head = head->twin;
+        if (head) head->twin = mfile->twin;
+    }
+    mfile->twin = NULL;
+}
+
 DommeFile* dommeGetFile(DommeStore *plan, char *id)
 {
     if (!plan || !id) return NULL;
@@ -170,6 +245,14 @@ DommeFile* dommeGetPos(DommeStore *plan, uint32_t pos)
     return NULL;
 }
 
+/* 全局递增，媒体库被替换后新旧版本号也不会相同 */
+static uint32_t _store_version()
+{
+    static uint32_t version = 0;
+
+    return __atomic_add_fetch(&version, 1, __ATOMIC_RELAXED);
+}
+
 DommeStore* dommeStoreCreate()
 {
     DommeStore *plan = mos_calloc(1, sizeof(DommeStore));
@@ -178,9 +261,10 @@ DommeStore* dommeStoreCreate()
     plan->moren = false;
     plan->count_album = 0;
     plan->count_track = 0;
-    plan->count_touched = 0;
+    plan->version = _store_version();
 
     mlist_init(&plan->dirs, free);
+    mhash_init(&plan->dirindex, mhash_str_hash, mhash_str_comp, _dir_free);
     mhash_init(&plan->mfiles, mhash_str_hash, mhash_str_comp, dommeFileFreeHash);
     mlist_init(&plan->artists, artistFree);
 
@@ -194,6 +278,7 @@ void dommeStoreFree(void *p)
     mos_free(plan->name);
     mos_free(plan->basedir);
 
+    mhash_destroy(&plan->dirindex);
     mlist_destroy(&plan->dirs);
     mhash_destroy(&plan->mfiles);
     mlist_destroy(&plan->artists);
@@ -222,15 +307,9 @@ MERR* dommeLoadFromFile(char *filename, DommeStore *plan)
 
     MDF *cnode = mdf_node_child(dbnode);
     while (cnode) {
-        char *dir = mdf_get_value_copy(cnode, "dir", NULL);
+        char *dir = dommeStoreDir(plan, mdf_get_value(cnode, "dir", NULL), true);
         if (!dir) goto nextdir;
 
-        char **tmps = mlist_search(plan->dirs, &dir, _strcompare);
-        if (tmps) {
-            mos_free(dir);
-            dir = *tmps;
-        } else mlist_append(plan->dirs, dir);
-
         MDF *artnode = mdf_get_child(cnode, "art");
         while (artnode) {
             char *sartist = mdf_get_value(artnode, "a", NULL);
@@ -255,7 +334,9 @@ MERR* dommeLoadFromFile(char *filename, DommeStore *plan)
 
             MDF *song = mdf_get_child(artnode, "d");
             while (song) {
-                if (mdf_child_count(song, NULL) != 6) goto nextsong;
+                /* 曾经以第 7 项保存 ID 版本，读入后下次保存时迁移至 .idv 文件 */
+                int fieldcount = mdf_child_count(song, NULL);
+                if (fieldcount != 6 && fieldcount != 7) goto nextsong;
 
                 char *id = mdf_get_value(song, "[0]", NULL);
                 char *name = mdf_get_value(song, "[1]", NULL);
@@ -273,13 +354,14 @@ MERR* dommeLoadFromFile(char *filename, DommeStore *plan)
                 mfile->sn = mdf_get_int_value(song, "[3]", 0);
                 mfile->index = mdf_get_int_value(song, "[4]", 0);
                 mfile->length = mdf_get_int_value(song, "[5]", 0);
-                mfile->touched = false;
+                mfile->idver = mdf_get_int_value(song, "[6]", MEDIA_ID_MD5);
 
                 mfile->artist = artist;
                 mfile->disk = disk;
 
                 mhash_insert(plan->mfiles, mfile->id, mfile);
                 plan->count_track++;
+                _path_link(plan, mfile);
 
                 mlist_append(disk->tracks, mfile);
                 artist->count_track++;
@@ -298,6 +380,25 @@ MERR* dommeLoadFromFile(char *filename, DommeStore *plan)
 
     mdf_destroy(&dbnode);
 
+    /* ID 版本单独保存，music.db 的曲目记录保持 6 项 */
+    char idvname[PATH_MAX];
+    snprintf(idvname, sizeof(idvname), "%s.idv", filename);
+    if (access(idvname, F_OK) == 0) {
+        MDF *idvnode;
+        mdf_init(&idvnode);
+        err = mdf_mpack_import_file(idvnode, idvname);
+        TRACE_NOK_MT(err);
+
+        MDF *cnode = mdf_node_child(idvnode);
+        while (cnode) {
+            mfile = mhash_lookup(plan->mfiles, mdf_get_name(cnode, NULL));
+            if (mfile) mfile->idver = mdf_get_int_value(cnode, NULL, MEDIA_ID_MD5);
+
+            cnode = mdf_node_next(cnode);
+        }
+        mdf_destroy(&idvnode);
+    }
+
     /*
      * post dbload scan
      */
@@ -375,8 +476,9 @@ bool dommeStoreDumpFile(DommeStore *plan, char *filename)
 
     mtc_mt_dbg("STORE DUMP %s", filename);
 
-    MDF *datanode;
+    MDF *datanode, *idvnode;
     mdf_init(&datanode);
+    mdf_init(&idvnode);
 
     char *key;
     DommeFile *mfile;
@@ -404,6 +506,7 @@ bool dommeStoreDumpFile(DommeStore *plan, char *filename)
         mdf_set_int_value(mnode, "3", mfile->sn);
         mdf_set_int_value(mnode, "4", mfile->index);
         mdf_set_int_value(mnode, "5", mfile->length);
+        if (mfile->idver > MEDIA_ID_MD5) mdf_set_int_value(idvnode, mfile->id, mfile->idver);
 
         mdf_object_2_array(mnode, NULL);
         mdf_object_2_array(tnode, "d");
@@ -415,6 +518,13 @@ bool dommeStoreDumpFile(DommeStore *plan, char *filename)
 
     mdf_mpack_export_file(datanode, filename);
 
+    /* music.db 会同步到手机，只认 6 项记录的客户端读不了新字段，ID 版本另存 */
+    char idvname[PATH_MAX];
+    snprintf(idvname, sizeof(idvname), "%s.idv", filename);
+    if (mdf_child_count(idvnode, NULL) > 0) mdf_mpack_export_file(idvnode, idvname);
+    else unlink(idvname);
+
+    mdf_destroy(&idvnode);
     mdf_destroy(&datanode);
     return true;
 }
@@ -437,7 +547,7 @@ MERR* dommeStoreReload(AudioEntry *me, char *basedir, char *name)
 
     mtc_mt_dbg("reload store %s with dir %s", name, basedir);
 
-    me->act = ACT_STOP;
+    _set_act(me, ACT_STOP);
 
     DommeStore *plan = dommeStoreCreate();
     plan->name = strdup(name);
@@ -469,7 +579,7 @@ bool dommeStoreReplace(AudioEntry *me, DommeStore *plan)
     mtc_mt_dbg("replace store %s", plan->name);
 
     if (plan->moren) {
-        me->act = ACT_STOP;
+        _set_act(me, ACT_STOP);
         me->plan = plan;
     }
 
@@ -486,46 +596,57 @@ bool dommeStoreReplace(AudioEntry *me, DommeStore *plan)
     return true;
 }
 
-bool dommeStoreAddTrack(DommeStore *plan, DommeFile *mfile, char *sartist, char *salbum, char *syear)
+/* sartist, salbum 中不能有 '/'，否则无法保存专辑和艺术家头像 */
+static void _store_unslash(char *s)
 {
-    char filename[PATH_MAX];
-    if (!plan || !plan->mfiles || !mfile || !sartist || !salbum) return false;
+    while (*s) {
+        if (*s == '/') *s = ' ';
+        s++;
+    }
+}
 
-    if (mhash_lookup(plan->mfiles, mfile->id)) {
-        /* TODO file length verify, and id crash process */
-        snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, mfile->dir, mfile->name);
-        mtc_mt_dbg("%s already exist", filename);
+/*
+ * ID 已在媒体库中时跳过该曲目，释放 mfile
+ * 采样指纹、FLAC 的 streaminfo MD5 相同不代表文件内容相同（重新编码、重新抓轨），绝不删除文件
+ */
+static bool _store_collide(DommeStore *plan, DommeFile *mfile)
+{
+    DommeFile *exist = mhash_lookup(plan->mfiles, mfile->id);
+    if (!exist) return false;
 
-        remove(filename);
-        DommeFileFree(mfile);
-        return false;
-    }
+    mtc_mt_warn("%s%s%s id %s collides with %s%s%s, skipped",
+                plan->basedir, mfile->dir, mfile->name, mfile->id, plan->basedir, exist->dir, exist->name);
 
-    /* sartist, salbum 中不能有 '/'，否则无法保存专辑和艺术家头像 */
-    char *ps = sartist;
-    while (*ps) {
-        if (*ps == '/') *ps = ' ';
-        ps++;
-    }
-    ps = salbum;
-    while (*ps) {
-        if (*ps == '/') *ps = ' ';
-        ps++;
-    }
+    DommeFileFree(mfile);
+    return true;
+}
 
+static DommeArtist* _store_artist(DommeStore *plan, char *sartist)
+{
     DommeArtist *artist = artistFind(plan->artists, sartist);
     if (!artist) {
         artist = artistCreate(sartist);
         mlist_append(plan->artists, artist);
     }
+
+    return artist;
+}
+
+static DommeAlbum* _store_album(DommeStore *plan, DommeArtist *artist, char *salbum, char *syear)
+{
     DommeAlbum *disk = albumFind(artist->albums, salbum);
     if (!disk) {
         disk = albumCreate(salbum);
-        disk->year = strdup(syear);
+        disk->year = strdup(syear ? syear : "");
         mlist_append(artist->albums, disk);
         plan->count_album++;
     }
 
+    return disk;
+}
+
+static void _store_insert(DommeStore *plan, DommeFile *mfile, DommeArtist *artist, DommeAlbum *disk)
+{
     mfile->artist = artist;
     mfile->disk = disk;
 
@@ -534,6 +655,113 @@ bool dommeStoreAddTrack(DommeStore *plan, DommeFile *mfile, char *sartist, char
 
     mhash_insert(plan->mfiles, mfile->id, mfile);
     plan->count_track++;
+    _path_link(plan, mfile);
+}
+
+bool dommeStoreAddTrack(DommeStore *plan, DommeFile *mfile, char *sartist, char *salbum, char *syear)
+{
+    if (!plan || !plan->mfiles || !mfile || !sartist || !salbum) return false;
+
+    if (_store_collide(plan, mfile)) return false;
+
+    _store_unslash(sartist);
+    _store_unslash(salbum);
+
+    DommeArtist *artist = _store_artist(plan, sartist);
+    DommeAlbum *disk = _store_album(plan, artist, salbum, syear);
+
+    _store_insert(plan, mfile, artist, disk);
+    plan->version = _store_version();
 
     return true;
 }
+
+static int _track_add_compare(const void *a, const void *b)
+{
+    const DommeTrackAdd *x = a, *y = b;
+
+    int ret = strcmp(x->artist, y->artist);
+    if (ret) return ret;
+
+    return strcmp(x->album, y->album);
+}
+
+/*
+ * 成批加入曲目（索引线程本地攒下的结果），按艺术家、专辑排序后依次加入，
+ * 每位艺术家、每张专辑只查找（创建）一次，整批只更新一次版本号。
+ * adds 会被重新排序，其中的字符串仍归调用者，返回加入的曲目数
+ */
+int dommeStoreAddTracks(DommeStore *plan, DommeTrackAdd *adds, uint32_t count)
+{
+    if (!plan || !plan->mfiles || !adds) return 0;
+
+    uint32_t valid = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!adds[i].mfile) continue;
+        if (!adds[i].artist || !adds[i].album) {
+            DommeFileFree(adds[i].mfile);
+            adds[i].mfile = NULL;
+            continue;
+        }
+
+        _store_unslash(adds[i].artist);
+        _store_unslash(adds[i].album);
+        if (valid != i) {
+            DommeTrackAdd tmp = adds[valid];
+            adds[valid] = adds[i];
+            adds[i] = tmp;
+        }
+        valid++;
+    }
+
+    qsort(adds, valid, sizeof(DommeTrackAdd), _track_add_compare);
+
+    DommeArtist *artist = NULL;
+    DommeAlbum *disk = NULL;
+    int added = 0;
+    for (uint32_t i = 0; i < valid; i++) {
+        DommeTrackAdd *add = &adds[i];
+
+        if (_store_collide(plan, add->mfile)) continue;
+
+        if (!artist || strcmp(artist->name, add->artist)) {
+            artist = _store_artist(plan, add->artist);
+            disk = NULL;
+        }
+        if (!disk || strcmp(disk->title, add->album)) disk = _store_album(plan, artist, add->album, add->year);
+
+        _store_insert(plan, add->mfile, artist, disk);
+        added++;
+    }
+
+    if (added > 0) plan->version = _store_version();
+
+    return added;
+}
+
+/* 从专辑和媒体库中移除并释放曲目 */
+void dommeStoreRemoveTrack(DommeStore *plan, DommeFile *mfile)
+{
+    if (!plan || !mfile) return;
+
+    if (mfile->disk) {
+        DommeFile *item;
+        MLIST_ITERATE(mfile->disk->tracks, item) {
+            if (item == mfile) {
+                mlist_delete(mfile->disk->tracks, _moon_i);
+                break;
+            }
+        }
+    }
+    if (mfile->artist && mfile->artist->count_track > 0) mfile->artist->count_track--;
+    if (plan->count_track > 0) plan->count_track--;
+    plan->version = _store_version();
+
+    _path_unlink(plan, mfile);
+    if (!dommeStoreFindPath(plan, mfile->dir, mfile->name)) {
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, mfile->dir, mfile->name);
+        seekIndexRemove(filename);
+    }
+    mhash_remove(plan->mfiles, mfile->id);
+}
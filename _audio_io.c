@@ -0,0 +1,279 @@
+/*
+ * 媒体文件 I/O 提示
+ * 解码器各自打开文件（minimp3 映射整个文件，dr_flac、dr_wav 走 stdio），提示另用一个只读 fd 下达，
+ * 页缓存按 inode 共享，效果相同：
+ *   播放时 SEQUENTIAL，并在当前位置之前保持 readahead 大小的 WILLNEED 窗口；
+ *   大文件（CUE 整轨镜像）已播放过的部分 DONTNEED，不把 music.db 等挤出缓存；
+ *   曲目将尽时预读播放顺序中的下一首开头；
+ *   索引、推送读过的文件随即丢弃（正在播放、已预读的文件除外）。
+ * 页缓存压力见 CMD_HOME_INFO 的 pagecache
+ */
+#define IO_MB (1024 * 1024)
+#define IO_PREFETCH_LEN (4 * IO_MB)     /* 预读下一首的长度 */
+#define IO_PREFETCH_LEAD 30             /* 秒，剩余多少时预读下一首 */
+
+/* 正在播放、已预读的文件，索引、推送不丢弃它们的缓存 */
+static struct {
+    uint64_t dev;
+    uint64_t ino;
+} m_io_keep[2] = {{0, 0}, {0, 0}};
+
+static struct {
+    uint64_t willneed;          /* 字节 */
+    uint64_t dropped;
+    uint64_t prefetched;
+} m_io_stat = {0, 0, 0};
+
+static void _io_keep(int slot, const struct stat *fs)
+{
+    __atomic_store_n(&m_io_keep[slot].dev, fs ? (uint64_t)fs->st_dev : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_io_keep[slot].ino, fs ? (uint64_t)fs->st_ino : 0, __ATOMIC_RELAXED);
+}
+
+static bool _io_kept(const struct stat *fs)
+{
+    for (int i = 0; i < 2; i++) {
+        if (__atomic_load_n(&m_io_keep[i].ino, __ATOMIC_RELAXED) == (uint64_t)fs->st_ino &&
+            __atomic_load_n(&m_io_keep[i].dev, __ATOMIC_RELAXED) == (uint64_t)fs->st_dev) return true;
+    }
+
+    return false;
+}
+
+static void _io_advise(int fd, uint64_t offset, uint64_t len, int advice)
+{
+    if (len == 0 || posix_fadvise(fd, offset, len, advice) != 0) return;
+
+    if (advice == POSIX_FADV_WILLNEED) __atomic_add_fetch(&m_io_stat.willneed, len, __ATOMIC_RELAXED);
+    else if (advice == POSIX_FADV_DONTNEED) __atomic_add_fetch(&m_io_stat.dropped, len, __ATOMIC_RELAXED);
+}
+
+void ioTrackOpen(MediaIO *io, const char *filename)
+{
+    memset(io, 0x0, sizeof(MediaIO));
+    io->fd = -1;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat fs;
+    if (fstat(fd, &fs) != 0) {
+        close(fd);
+        return;
+    }
+
+    io->fd = fd;
+    io->size = fs.st_size;
+    io->window = (uint64_t)mdf_get_int_value(g_config, "audio.io.readahead", 8) * IO_MB;
+    uint64_t threshold = (uint64_t)mdf_get_int_value(g_config, "audio.io.drop_behind", 32) * IO_MB;
+    io->drop = threshold > 0 && io->size >= threshold;
+    io->prefetch = mdf_get_bool_value(g_config, "audio.io.prefetch", true);
+
+    _io_keep(0, &fs);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/* 解码器映射了整个文件（mp3） */
+void ioTrackMap(MediaIO *io, const void *addr, size_t len)
+{
+    if (!io || !addr || len == 0) return;
+
+    io->map = addr;
+    io->maplen = len;
+    madvise((void*)addr, len, MADV_SEQUENTIAL);
+}
+
+/* 播放到 offset 处，窗口剩余不足一半时补足，大文件丢弃窗口之后的已播放部分 */
+void ioTrackAdvance(MediaIO *io, uint64_t offset)
+{
+    if (!io || io->fd < 0 || offset > io->size) return;
+
+    if (io->window > 0 && io->ahead < io->size && io->ahead < offset + io->window / 2) {
+        uint64_t start = io->ahead > offset ? io->ahead : offset;
+        uint64_t end = offset + io->window < io->size ? offset + io->window : io->size;
+        if (end > start) _io_advise(io->fd, start, end - start, POSIX_FADV_WILLNEED);
+        io->ahead = end;
+    }
+
+    /* 留一个窗口的余量，往回拖动一点不必重新读盘 */
+    if (io->drop && offset > io->behind + 2 * io->window + IO_MB) {
+        uint64_t end = (offset - io->window) & ~((uint64_t)IO_MB - 1);
+        _io_advise(io->fd, io->behind, end - io->behind, POSIX_FADV_DONTNEED);
+        if (io->map) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            uint64_t mstart = (io->behind + page - 1) / page * page;
+            if (end > mstart) madvise((uint8_t*)io->map + mstart, end - mstart, MADV_DONTNEED);
+        }
+        io->behind = end;
+    }
+}
+
+/* CUE 镜像的下一首紧接着本曲，窗口部分保留，只丢弃已播放的部分 */
+void ioTrackClose(MediaIO *io)
+{
+    if (!io || io->fd < 0) return;
+
+    if (io->drop && io->ahead > io->window) {
+        uint64_t end = io->ahead - io->window;
+        if (end > io->behind) _io_advise(io->fd, io->behind, end - io->behind, POSIX_FADV_DONTNEED);
+    }
+
+    close(io->fd);
+    _io_keep(0, NULL);
+    memset(io, 0x0, sizeof(MediaIO));
+    io->fd = -1;
+}
+
+/* 预读文件开头，下一首开始播放时不必等磁盘 */
+void ioPrefetch(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat fs;
+    if (fstat(fd, &fs) == 0 && !_io_kept(&fs)) {
+        uint64_t len = (uint64_t)fs.st_size < IO_PREFETCH_LEN ? (uint64_t)fs.st_size : IO_PREFETCH_LEN;
+        _io_advise(fd, 0, len, POSIX_FADV_WILLNEED);
+        __atomic_add_fetch(&m_io_stat.prefetched, len, __ATOMIC_RELAXED);
+        _io_keep(1, &fs);
+    }
+
+    close(fd);
+}
+
+/* 解码循环中调用（播放线程），推进窗口，曲目将尽时预读下一首 */
+void ioPlayProgress(AudioEntry *me)
+{
+    struct audioTrack *track = me->track;
+    MediaIO *io = &track->io;
+
+    if (io->fd < 0) return;
+
+    ioTrackAdvance(io, (uint64_t)(track->percent * io->size));
+
+    if (!io->prefetch || io->prefetched || track->tinfo.hz <= 0 || track->tinfo.samples < track->samples_eat) return;
+    if (track->tinfo.samples - track->samples_eat > (uint64_t)IO_PREFETCH_LEAD * track->tinfo.hz) return;
+
+    io->prefetched = true;
+
+    /* 单曲播放没有下一首，循环时即为本曲 */
+    if (me->trackid || !me->plan || !_order_current(me)) return;
+
+    const char *id = orderPeek(me->order, me->loopon);
+    DommeFile *mfile = id ? dommeGetFile(me->plan, (char*)id) : NULL;
+    if (!mfile || (track->id && !strcmp(mfile->id, track->id))) return;
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s%s", me->plan->basedir, mfile->dir, mfile->name);
+    ioPrefetch(filename);
+
+    mtc_mt_dbg("prefetch next %s", mfile->name);
+}
+
+/* 读过的部分不再需要，len 为 0 时到文件尾 */
+void ioDropBehind(int fd, off_t offset, off_t len)
+{
+    struct stat fs;
+    if (fd < 0 || fstat(fd, &fs) != 0 || _io_kept(&fs)) return;
+
+    if (len == 0) len = fs.st_size > offset ? fs.st_size - offset : 0;
+    _io_advise(fd, offset, len, POSIX_FADV_DONTNEED);
+}
+
+void ioDropFile(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    ioDropBehind(fd, 0, 0);
+    close(fd);
+}
+
+/* 文件在页缓存中的比例 */
+static double _io_resident(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    struct stat fs;
+    if (fstat(fd, &fs) != 0 || fs.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    double ratio = 0;
+    void *addr = mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t npage = (fs.st_size + page - 1) / page;
+        unsigned char *vec = mos_calloc(npage, 1);
+        if (mincore(addr, fs.st_size, vec) == 0) {
+            size_t incore = 0;
+            for (size_t i = 0; i < npage; i++) incore += vec[i] & 1;
+            ratio = (double)incore / npage;
+        }
+        mos_free(vec);
+        munmap(addr, fs.st_size);
+    }
+    close(fd);
+
+    return ratio;
+}
+
+/* /proc 下 "key value" 格式文件中 key 对应的数值，没有时返回 -1 */
+static int64_t _io_proc_value(const char *filename, const char *key)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+
+    char line[256];
+    size_t keylen = strlen(key);
+    int64_t value = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, key, keylen) && (line[keylen] == ' ' || line[keylen] == '\t')) {
+            value = strtoll(line + keylen, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+
+    return value;
+}
+
+/*
+ * 提示累计量，页缓存概况，及距上次查询的主缺页、回迁（被挤出后又读回）次数，
+ * 各媒体库 music.db 的缓存比例
+ */
+void ioStat(MDF *node)
+{
+    static int64_t lastfault = -1, lastrefault = -1;
+
+    if (!node) return;
+
+    mdf_set_int64_value(node, "willneed", __atomic_load_n(&m_io_stat.willneed, __ATOMIC_RELAXED));
+    mdf_set_int64_value(node, "dropped", __atomic_load_n(&m_io_stat.dropped, __ATOMIC_RELAXED));
+    mdf_set_int64_value(node, "prefetched", __atomic_load_n(&m_io_stat.prefetched, __ATOMIC_RELAXED));
+
+    mdf_set_int64_value(node, "cachedKB", _io_proc_value("/proc/meminfo", "Cached:"));
+    mdf_set_int64_value(node, "activeFileKB", _io_proc_value("/proc/meminfo", "Active(file):"));
+    mdf_set_int64_value(node, "inactiveFileKB", _io_proc_value("/proc/meminfo", "Inactive(file):"));
+    mdf_set_int64_value(node, "availableKB", _io_proc_value("/proc/meminfo", "MemAvailable:"));
+
+    int64_t fault = _io_proc_value("/proc/vmstat", "pgmajfault");
+    int64_t refault = _io_proc_value("/proc/vmstat", "workingset_refault_file");
+    if (refault < 0) refault = _io_proc_value("/proc/vmstat", "workingset_refault");
+
+    if (lastfault >= 0 && fault >= 0) mdf_set_int64_value(node, "majorFaults", fault - lastfault);
+    if (lastrefault >= 0 && refault >= 0) mdf_set_int64_value(node, "refaults", refault - lastrefault);
+    lastfault = fault;
+    lastrefault = refault;
+
+    MDF *snode = mdf_get_or_create_node(node, "musicdb");
+    MLIST *plans = mediaStoreList();
+    DommeStore *plan;
+    MLIST_ITERATE(plans, plan) {
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%smusic.db", plan->basedir);
+        mdf_set_double_value(snode, plan->name, _io_resident(filename));
+    }
+}
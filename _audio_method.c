@@ -166,7 +166,7 @@ bool storeSetDefault(char *storename)
     DommeStore *plan;
     MLIST_ITERATE(me->plans, plan) {
         if (!strcmp(plan->name, storename)) {
-            me->act = ACT_STOP;
+            _set_act(me, ACT_STOP);
             me->plan = plan;
             plan->moren = true;
         } else plan->moren = false;
@@ -209,7 +209,7 @@ bool storeDelete(char *storename, bool force)
         if (!strcmp(plan->name, storename)) {
             /* 删除当前媒体库时的切换 */
             if (me->plan == plan) {
-                me->act = ACT_STOP;
+                _set_act(me, ACT_STOP);
                 me->plan = plandft;
             }
 
@@ -277,7 +277,7 @@ bool storeMerge(char *src, char *dest)
 
     /* 合并当前媒体库时的切换 */
     if (me->plan == plansrc) {
-        me->act = ACT_STOP;
+        _set_act(me, ACT_STOP);
         me->plan = plandft;
     }
 
@@ -333,10 +333,12 @@ int storeMediaCopy(DommeStore *plan, char *pathfrom, char *pathto, bool recursiv
             if (ftype == ASSET_AUDIO) {
                 mnode = mediaOpen(srcfile);
                 if (mnode) {
-                    memcpy(mediaID, mnode->md5, LEN_DOMMEID);
+                    const char *id = mediaIdGet(mnode);
+                    if (id) memcpy(mediaID, id, LEN_DOMMEID);
                     mediaID[LEN_DOMMEID-1] = '\0';
 
                     mnode->driver->close(mnode);
+                    if (!id) continue;
                 } else continue;
             } else if (ftype == ASSET_UNKNOWN) continue;
 
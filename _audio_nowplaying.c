@@ -0,0 +1,109 @@
+/*
+ * 正在播放信息
+ * 播放线程（及设置音量、随机方式的命令线程）写入，写者之间用 nowlock 互斥；
+ * 命令线程、定时器线程通过 seqlock 读取完整一致的快照，读者不加锁、不访问 ALSA、不查媒体库。
+ * 快照中的字符串都是拷贝，媒体库被替换或曲目被删除后依然有效
+ */
+static void _nowplaying_begin(AudioEntry *me)
+{
+    pthread_mutex_lock(&me->nowlock);
+    __atomic_add_fetch(&me->nowseq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void _nowplaying_end(AudioEntry *me)
+{
+    __atomic_add_fetch(&me->nowseq, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&me->nowlock);
+}
+
+void nowPlayingRead(AudioEntry *me, NowPlaying *now)
+{
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&me->nowseq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+
+        memcpy(now, &me->now, sizeof(NowPlaying));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&me->nowseq, __ATOMIC_RELAXED));
+}
+
+/* 开始播放曲目，mfile 为空时（提示音）没有曲目信息 */
+void nowPlayingTrack(AudioEntry *me, DommeFile *mfile, const char *media_name)
+{
+    struct audioTrack *track = me->track;
+    NowPlaying *now = &me->now;
+
+    _nowplaying_begin(me);
+
+    now->playing = true;
+    memset(now->id, 0x0, sizeof(now->id));
+    memset(now->title, 0x0, sizeof(now->title));
+    memset(now->artist, 0x0, sizeof(now->artist));
+    memset(now->album, 0x0, sizeof(now->album));
+    if (mfile) {
+        strncpy(now->id, mfile->id, sizeof(now->id) - 1);
+        strncpy(now->title, mfile->title, sizeof(now->title) - 1);
+        strncpy(now->artist, mfile->artist->name, sizeof(now->artist) - 1);
+        strncpy(now->album, mfile->disk->title, sizeof(now->album) - 1);
+    }
+    now->media_name = media_name;
+    now->tinfo = track->tinfo;
+    now->samples = track->samples_eat;
+    now->shuffle = me->shuffle;
+    now->xruns = me->out.xruns;
+
+    _nowplaying_end(me);
+}
+
+void nowPlayingStop(AudioEntry *me)
+{
+    _nowplaying_begin(me);
+    me->now.playing = false;
+    me->now.xruns = me->out.xruns;
+    _nowplaying_end(me);
+}
+
+/* 解码循环中调用，只更新播放位置 */
+void nowPlayingPosition(AudioEntry *me, uint64_t samples)
+{
+    _nowplaying_begin(me);
+    me->now.samples = samples;
+    _nowplaying_end(me);
+}
+
+void nowPlayingVolume(AudioEntry *me, double volume)
+{
+    _nowplaying_begin(me);
+    me->now.volume = volume;
+    _nowplaying_end(me);
+}
+
+void nowPlayingShuffle(AudioEntry *me, bool shuffle)
+{
+    _nowplaying_begin(me);
+    me->now.shuffle = shuffle;
+    _nowplaying_end(me);
+}
+
+/* 按 CMD_PLAY_INFO 格式填充 */
+void nowPlayingFill(NowPlaying *now, MDF *node)
+{
+    int hz = now->tinfo.hz > 0 ? now->tinfo.hz : 44100;
+
+    mdf_set_value(node, "id", now->id);
+    mdf_set_int_value(node ,"length", now->tinfo.length);
+    mdf_set_int_value(node, "pos", now->samples / hz);
+    mdf_set_value(node, "title", now->title);
+    mdf_set_value(node, "artist", now->artist);
+    mdf_set_value(node, "album", now->album);
+
+    mdf_set_value(node, "file_type", now->media_name);
+    mdf_set_valuef(node, "bps=%dkbps", now->tinfo.kbps);
+    mdf_set_valuef(node, "rate=%.1fkhz", (float)now->tinfo.hz / 1000);
+    mdf_set_double_value(node, "volume", now->volume);
+    mdf_set_bool_value(node, "shuffle", now->shuffle);
+    mdf_set_int64_value(node, "xruns", now->xruns);
+}
@@ -0,0 +1,302 @@
+/*
+ * 播放顺序
+ * 开始播放时把播放范围（媒体库、艺术家、专辑）内的曲目 ID 收集为紧凑数组，之后只操作下标：
+ * 顺序播放按下标递增；随机播放按需做 Fisher–Yates，每取一首只交换一次。
+ * 已播放的序列记在 played 中，上一首、下一首都是 O(1)。
+ * 随机时可按艺术家或专辑分组（audio.shuffle_weight），先等概率挑一组，再在组内洗牌，
+ * 曲目多的艺术家不会霸占整个播放过程。
+ * 循环播放重新开始时只重置各组计数，不改动 DommeFile。
+ * 媒体库增删曲目后版本号变化，下次取曲目时按原范围重建。
+ * 索引线程删除曲目时会释放 DommeFile，所以只保存 ID，由调用者到媒体库中查找，找不到的跳过
+ */
+typedef enum {
+    WEIGHT_TRACK = 0,           /* 每首曲目机会均等 */
+    WEIGHT_ARTIST,              /* 每位艺术家机会均等 */
+    WEIGHT_ALBUM,               /* 每张专辑机会均等 */
+} ORDER_WEIGHT;
+
+static ORDER_WEIGHT _order_weight()
+{
+    char *weight = mdf_get_value(g_config, "audio.shuffle_weight", "artist");
+
+    if (!strcmp(weight, "artist")) return WEIGHT_ARTIST;
+    else if (!strcmp(weight, "album")) return WEIGHT_ALBUM;
+    else return WEIGHT_TRACK;
+}
+
+/* 索引时把 CUE 脚本自身也加入了媒体库（防止重复解析），不能播放 */
+static bool _order_playable(DommeFile *mfile)
+{
+    char *suffix = strrchr(mfile->name, '.');
+
+    return !suffix || strcasecmp(suffix, ".cue");
+}
+
+static void _order_clear(PlayOrder *order)
+{
+    mos_free(order->artist);
+    mos_free(order->album);
+    mos_free(order->ids);
+    mos_free(order->perm);
+    mos_free(order->played);
+    mos_free(order->gstart);
+    mos_free(order->gcount);
+    mos_free(order->gdrawn);
+    mos_free(order->live);
+
+    memset(order, 0x0, sizeof(PlayOrder));
+}
+
+/* 收集一张专辑的曲目，*newgroup 为 true 时在第一首可播放曲目处开始新的分组 */
+static void _order_collect(PlayOrder *order, DommeAlbum *disk, bool *newgroup)
+{
+    DommeFile *mfile;
+    MLIST_ITERATE(disk->tracks, mfile) {
+        if (!_order_playable(mfile)) continue;
+
+        if (*newgroup) {
+            order->gstart[order->ngroup] = order->count;
+            order->gcount[order->ngroup] = 0;
+            order->ngroup++;
+            *newgroup = false;
+        }
+
+        memcpy(order->ids[order->count], mfile->id, LEN_DOMMEID);
+        order->perm[order->count] = order->count;
+        order->count++;
+        order->gcount[order->ngroup - 1]++;
+    }
+}
+
+/* 从头开始（循环播放、新建范围），O(分组数) */
+static void _order_rewind(PlayOrder *order)
+{
+    order->nplayed = 0;
+    order->pos = 0;
+
+    order->nlive = 0;
+    for (uint32_t i = 0; i < order->ngroup; i++) {
+        order->gdrawn[i] = 0;
+        if (order->gcount[i] > 0) order->live[order->nlive++] = i;
+    }
+}
+
+/* 随机抽取下一首，返回 files 下标 */
+static uint32_t _order_draw(PlayOrder *order)
+{
+    uint32_t k = order->nlive > 1 ? mos_rand(order->nlive) : 0;
+    uint32_t g = order->live[k];
+
+    uint32_t i = order->gstart[g] + order->gdrawn[g];
+    uint32_t remain = order->gcount[g] - order->gdrawn[g];
+    uint32_t j = i + (remain > 1 ? mos_rand(remain) : 0);
+
+    uint32_t x = order->perm[j];
+    order->perm[j] = order->perm[i];
+    order->perm[i] = x;
+
+    order->gdrawn[g]++;
+    if (order->gdrawn[g] == order->gcount[g]) order->live[k] = order->live[--order->nlive];
+
+    return x;
+}
+
+/* 把 index 对应曲目作为第一首（已在播放的曲目），perm 此时还是恒等排列 */
+static void _order_first(PlayOrder *order, uint32_t index)
+{
+    if (!order->shuffle) {
+        for (uint32_t i = 0; i <= index; i++) order->played[i] = i;
+        order->nplayed = order->pos = index + 1;
+        return;
+    }
+
+    for (uint32_t k = 0; k < order->nlive; k++) {
+        uint32_t g = order->live[k];
+        if (index < order->gstart[g] || index >= order->gstart[g] + order->gcount[g]) continue;
+
+        uint32_t i = order->gstart[g];
+        order->perm[index] = order->perm[i];
+        order->perm[i] = index;
+
+        order->gdrawn[g] = 1;
+        if (order->gcount[g] == 1) order->live[k] = order->live[--order->nlive];
+        break;
+    }
+
+    order->played[0] = index;
+    order->nplayed = order->pos = 1;
+}
+
+PlayOrder* orderCreate()
+{
+    return mos_calloc(1, sizeof(PlayOrder));
+}
+
+void orderFree(PlayOrder *order)
+{
+    if (!order) return;
+
+    _order_clear(order);
+    mos_free(order);
+}
+
+/*
+ * 按范围重建播放顺序，artist、album 为 NULL 时为整个媒体库
+ * first（曲目 ID）不为空时视为已经播放了该曲目，之后从它接着往下排
+ */
+bool orderStart(PlayOrder *order, DommeStore *plan, const char *artist, const char *album,
+                bool shuffle, const char *first)
+{
+    if (!order || !plan) return false;
+
+    _order_clear(order);
+
+    DommeArtist *partist = NULL;
+    DommeAlbum *disk = NULL;
+    if (artist) {
+        partist = artistFind(plan->artists, (char*)artist);
+        if (!partist) return false;
+
+        if (album) {
+            disk = albumFind(partist->albums, (char*)album);
+            if (!disk) return false;
+        }
+    }
+
+    order->plan = plan;
+    order->version = plan->version;
+    order->artist = artist ? strdup(artist) : NULL;
+    order->album = album ? strdup(album) : NULL;
+    order->shuffle = shuffle;
+
+    /* 先数一遍，一次分配 */
+    uint32_t maxcount = 0, maxgroup = 0;
+    DommeArtist *aitem;
+    DommeAlbum *ditem;
+    if (disk) {
+        maxcount = mlist_length(disk->tracks);
+        maxgroup = 1;
+    } else if (partist) {
+        MLIST_ITERATE(partist->albums, ditem) maxcount += mlist_length(ditem->tracks);
+        maxgroup = mlist_length(partist->albums);
+    } else {
+        MLIST_ITERATE(plan->artists, aitem) {
+            MLIST_ITERATE(aitem->albums, ditem) maxcount += mlist_length(ditem->tracks);
+            maxgroup += mlist_length(aitem->albums);
+        }
+    }
+    if (maxgroup == 0) maxgroup = 1;
+    if (maxcount == 0) return false;
+
+    order->ids = mos_calloc(maxcount, LEN_DOMMEID);
+    order->perm = mos_calloc(maxcount, sizeof(uint32_t));
+    order->played = mos_calloc(maxcount, sizeof(uint32_t));
+    order->gstart = mos_calloc(maxgroup, sizeof(uint32_t));
+    order->gcount = mos_calloc(maxgroup, sizeof(uint32_t));
+    order->gdrawn = mos_calloc(maxgroup, sizeof(uint32_t));
+    order->live = mos_calloc(maxgroup, sizeof(uint32_t));
+
+    ORDER_WEIGHT weight = shuffle ? _order_weight() : WEIGHT_TRACK;
+    bool newgroup = true;
+    if (disk) _order_collect(order, disk, &newgroup);
+    else if (partist) {
+        MLIST_ITERATE(partist->albums, ditem) {
+            if (weight == WEIGHT_ALBUM) newgroup = true;
+            _order_collect(order, ditem, &newgroup);
+        }
+    } else {
+        MLIST_ITERATE(plan->artists, aitem) {
+            if (weight == WEIGHT_ARTIST) newgroup = true;
+            MLIST_ITERATEB(aitem->albums, ditem) {
+                if (weight == WEIGHT_ALBUM) newgroup = true;
+                _order_collect(order, ditem, &newgroup);
+            }
+        }
+    }
+
+    if (order->count == 0) {
+        _order_clear(order);
+        return false;
+    }
+
+    _order_rewind(order);
+
+    if (first) {
+        for (uint32_t i = 0; i < order->count; i++) {
+            if (!strcmp(order->ids[i], first)) {
+                _order_first(order, i);
+                break;
+            }
+        }
+    }
+
+    mtc_mt_dbg("play order %s %s, %u tracks in %u groups, %s",
+               artist ? artist : plan->name, album ? album : "",
+               order->count, order->ngroup, shuffle ? "shuffle" : "sequence");
+
+    return true;
+}
+
+/* 当前播放顺序是否仍然适用于该范围 */
+bool orderMatch(PlayOrder *order, DommeStore *plan, const char *artist, const char *album, bool shuffle)
+{
+    if (!order || !order->ids) return false;
+
+    if (order->plan != plan || order->version != plan->version || order->shuffle != shuffle) return false;
+
+    if ((artist == NULL) != (order->artist == NULL) || (album == NULL) != (order->album == NULL)) return false;
+    if (artist && strcmp(artist, order->artist)) return false;
+    if (album && strcmp(album, order->album)) return false;
+
+    return true;
+}
+
+/* 下一首的 ID，播完且不循环时返回 NULL */
+const char* orderNext(PlayOrder *order, bool loop)
+{
+    if (!order || order->count == 0) return NULL;
+
+    if (order->pos < order->nplayed) return order->ids[order->played[order->pos++]];
+
+    if (order->nplayed >= order->count) {
+        if (!loop) return NULL;
+        _order_rewind(order);
+    }
+
+    uint32_t index = order->shuffle ? _order_draw(order) : order->nplayed;
+    order->played[order->nplayed++] = index;
+    order->pos = order->nplayed;
+
+    return order->ids[index];
+}
+
+/*
+ * 下一首是哪首，不移动位置（用于预读）
+ * 随机时提前抽取并记入 played，之后的 orderNext 取到的就是它
+ */
+const char* orderPeek(PlayOrder *order, bool loop)
+{
+    if (!order || order->count == 0) return NULL;
+
+    if (order->pos < order->nplayed) return order->ids[order->played[order->pos]];
+
+    if (order->nplayed >= order->count) {
+        /* 循环时重新洗牌，不好提前抽取 */
+        return loop && !order->shuffle ? order->ids[0] : NULL;
+    }
+
+    uint32_t index = order->shuffle ? _order_draw(order) : order->nplayed;
+    order->played[order->nplayed++] = index;
+
+    return order->ids[index];
+}
+
+/* 上一首（当前曲目之前的那首），已在开头时返回 NULL */
+const char* orderPrev(PlayOrder *order)
+{
+    if (!order || order->pos < 2) return NULL;
+
+    order->pos--;
+
+    return order->ids[order->played[order->pos - 1]];
+}
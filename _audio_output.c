@@ -0,0 +1,552 @@
+/*
+ * 声卡输出
+ * 按音源位宽协商声卡原生支持的最窄样本格式（16 位音源优先 S16_LE），解码器尽量直接输出该格式，
+ * 避免 plug 层转换。设备支持 MMAP_INTERLEAVED 时，解码器通过 outputBegin()/outputCommit()
+ * 直接写入 DMA 缓冲区，否则经中转缓冲 snd_pcm_writei()。
+ * 解码格式、声道数与声卡不一致时（如 MP3 只输出 s16、单声道音源、24 位音源只能输出 16 位），
+ * 解码至 outputBuffer()，再由 outputWrite() 转换后写入
+ */
+#define OUTPUT_BUFFER_TIME 100000   /* 微秒 */
+#define OUTPUT_STAGE_FRAMES 4096
+#define OUTPUT_MAX_CHANNELS 8
+
+static snd_pcm_format_t m_formats_16[] = {SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_3LE};
+static snd_pcm_format_t m_formats_24[] = {SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S16_LE};
+static snd_pcm_format_t m_formats_32[] = {SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S16_LE};
+
+static size_t _frame_bytes(struct audioOutput *out)
+{
+    return out->channels * snd_pcm_format_physical_width(out->format) / 8;
+}
+
+bool outputOpen(AudioEntry *me)
+{
+    struct audioOutput *out = &me->out;
+
+    out->device = mdf_get_value(g_config, "audio.device", "default");
+    out->format = SND_PCM_FORMAT_UNKNOWN;
+    out->sformat = SND_PCM_FORMAT_UNKNOWN;
+    out->mmap = false;
+    out->direct = false;
+    out->channels = 0;
+    out->src_channels = 0;
+    out->hz = 0;
+    out->bits = 0;
+    out->gain = 1.0;
+    out->fixed_rate = mdf_get_int_value(g_config, "audio.fixed_rate", 0);
+    out->rate = 0;
+    out->resampler = NULL;
+    out->resampled = NULL;
+    out->widen = mos_calloc(OUTPUT_STAGE_FRAMES, OUTPUT_MAX_CHANNELS * sizeof(int32_t));
+    out->area = NULL;
+    out->stage = mos_calloc(OUTPUT_STAGE_FRAMES, OUTPUT_MAX_CHANNELS * sizeof(int32_t));
+    out->scratch = mos_calloc(OUTPUT_STAGE_FRAMES, OUTPUT_MAX_CHANNELS * sizeof(int32_t));
+    out->upmix = mos_calloc(OUTPUT_STAGE_FRAMES, 2 * sizeof(int32_t));
+    out->dither[0] = 0x12345678;
+    out->dither[1] = 0x9ABCDEF0;
+    out->dither[2] = 0x0FEDCBA9;
+    out->dither[3] = 0x87654321;
+    out->rt_cpu = -1;
+    out->mlock = false;
+    out->xruns = 0;
+
+    /* 多核时默认把最后一个 CPU 留给播放线程，须在其他线程创建前确定 */
+    if (mdf_get_bool_value(g_config, "audio.realtime.enable", false)) {
+        int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int cpu = mdf_get_int_value(g_config, "audio.realtime.cpu", -1);
+        if (cpu < 0 && ncpu > 1) cpu = ncpu - 1;
+        if (cpu >= 0 && cpu < ncpu && ncpu > 1) out->rt_cpu = cpu;
+    }
+
+    int rv = snd_pcm_open(&me->pcm, out->device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (rv < 0) {
+        mtc_mt_err("Can't open PCM device %s. %s", out->device, snd_strerror(rv));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * 锁定播放线程用到的缓冲（audio.realtime.mlock）
+ * 只锁这些缓冲和播放线程的栈，不用 mlockall：整轨 mmap、索引线程栈等不必常驻，
+ * 也不妨碍 _audio_io.c 把播放过的部分丢出页缓存
+ */
+static void _output_pin(struct audioOutput *out, void *addr, size_t len)
+{
+    if (!out->mlock || !addr || len == 0) return;
+
+    if (mlock(addr, len) != 0) mtc_mt_warn("mlock %zu bytes failure %s", len, strerror(errno));
+}
+
+static void _output_unpin(struct audioOutput *out, void *addr, size_t len)
+{
+    if (!out->mlock || !addr || len == 0) return;
+
+    munlock(addr, len);
+}
+
+static void _output_pin_resampler(struct audioOutput *out, bool pin)
+{
+    Resampler *rs = out->resampler;
+    if (!rs) return;
+
+    void (*op)(struct audioOutput*, void*, size_t) = pin ? _output_pin : _output_unpin;
+    op(out, rs->coeffs, (size_t)rs->L * rs->taps * sizeof(float));
+    op(out, rs->buf, (size_t)rs->channels * rs->buflen * sizeof(float));
+    op(out, out->resampled, resamplerMaxOutput(rs) * rs->channels * sizeof(int32_t));
+}
+
+/*
+ * 播放线程实时配置（audio.realtime），在播放线程内调用
+ * SCHED_FIFO 优先级、锁定播放缓冲、绑定 CPU，并预先触碰栈和输出缓冲，稳定播放时不再缺页
+ */
+void outputRealtime(AudioEntry *me)
+{
+    struct audioOutput *out = &me->out;
+
+    if (!mdf_get_bool_value(g_config, "audio.realtime.enable", false)) return;
+
+    int priority = mdf_get_int_value(g_config, "audio.realtime.priority", 60);
+    struct sched_param param = {.sched_priority = priority};
+    int rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rv != 0) mtc_mt_warn("set SCHED_FIFO %d failure %s", priority, strerror(rv));
+
+    if (out->rt_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(out->rt_cpu, &cpus);
+        rv = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (rv != 0) mtc_mt_warn("bind to cpu %d failure %s", out->rt_cpu, strerror(rv));
+    }
+
+    size_t bytes = OUTPUT_STAGE_FRAMES * OUTPUT_MAX_CHANNELS * sizeof(int32_t);
+    memset(out->stage, 0x0, bytes);
+    memset(out->scratch, 0x0, bytes);
+    memset(out->widen, 0x0, bytes);
+    memset(out->upmix, 0x0, OUTPUT_STAGE_FRAMES * 2 * sizeof(int32_t));
+
+    if (mdf_get_bool_value(g_config, "audio.realtime.mlock", true)) {
+        out->mlock = true;
+        _output_pin(out, out->stage, bytes);
+        _output_pin(out, out->scratch, bytes);
+        _output_pin(out, out->widen, bytes);
+        _output_pin(out, out->upmix, OUTPUT_STAGE_FRAMES * 2 * sizeof(int32_t));
+        _output_pin_resampler(out, true);
+
+        /* 预先触碰并锁定播放线程将用到的栈 */
+        volatile uint8_t stack[256 * 1024];
+        for (size_t i = 0; i < sizeof(stack); i += 4096) stack[i] = 0;
+        _output_pin(out, (void*)stack, sizeof(stack));
+    }
+
+    mtc_mt_dbg("realtime priority %d, cpu %d", priority, out->rt_cpu);
+}
+
+/* 其他工作线程（索引等）避开播放线程独占的 CPU，子线程会继承 */
+void outputYieldCPU(AudioEntry *me)
+{
+    if (me->out.rt_cpu < 0) return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < ncpu && i < CPU_SETSIZE; i++) {
+        if (i != me->out.rt_cpu) CPU_SET(i, &cpus);
+    }
+
+    int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rv != 0) mtc_mt_warn("keep off cpu %d failure %s", me->out.rt_cpu, strerror(rv));
+}
+
+/* 停止当前输出，丢弃缓冲区中的数据 */
+void outputDrop(AudioEntry *me)
+{
+    switch (snd_pcm_state(me->pcm)) {
+    case SND_PCM_STATE_RUNNING:
+        snd_pcm_drop(me->pcm);
+        break;
+    case SND_PCM_STATE_XRUN:
+        snd_pcm_prepare(me->pcm);
+        break;
+    default:
+        break;
+    }
+}
+
+/* 配置声卡硬件参数，channels 为期望声道数（单声道可能被提升为双声道） */
+static bool _output_hw(AudioEntry *me, int channels, int hz, snd_pcm_format_t *formats)
+{
+    struct audioOutput *out = &me->out;
+    snd_pcm_t *pcm = me->pcm;
+    snd_pcm_hw_params_t *hwparams;
+    snd_pcm_sw_params_t *swparams;
+    int rv;
+
+    outputDrop(me);
+
+    snd_pcm_hw_params_alloca(&hwparams);
+    snd_pcm_hw_params_any(pcm, hwparams);
+
+    if (snd_pcm_hw_params_set_access(pcm, hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0) {
+        out->mmap = true;
+    } else {
+        out->mmap = false;
+        rv = snd_pcm_hw_params_set_access(pcm, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED);
+        if (rv < 0) {
+            mtc_mt_err("can't set access. %s", snd_strerror(rv));
+            goto error;
+        }
+    }
+
+    out->format = SND_PCM_FORMAT_UNKNOWN;
+    for (int i = 0; i < 3; i++) {
+        if (snd_pcm_hw_params_test_format(pcm, hwparams, formats[i]) == 0) {
+            out->format = formats[i];
+            break;
+        }
+    }
+    if (out->format == SND_PCM_FORMAT_UNKNOWN) {
+        mtc_mt_err("no usable sample format on %s", out->device);
+        goto error;
+    }
+
+    /* 很多 I2S 声卡（如 WM8960）只支持双声道，单声道音源由我们扩展 */
+    int devchannels = channels;
+    if (snd_pcm_hw_params_test_channels(pcm, hwparams, channels) != 0 && channels == 1) devchannels = 2;
+
+    unsigned int rate = hz, buffer_time = OUTPUT_BUFFER_TIME, period_time = OUTPUT_BUFFER_TIME / 4;
+    if ((rv = snd_pcm_hw_params_set_format(pcm, hwparams, out->format)) < 0 ||
+        (rv = snd_pcm_hw_params_set_channels(pcm, hwparams, devchannels)) < 0 ||
+        (rv = snd_pcm_hw_params_set_rate_resample(pcm, hwparams, 0)) < 0 ||
+        (rv = snd_pcm_hw_params_set_rate_near(pcm, hwparams, &rate, NULL)) < 0 ||
+        (rv = snd_pcm_hw_params_set_buffer_time_near(pcm, hwparams, &buffer_time, NULL)) < 0 ||
+        (rv = snd_pcm_hw_params_set_period_time_near(pcm, hwparams, &period_time, NULL)) < 0 ||
+        (rv = snd_pcm_hw_params(pcm, hwparams)) < 0) {
+        mtc_mt_err("can't set parameter. %s", snd_strerror(rv));
+        goto error;
+    }
+
+    if (rate != (unsigned int)hz) mtc_mt_warn("rate %d not supported, got %u", hz, rate);
+
+    snd_pcm_hw_params_get_buffer_size(hwparams, &out->buffer_size);
+    snd_pcm_hw_params_get_period_size(hwparams, &out->period_size, NULL);
+
+    snd_pcm_sw_params_alloca(&swparams);
+    snd_pcm_sw_params_current(pcm, swparams);
+    snd_pcm_sw_params_set_start_threshold(pcm, swparams,
+                                          out->buffer_size / out->period_size * out->period_size);
+    snd_pcm_sw_params_set_avail_min(pcm, swparams, out->period_size);
+    if ((rv = snd_pcm_sw_params(pcm, swparams)) < 0) {
+        mtc_mt_err("can't set sw parameter. %s", snd_strerror(rv));
+        goto error;
+    }
+
+    out->channels = devchannels;
+    out->rate = rate;
+
+    mtc_mt_dbg("%s %s %s %d channels %dHZ, buffer %lu, period %lu", out->device,
+               snd_pcm_format_name(out->format), out->mmap ? "MMAP" : "RW", out->channels,
+               out->rate, out->buffer_size, out->period_size);
+
+    return true;
+
+error:
+    out->format = SND_PCM_FORMAT_UNKNOWN;
+    return false;
+}
+
+/*
+ * 按音源参数配置声卡，参数未变化时直接返回
+ * bits 为音源位宽，决定格式的优先顺序。
+ * 固定输出采样率模式下（audio.fixed_rate），声卡只在声道数变化时重新配置，采样率不同的音源
+ * 在进程内重采样，避免切歌时 drop + 重新配置造成的停顿。
+ * 配置后 me->out.format 为声卡格式，me->out.sformat 为解码器应输出的格式（s16 或 s32），
+ * me->out.direct 表示解码器可直接写入 outputBegin() 返回的区域
+ */
+bool outputSetup(AudioEntry *me, int channels, int hz, int bits)
+{
+    struct audioOutput *out = &me->out;
+
+    if (channels <= 0 || channels > OUTPUT_MAX_CHANNELS) {
+        mtc_mt_err("%d channels not supported", channels);
+        return false;
+    }
+
+    if (out->format != SND_PCM_FORMAT_UNKNOWN &&
+        out->src_channels == channels && out->hz == hz && out->bits == bits) return true;
+
+    mtc_mt_dbg("set pcm params %d %dHZ %dbits", channels, hz, bits);
+
+    snd_pcm_format_t *formats = bits <= 16 ? m_formats_16 : (bits <= 24 ? m_formats_24 : m_formats_32);
+
+    if (out->fixed_rate > 0) {
+        /* 重采样输出精度高于 16 位，按 24 位挑选格式 */
+        int devchannels = channels <= 2 ? 2 : channels;
+        if (out->format == SND_PCM_FORMAT_UNKNOWN ||
+            out->channels != devchannels || out->rate != out->fixed_rate) {
+            if (!_output_hw(me, devchannels, out->fixed_rate, m_formats_24)) return false;
+        }
+    } else if (!_output_hw(me, channels, hz, formats)) return false;
+
+    _output_pin_resampler(out, false);
+    resamplerFree(out->resampler);
+    out->resampler = NULL;
+    if (out->rate != hz) {
+        out->resampler = resamplerCreate(hz, out->rate, channels,
+                                         mdf_get_value(g_config, "audio.resample_quality", "medium"));
+        if (out->resampler) {
+            mos_free(out->resampled);
+            out->resampled = mos_calloc(resamplerMaxOutput(out->resampler), channels * sizeof(int32_t));
+            _output_pin_resampler(out, true);
+        } else if (!_output_hw(me, channels, hz, formats)) return false;
+    }
+
+    out->src_channels = channels;
+    out->hz = hz;
+    out->bits = bits;
+
+    /* 16 位声卡播放 16 位音源时解码 s16，其余情况一律解码 s32（变窄时抖动） */
+    if (out->format == SND_PCM_FORMAT_S16_LE && bits <= 16 && !out->resampler)
+        out->sformat = SND_PCM_FORMAT_S16_LE;
+    else out->sformat = SND_PCM_FORMAT_S32_LE;
+    out->direct = !out->resampler && out->sformat == out->format && out->channels == out->src_channels;
+
+    return true;
+}
+
+/* 软件音量 0.0 ~ 1.0，在提交时作用于声卡格式的数据 */
+void outputGain(AudioEntry *me, float gain)
+{
+    me->out.gain = gain < 0 ? 0 : (gain > 1.0 ? 1.0 : gain);
+}
+
+static int _output_recover(AudioEntry *me, int err)
+{
+    if (err == -EPIPE) {
+        me->out.xruns++;
+        mtc_mt_warn("XRUN %ju", (uintmax_t)me->out.xruns);
+    }
+
+    return snd_pcm_recover(me->pcm, err, 1);
+}
+
+/*
+ * 获取可写区域（格式为 me->out.format），*frames 传入期望帧数，返回实际可写帧数
+ * 写完后须调用 outputCommit()
+ */
+void* outputBegin(AudioEntry *me, snd_pcm_uframes_t *frames)
+{
+    struct audioOutput *out = &me->out;
+    snd_pcm_t *pcm = me->pcm;
+    int rv;
+
+    if (*frames > OUTPUT_STAGE_FRAMES) *frames = OUTPUT_STAGE_FRAMES;
+
+    if (!out->mmap) {
+        out->area = out->stage;
+        return out->area;
+    }
+
+    while (true) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0) {
+            if ((rv = _output_recover(me, avail)) < 0) {
+                mtc_mt_err("recover failure %s", snd_strerror(rv));
+                return NULL;
+            }
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t)avail < out->period_size) {
+            if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+                /* 缓冲区已满但尚未启动 */
+                if ((rv = snd_pcm_start(pcm)) < 0) {
+                    mtc_mt_err("start failure %s", snd_strerror(rv));
+                    return NULL;
+                }
+            } else if ((rv = snd_pcm_wait(pcm, 1000)) < 0) {
+                if ((rv = _output_recover(me, rv)) < 0) return NULL;
+            }
+            continue;
+        }
+
+        const snd_pcm_channel_area_t *areas;
+        if ((rv = snd_pcm_mmap_begin(pcm, &areas, &out->mmap_offset, frames)) < 0) {
+            if ((rv = _output_recover(me, rv)) < 0) return NULL;
+            continue;
+        }
+
+        out->area = (uint8_t*)areas[0].addr + (areas[0].first + out->mmap_offset * areas[0].step) / 8;
+        return out->area;
+    }
+}
+
+/* 返回提交的帧数，出错返回负值 */
+snd_pcm_sframes_t outputCommit(AudioEntry *me, snd_pcm_uframes_t frames)
+{
+    struct audioOutput *out = &me->out;
+    snd_pcm_t *pcm = me->pcm;
+    snd_pcm_sframes_t rv;
+
+    if (frames > 0 && out->gain < 1.0) pcmGain(out->area, out->format, frames * out->channels, out->gain);
+
+    if (!out->mmap) {
+        uint8_t *buf = out->stage;
+        snd_pcm_uframes_t remain = frames;
+        while (remain > 0) {
+            rv = snd_pcm_writei(pcm, buf, remain);
+            if (rv < 0) {
+                if (_output_recover(me, rv) < 0) return rv;
+                continue;
+            }
+            buf += rv * _frame_bytes(out);
+            remain -= rv;
+        }
+
+        return frames;
+    }
+
+    rv = snd_pcm_mmap_commit(pcm, out->mmap_offset, frames);
+    if (rv < 0 || (snd_pcm_uframes_t)rv != frames) {
+        _output_recover(me, rv >= 0 ? -EPIPE : rv);
+        return rv;
+    }
+
+    if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED &&
+        out->buffer_size - snd_pcm_avail_update(pcm) >= out->buffer_size / 2) {
+        snd_pcm_start(pcm);
+    }
+
+    return rv;
+}
+
+/*
+ * 音源数据可以原样交给声卡：格式、声道、采样率都一致，也不需要软件音量
+ * 此时用 outputPCM() 写入，不经过任何转换
+ */
+bool outputPassthrough(AudioEntry *me, snd_pcm_format_t format)
+{
+    struct audioOutput *out = &me->out;
+
+    return out->format == format && !out->resampler &&
+        out->channels == out->src_channels && out->gain >= 1.0;
+}
+
+/* 写入 frames 帧声卡格式的数据，RW 访问时直接从 buf 写入，不经中转缓冲 */
+snd_pcm_sframes_t outputPCM(AudioEntry *me, const void *buf, snd_pcm_uframes_t frames)
+{
+    struct audioOutput *out = &me->out;
+    size_t fbytes = _frame_bytes(out);
+    snd_pcm_uframes_t done = 0;
+    snd_pcm_sframes_t rv;
+
+    while (done < frames) {
+        const uint8_t *src = (const uint8_t*)buf + done * fbytes;
+
+        if (out->mmap) {
+            snd_pcm_uframes_t count = frames - done;
+            uint8_t *dst = outputBegin(me, &count);
+            if (!dst) return -EIO;
+
+            memcpy(dst, src, count * fbytes);
+            rv = outputCommit(me, count);
+        } else {
+            rv = snd_pcm_writei(me->pcm, src, frames - done);
+            if (rv < 0) {
+                if ((rv = _output_recover(me, rv)) < 0) return rv;
+                continue;
+            }
+        }
+
+        if (rv < 0) return rv;
+        done += rv;
+    }
+
+    return done;
+}
+
+/* 非直接输出时的解码缓冲（me->out.sformat 格式，音源声道数） */
+void* outputBuffer(AudioEntry *me, snd_pcm_uframes_t *frames)
+{
+    if (*frames > OUTPUT_STAGE_FRAMES) *frames = OUTPUT_STAGE_FRAMES;
+
+    return me->out.scratch;
+}
+
+static snd_pcm_sframes_t _output_write(AudioEntry *me, const void *buf, snd_pcm_format_t format,
+                                       int channels, snd_pcm_uframes_t frames)
+{
+    struct audioOutput *out = &me->out;
+    size_t srcbytes = channels * snd_pcm_format_physical_width(format) / 8;
+    snd_pcm_uframes_t done = 0;
+
+    if (channels != out->channels && !(channels == 1 && out->channels == 2)) return -EINVAL;
+
+    while (done < frames) {
+        snd_pcm_uframes_t count = frames - done;
+        uint8_t *dst = outputBegin(me, &count);
+        if (!dst) return -EIO;
+
+        const void *src = (const uint8_t*)buf + done * srcbytes;
+        if (channels != out->channels) {
+            if (format == SND_PCM_FORMAT_S16_LE) pcmUpmixS16(out->upmix, src, count);
+            else pcmUpmixS32(out->upmix, src, count);
+            src = out->upmix;
+        }
+
+        if (!pcmConvert(dst, out->format, src, format, count * out->channels, out->dither)) {
+            outputCommit(me, 0);
+            return -EINVAL;
+        }
+
+        snd_pcm_sframes_t rv = outputCommit(me, count);
+        if (rv < 0) return rv;
+
+        done += rv;
+    }
+
+    return done;
+}
+
+/*
+ * 写入 frames 帧 format 格式、channels 声道的数据，（重采样、）转换成声卡格式及声道数
+ * 供无法直接解码至输出缓冲区的情况使用，返回消耗的输入帧数
+ */
+snd_pcm_sframes_t outputWrite(AudioEntry *me, const void *buf, snd_pcm_format_t format,
+                              int channels, snd_pcm_uframes_t frames)
+{
+    struct audioOutput *out = &me->out;
+
+    if (!out->resampler) return _output_write(me, buf, format, channels, frames);
+
+    /* 立体声流中夹杂的单声道帧（MP3）先升为立体声再重采样 */
+    int rschannels = out->resampler->channels;
+    if (channels != rschannels && !(channels == 1 && rschannels == 2)) return -EINVAL;
+
+    size_t srcbytes = channels * snd_pcm_format_physical_width(format) / 8;
+    snd_pcm_uframes_t done = 0;
+    while (done < frames) {
+        snd_pcm_uframes_t count = frames - done;
+        if (count > RESAMPLE_IN_FRAMES) count = RESAMPLE_IN_FRAMES;
+
+        const int32_t *src = (const int32_t*)((const uint8_t*)buf + done * srcbytes);
+        if (format == SND_PCM_FORMAT_S16_LE) {
+            pcmS16ToS32(out->widen, (const int16_t*)src, count * channels);
+            src = out->widen;
+        } else if (format != SND_PCM_FORMAT_S32_LE) return -EINVAL;
+
+        if (channels != rschannels) {
+            pcmUpmixS32(out->upmix, src, count);
+            src = out->upmix;
+        }
+
+        size_t outframes = resamplerProcess(out->resampler, src, count, out->resampled);
+        snd_pcm_sframes_t rv = _output_write(me, out->resampled, SND_PCM_FORMAT_S32_LE, rschannels, outframes);
+        if (rv < 0) return rv;
+
+        done += count;
+    }
+
+    return done;
+}
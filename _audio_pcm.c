@@ -0,0 +1,508 @@
+/*
+ * PCM 样本转换
+ * 格式转换（s16/s24/s32）、单声道扩展为立体声、位宽变窄时的 TPDF 抖动、软件音量。
+ * 各函数有 NEON / SSE2 实现，其余平台（及不便向量化的部分）用标量实现
+ * s24 指 S24_3LE 紧凑格式，s32 样本高位对齐
+ */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_NEON 1
+#define PCM_ARCH "NEON"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_SSE2 1
+#define PCM_ARCH "SSE2"
+#else
+#define PCM_ARCH "scalar"
+#endif
+
+static inline uint32_t _xorshift(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static inline int16_t _clamp16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+}
+
+/*
+ * ================ scalar ================
+ */
+static void _s16_to_s32_c(int32_t *dst, const int16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) dst[i] = (int32_t)src[i] * 65536;
+}
+
+static void _s16_to_s24_c(uint8_t *dst, const int16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[3*i]   = 0;
+        dst[3*i+1] = src[i] & 0xFF;
+        dst[3*i+2] = (src[i] >> 8) & 0xFF;
+    }
+}
+
+/* seed 为 4 个通道的随机数种子，NULL 时不加抖动（四舍五入） */
+static void _s32_to_s16_c(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed)
+{
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = src[i] >> 8;
+        if (seed) {
+            uint32_t r = _xorshift(&seed[i & 3]);
+            v += ((int32_t)(r & 0xFFFF) - (int32_t)(r >> 16)) >> 8;
+        } else v += 128;
+        dst[i] = _clamp16(v >> 8);
+    }
+}
+
+static void _s32_to_s24_c(uint8_t *dst, const int32_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[3*i]   = (src[i] >> 8) & 0xFF;
+        dst[3*i+1] = (src[i] >> 16) & 0xFF;
+        dst[3*i+2] = (src[i] >> 24) & 0xFF;
+    }
+}
+
+static void _upmix_s16_c(int16_t *dst, const int16_t *src, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) dst[2*i] = dst[2*i+1] = src[i];
+}
+
+static void _upmix_s32_c(int32_t *dst, const int32_t *src, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) dst[2*i] = dst[2*i+1] = src[i];
+}
+
+static void _gain_s16_c(int16_t *buf, size_t n, int16_t q15)
+{
+    for (size_t i = 0; i < n; i++) buf[i] = _clamp16(((int32_t)buf[i] * q15 + 16384) >> 15);
+}
+
+static void _gain_s32_c(int32_t *buf, size_t n, int32_t q31)
+{
+    for (size_t i = 0; i < n; i++) buf[i] = ((int64_t)buf[i] * q31 + (1LL << 30)) >> 31;
+}
+
+static void _gain_s24_c(uint8_t *buf, size_t n, int32_t q31)
+{
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = (int32_t)((uint32_t)buf[3*i] << 8 | (uint32_t)buf[3*i+1] << 16 |
+                              (uint32_t)buf[3*i+2] << 24);
+        v = ((int64_t)v * q31 + (1LL << 30)) >> 31;
+        buf[3*i]   = (v >> 8) & 0xFF;
+        buf[3*i+1] = (v >> 16) & 0xFF;
+        buf[3*i+2] = (v >> 24) & 0xFF;
+    }
+}
+
+/*
+ * ================ SIMD ================
+ * 处理整块部分，尾巴交给标量实现，返回已处理的样本数
+ */
+#if defined(PCM_NEON)
+static size_t _s16_to_s32_v(int32_t *dst, const int16_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(dst + i,     vshll_n_s16(vget_low_s16(v), 16));
+        vst1q_s32(dst + i + 4, vshll_n_s16(vget_high_s16(v), 16));
+    }
+    return i;
+}
+
+static size_t _s16_to_s24_v(uint8_t *dst, const int16_t *src, size_t n)
+{
+    size_t i = 0;
+    uint8x16x3_t out;
+    out.val[0] = vdupq_n_u8(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t in = vld2q_u8((const uint8_t*)(src + i));
+        out.val[1] = in.val[0];
+        out.val[2] = in.val[1];
+        vst3q_u8(dst + 3 * i, out);
+    }
+    return i;
+}
+
+static inline int16x4_t _narrow_neon(int32x4_t v, int32x4_t noise)
+{
+    v = vaddq_s32(vshrq_n_s32(v, 8), noise);
+    return vqmovn_s32(vshrq_n_s32(v, 8));
+}
+
+static size_t _s32_to_s16_v(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed)
+{
+    size_t i = 0;
+    if (seed) {
+        uint32x4_t s = vld1q_u32(seed);
+        for (; i + 8 <= n; i += 8) {
+            int32x4_t noise[2];
+            for (int k = 0; k < 2; k++) {
+                s = veorq_u32(s, vshlq_n_u32(s, 13));
+                s = veorq_u32(s, vshrq_n_u32(s, 17));
+                s = veorq_u32(s, vshlq_n_u32(s, 5));
+                int32x4_t u1 = vreinterpretq_s32_u32(vandq_u32(s, vdupq_n_u32(0xFFFF)));
+                int32x4_t u2 = vreinterpretq_s32_u32(vshrq_n_u32(s, 16));
+                noise[k] = vshrq_n_s32(vsubq_s32(u1, u2), 8);
+            }
+            int16x4_t a = _narrow_neon(vld1q_s32(src + i), noise[0]);
+            int16x4_t b = _narrow_neon(vld1q_s32(src + i + 4), noise[1]);
+            vst1q_s16(dst + i, vcombine_s16(a, b));
+        }
+        vst1q_u32(seed, s);
+    } else {
+        int32x4_t round = vdupq_n_s32(128);
+        for (; i + 8 <= n; i += 8) {
+            int16x4_t a = _narrow_neon(vld1q_s32(src + i), round);
+            int16x4_t b = _narrow_neon(vld1q_s32(src + i + 4), round);
+            vst1q_s16(dst + i, vcombine_s16(a, b));
+        }
+    }
+    return i;
+}
+
+static size_t _s32_to_s24_v(uint8_t *dst, const int32_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t in = vld4q_u8((const uint8_t*)(src + i));
+        uint8x16x3_t out = {{in.val[1], in.val[2], in.val[3]}};
+        vst3q_u8(dst + 3 * i, out);
+    }
+    return i;
+}
+
+static size_t _upmix_s16_v(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        int16x8x2_t out = {{v, v}};
+        vst2q_s16(dst + 2 * i, out);
+    }
+    return i;
+}
+
+static size_t _upmix_s32_v(int32_t *dst, const int32_t *src, size_t frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        int32x4_t v = vld1q_s32(src + i);
+        int32x4x2_t out = {{v, v}};
+        vst2q_s32(dst + 2 * i, out);
+    }
+    return i;
+}
+
+static size_t _gain_s16_v(int16_t *buf, size_t n, int16_t q15)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) vst1q_s16(buf + i, vqrdmulhq_n_s16(vld1q_s16(buf + i), q15));
+    return i;
+}
+
+static size_t _gain_s32_v(int32_t *buf, size_t n, int32_t q31)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) vst1q_s32(buf + i, vqrdmulhq_n_s32(vld1q_s32(buf + i), q31));
+    return i;
+}
+
+#elif defined(PCM_SSE2)
+static size_t _s16_to_s32_v(int32_t *dst, const int16_t *src, size_t n)
+{
+    size_t i = 0;
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i),     _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+    return i;
+}
+
+/* SSE2 没有字节重排指令，紧凑 24 位交给标量 */
+static size_t _s16_to_s24_v(uint8_t *dst, const int16_t *src, size_t n)
+{
+    return 0;
+}
+
+static inline __m128i _narrow_sse2(__m128i a, __m128i b, __m128i na, __m128i nb)
+{
+    a = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(a, 8), na), 8);
+    b = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(b, 8), nb), 8);
+    return _mm_packs_epi32(a, b);
+}
+
+static size_t _s32_to_s16_v(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed)
+{
+    size_t i = 0;
+    if (seed) {
+        __m128i s = _mm_loadu_si128((const __m128i*)seed);
+        __m128i mask = _mm_set1_epi32(0xFFFF);
+        for (; i + 8 <= n; i += 8) {
+            __m128i noise[2];
+            for (int k = 0; k < 2; k++) {
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+                s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+                __m128i u1 = _mm_and_si128(s, mask);
+                __m128i u2 = _mm_srli_epi32(s, 16);
+                noise[k] = _mm_srai_epi32(_mm_sub_epi32(u1, u2), 8);
+            }
+            __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+            _mm_storeu_si128((__m128i*)(dst + i), _narrow_sse2(a, b, noise[0], noise[1]));
+        }
+        _mm_storeu_si128((__m128i*)seed, s);
+    } else {
+        __m128i round = _mm_set1_epi32(128);
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+            _mm_storeu_si128((__m128i*)(dst + i), _narrow_sse2(a, b, round, round));
+        }
+    }
+    return i;
+}
+
+static size_t _s32_to_s24_v(uint8_t *dst, const int32_t *src, size_t n)
+{
+    return 0;
+}
+
+static size_t _upmix_s16_v(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i),     _mm_unpacklo_epi16(v, v));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 8), _mm_unpackhi_epi16(v, v));
+    }
+    return i;
+}
+
+static size_t _upmix_s32_v(int32_t *dst, const int32_t *src, size_t frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i),     _mm_unpacklo_epi32(v, v));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 4), _mm_unpackhi_epi32(v, v));
+    }
+    return i;
+}
+
+static size_t _gain_s16_v(int16_t *buf, size_t n, int16_t q15)
+{
+    size_t i = 0;
+    __m128i g = _mm_set1_epi16(q15), round = _mm_set1_epi32(16384);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i lo = _mm_mullo_epi16(v, g), hi = _mm_mulhi_epi16(v, g);
+        __m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), 15);
+        __m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), 15);
+        _mm_storeu_si128((__m128i*)(buf + i), _mm_packs_epi32(a, b));
+    }
+    return i;
+}
+
+/* SSE2 没有有符号 32 位乘法取高位，交给标量 */
+static size_t _gain_s32_v(int32_t *buf, size_t n, int32_t q31)
+{
+    return 0;
+}
+
+#else
+static size_t _s16_to_s32_v(int32_t *dst, const int16_t *src, size_t n) {return 0;}
+static size_t _s16_to_s24_v(uint8_t *dst, const int16_t *src, size_t n) {return 0;}
+static size_t _s32_to_s16_v(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed) {return 0;}
+static size_t _s32_to_s24_v(uint8_t *dst, const int32_t *src, size_t n) {return 0;}
+static size_t _upmix_s16_v(int16_t *dst, const int16_t *src, size_t frames) {return 0;}
+static size_t _upmix_s32_v(int32_t *dst, const int32_t *src, size_t frames) {return 0;}
+static size_t _gain_s16_v(int16_t *buf, size_t n, int16_t q15) {return 0;}
+static size_t _gain_s32_v(int32_t *buf, size_t n, int32_t q31) {return 0;}
+#endif
+
+/*
+ * ================ public ================
+ * n 为样本数（帧数 * 声道数）
+ */
+void pcmS16ToS32(int32_t *dst, const int16_t *src, size_t n)
+{
+    size_t i = _s16_to_s32_v(dst, src, n);
+    _s16_to_s32_c(dst + i, src + i, n - i);
+}
+
+void pcmS16ToS24(uint8_t *dst, const int16_t *src, size_t n)
+{
+    size_t i = _s16_to_s24_v(dst, src, n);
+    _s16_to_s24_c(dst + 3 * i, src + i, n - i);
+}
+
+/* seed 不为 NULL 时加 TPDF 抖动（uint32_t[4]，由调用者维护） */
+void pcmS32ToS16(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed)
+{
+    size_t i = _s32_to_s16_v(dst, src, n, seed);
+    _s32_to_s16_c(dst + i, src + i, n - i, seed);
+}
+
+void pcmS32ToS24(uint8_t *dst, const int32_t *src, size_t n)
+{
+    size_t i = _s32_to_s24_v(dst, src, n);
+    _s32_to_s24_c(dst + 3 * i, src + i, n - i);
+}
+
+void pcmUpmixS16(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i = _upmix_s16_v(dst, src, frames);
+    _upmix_s16_c(dst + 2 * i, src + i, frames - i);
+}
+
+void pcmUpmixS32(int32_t *dst, const int32_t *src, size_t frames)
+{
+    size_t i = _upmix_s32_v(dst, src, frames);
+    _upmix_s32_c(dst + 2 * i, src + i, frames - i);
+}
+
+/* gain 为 0.0 ~ 1.0 */
+void pcmGain(void *buf, snd_pcm_format_t format, size_t n, float gain)
+{
+    size_t i;
+
+    if (gain >= 1.0) return;
+    if (gain < 0) gain = 0;
+
+    switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+        i = _gain_s16_v(buf, n, gain * INT16_MAX);
+        _gain_s16_c((int16_t*)buf + i, n - i, gain * INT16_MAX);
+        break;
+    case SND_PCM_FORMAT_S32_LE:
+        i = _gain_s32_v(buf, n, gain * INT32_MAX);
+        _gain_s32_c((int32_t*)buf + i, n - i, gain * INT32_MAX);
+        break;
+    case SND_PCM_FORMAT_S24_3LE:
+        _gain_s24_c(buf, n, gain * INT32_MAX);
+        break;
+    default:
+        break;
+    }
+}
+
+/* 样本格式转换，seed 用于位宽变窄时的抖动 */
+bool pcmConvert(void *dst, snd_pcm_format_t dformat,
+                const void *src, snd_pcm_format_t sformat, size_t n, uint32_t *seed)
+{
+    if (dformat == sformat) {
+        memcpy(dst, src, n * snd_pcm_format_physical_width(sformat) / 8);
+        return true;
+    }
+
+    if (sformat == SND_PCM_FORMAT_S16_LE) {
+        if (dformat == SND_PCM_FORMAT_S32_LE) pcmS16ToS32(dst, src, n);
+        else if (dformat == SND_PCM_FORMAT_S24_3LE) pcmS16ToS24(dst, src, n);
+        else return false;
+    } else if (sformat == SND_PCM_FORMAT_S32_LE) {
+        if (dformat == SND_PCM_FORMAT_S16_LE) pcmS32ToS16(dst, src, n, seed);
+        else if (dformat == SND_PCM_FORMAT_S24_3LE) pcmS32ToS24(dst, src, n);
+        else return false;
+    } else return false;
+
+    return true;
+}
+
+/*
+ * ================ benchmark ================
+ * trace.benchmark 打开时，播放线程启动前跑一遍，日志输出各转换函数每秒处理的帧数（立体声）
+ */
+#define BENCH_FRAMES 4096
+#define BENCH_ROUNDS 2000
+#define BENCH_MP3_SAMPLES 2304      /* MINIMP3_MAX_SAMPLES_PER_FRAME */
+
+static uint32_t m_bench_seed[4] = {0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321};
+
+static void _bench_legacy_mp3(void *dst, const void *src, size_t n)
+{
+    /* 原 _iterate_callback：每帧清空整个 psamples 后解码（此处用拷贝代替解码） */
+    for (size_t i = 0; i < n; i += BENCH_MP3_SAMPLES) {
+        size_t len = n - i > BENCH_MP3_SAMPLES ? BENCH_MP3_SAMPLES : n - i;
+        memset((int16_t*)dst + i, 0x0, BENCH_MP3_SAMPLES * sizeof(int16_t));
+        memcpy((int16_t*)dst + i, (int16_t*)src + i, len * sizeof(int16_t));
+    }
+}
+static void _bench_legacy_narrow(void *dst, const void *src, size_t n)
+{
+    /* 原 flac/wav 路径：一律解码为 s32，由 plug 层截断为 s16 */
+    for (size_t i = 0; i < n; i++) ((int16_t*)dst)[i] = ((int32_t*)src)[i] >> 16;
+}
+static void _bench_mp3(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n * sizeof(int16_t));
+}
+static void _bench_s16_s32_c(void *dst, const void *src, size_t n) {_s16_to_s32_c(dst, src, n);}
+static void _bench_s16_s32(void *dst, const void *src, size_t n) {pcmS16ToS32(dst, src, n);}
+static void _bench_s16_s24_c(void *dst, const void *src, size_t n) {_s16_to_s24_c(dst, src, n);}
+static void _bench_s16_s24(void *dst, const void *src, size_t n) {pcmS16ToS24(dst, src, n);}
+static void _bench_s32_s16_c(void *dst, const void *src, size_t n) {_s32_to_s16_c(dst, src, n, m_bench_seed);}
+static void _bench_s32_s16(void *dst, const void *src, size_t n) {pcmS32ToS16(dst, src, n, m_bench_seed);}
+static void _bench_s32_s24_c(void *dst, const void *src, size_t n) {_s32_to_s24_c(dst, src, n);}
+static void _bench_s32_s24(void *dst, const void *src, size_t n) {pcmS32ToS24(dst, src, n);}
+static void _bench_upmix_c(void *dst, const void *src, size_t n) {_upmix_s16_c(dst, src, n / 2);}
+static void _bench_upmix(void *dst, const void *src, size_t n) {pcmUpmixS16(dst, src, n / 2);}
+static void _bench_gain_c(void *dst, const void *src, size_t n) {_gain_s16_c(dst, n, 20000);}
+static void _bench_gain(void *dst, const void *src, size_t n) {pcmGain(dst, SND_PCM_FORMAT_S16_LE, n, 0.6);}
+
+void pcmBenchmark()
+{
+    struct {
+        char *name;
+        void (*fn)(void *dst, const void *src, size_t n);
+    } cases[] = {
+        {"legacy mp3 memset+copy", _bench_legacy_mp3},
+        {"mp3 copy",               _bench_mp3},
+        {"legacy s32=>s16 trunc",  _bench_legacy_narrow},
+        {"s32=>s16 dither scalar", _bench_s32_s16_c},
+        {"s32=>s16 dither",        _bench_s32_s16},
+        {"s16=>s32 scalar",        _bench_s16_s32_c},
+        {"s16=>s32",               _bench_s16_s32},
+        {"s16=>s24 scalar",        _bench_s16_s24_c},
+        {"s16=>s24",               _bench_s16_s24},
+        {"s32=>s24 scalar",        _bench_s32_s24_c},
+        {"s32=>s24",               _bench_s32_s24},
+        {"upmix s16 scalar",       _bench_upmix_c},
+        {"upmix s16",              _bench_upmix},
+        {"gain s16 scalar",        _bench_gain_c},
+        {"gain s16",               _bench_gain},
+        {NULL, NULL}
+    };
+
+    size_t n = BENCH_FRAMES * 2;
+    int32_t *src = mos_calloc(n, sizeof(int32_t));
+    int32_t *dst = mos_calloc(n + BENCH_MP3_SAMPLES, sizeof(int32_t));
+    for (size_t i = 0; i < n; i++) src[i] = (int32_t)(mos_rand(65536) - 32768) * 65536;
+
+    mtc_mt_dbg("pcm kernels: %s", PCM_ARCH);
+
+    for (int i = 0; cases[i].name; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < BENCH_ROUNDS; j++) cases[i].fn(dst, src, n);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        mtc_mt_dbg("%-24s %12.0f frames/sec", cases[i].name,
+                   secs > 0 ? (double)BENCH_FRAMES * BENCH_ROUNDS / secs : 0);
+    }
+
+    mos_free(src);
+    mos_free(dst);
+}
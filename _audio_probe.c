@@ -0,0 +1,450 @@
+/*
+ * 文件探测缓存
+ * 以 (dev, inode) 为键，大小、修改时间判断是否过期，记录资源类型、媒体类型、TechInfo、ArtInfo、
+ * 媒体 ID 及封面有无，保存在 libroot/.avm/probe.cache。
+ * 未变化的文件，扫描、监控、目录浏览时不再重新 magic、mediaOpen、cueOpen。
+ * 以 inode 为键无法得知文件是否已删除，保存时按媒体库中的曲目 ID 清理已不存在的音频记录
+ */
+#define PROBE_MAGIC 0x45425250    /* "PRBE" */
+#define PROBE_VERSION 1
+
+struct probe_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserve;
+};
+
+/* 磁盘上的记录，后面依次跟着 lens 个字节的各字符串（不含结尾 0） */
+struct probe_record {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime;
+    int64_t  dirmtime;          /* 记录封面有无时所在目录的修改时间（封面可能来自目录下的图片） */
+    uint64_t samples;
+    int32_t  channels;
+    int32_t  hz;
+    int32_t  kbps;
+    uint32_t length;
+    uint8_t  asset;
+    uint8_t  media;
+    uint8_t  idver;
+    int8_t   cover;             /* -1 未知，0 没有，1 有 */
+    uint8_t  info;              /* TechInfo、ArtInfo 有效（索引时才解析，扫描时只判断类型） */
+    char     id[LEN_DOMMEID];
+    uint8_t  lens[5];           /* title, artist, album, year, track */
+};
+
+struct probe_entry {
+    char key[48];
+    struct probe_record rec;
+    char *strings[5];
+};
+
+static MHASH *m_probes = NULL;
+static bool m_probe_dirty = false;
+static pthread_mutex_t m_probe_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _probe_free(void *key, void *val)
+{
+    struct probe_entry *entry = val;
+    if (!entry) return;
+
+    for (int i = 0; i < 5; i++) mos_free(entry->strings[i]);
+    mos_free(entry);
+}
+
+static void _probe_filename(char *out, size_t outlen)
+{
+    snprintf(out, outlen, "%s.avm/probe.cache", mdf_get_value(g_config, "libraryRoot", ""));
+}
+
+static void _probe_key(struct stat *fs, char *key, size_t keylen)
+{
+    snprintf(key, keylen, "%jx:%jx", (uintmax_t)fs->st_dev, (uintmax_t)fs->st_ino);
+}
+
+/* 调用者持有 m_probe_lock */
+static void _probe_load()
+{
+    struct probe_header header;
+    struct probe_record rec;
+    char filename[PATH_MAX];
+
+    if (m_probes) return;
+
+    mhash_init(&m_probes, mhash_str_hash, mhash_str_comp, _probe_free);
+
+    _probe_filename(filename, sizeof(filename));
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != PROBE_MAGIC || header.version != PROBE_VERSION) {
+        mtc_mt_dbg("probe cache %s outdated", filename);
+        fclose(fp);
+        return;
+    }
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (fread(&rec, sizeof(rec), 1, fp) != 1) break;
+
+        struct probe_entry *entry = mos_calloc(1, sizeof(struct probe_entry));
+        entry->rec = rec;
+        entry->rec.id[LEN_DOMMEID-1] = 0;
+        snprintf(entry->key, sizeof(entry->key), "%jx:%jx", (uintmax_t)rec.dev, (uintmax_t)rec.ino);
+
+        bool ok = true;
+        for (int j = 0; j < 5; j++) {
+            entry->strings[j] = mos_calloc(1, rec.lens[j] + 1);
+            if (rec.lens[j] > 0 && fread(entry->strings[j], rec.lens[j], 1, fp) != 1) ok = false;
+        }
+
+        if (!ok) {
+            _probe_free(NULL, entry);
+            break;
+        }
+
+        mhash_insert(m_probes, entry->key, entry);
+    }
+
+    fclose(fp);
+
+    mtc_mt_dbg("%u probe records loaded", mhash_length(m_probes));
+}
+
+/* 调用者持有 m_probe_lock，文件有变化时返回 NULL */
+static struct probe_entry* _probe_lookup(struct stat *fs)
+{
+    char key[48];
+
+    _probe_load();
+
+    _probe_key(fs, key, sizeof(key));
+    struct probe_entry *entry = mhash_lookup(m_probes, key);
+    if (entry && entry->rec.size == (uint64_t)fs->st_size && entry->rec.mtime == (int64_t)fs->st_mtime)
+        return entry;
+
+    return NULL;
+}
+
+/* 调用者持有 m_probe_lock，已有记录（可能已过期）时重置 */
+static struct probe_entry* _probe_reset(struct stat *fs)
+{
+    char key[48];
+
+    _probe_load();
+
+    _probe_key(fs, key, sizeof(key));
+    struct probe_entry *entry = mhash_lookup(m_probes, key);
+    if (!entry) {
+        entry = mos_calloc(1, sizeof(struct probe_entry));
+        memcpy(entry->key, key, sizeof(key));
+        mhash_insert(m_probes, entry->key, entry);
+    } else {
+        for (int i = 0; i < 5; i++) mos_free(entry->strings[i]);
+    }
+
+    memset(&entry->rec, 0x0, sizeof(entry->rec));
+    entry->rec.dev = fs->st_dev;
+    entry->rec.ino = fs->st_ino;
+    entry->rec.size = fs->st_size;
+    entry->rec.mtime = fs->st_mtime;
+    entry->rec.cover = -1;
+
+    m_probe_dirty = true;
+
+    return entry;
+}
+
+static void _probe_fill(struct probe_entry *entry, MediaNode *mnode)
+{
+    TechInfo *tinfo = mnode->driver->tech_info_get(mnode);
+    ArtInfo *ainfo = mnode->driver->art_info_get(mnode);
+
+    entry->rec.media = mnode->driver->type;
+    entry->rec.info = 1;
+    if (tinfo) {
+        entry->rec.samples = tinfo->samples;
+        entry->rec.channels = tinfo->channels;
+        entry->rec.hz = tinfo->hz;
+        entry->rec.kbps = tinfo->kbps;
+        entry->rec.length = tinfo->length;
+    }
+
+    if (ainfo) {
+        char *values[5] = {ainfo->title, ainfo->artist, ainfo->album, ainfo->year, ainfo->track};
+        for (int i = 0; i < 5; i++) {
+            mos_free(entry->strings[i]);
+            entry->strings[i] = strndup(values[i], LEN_MEDIA_TOKEN - 1);
+            entry->rec.lens[i] = strlen(entry->strings[i]);
+        }
+    }
+
+    if (mnode->md5[0]) {
+        memcpy(entry->rec.id, mnode->md5, LEN_DOMMEID);
+        entry->rec.id[LEN_DOMMEID-1] = 0;
+        entry->rec.idver = mnode->idver;
+    }
+
+    m_probe_dirty = true;
+}
+
+/*
+ * 带缓存的 assetType()，音频文件须能被 mediaOpen() 打开才算 ASSET_AUDIO
+ * media 不为空时返回媒体类型。只打开文件，不解析信息（MP3 需遍历所有帧）
+ */
+ASSET_TYPE probeAssetType(const char *filename, MEDIA_TYPE *media)
+{
+    struct stat fs;
+
+    if (media) *media = MEDIA_UNKNOWN;
+    if (!filename || stat(filename, &fs) != 0) return ASSET_UNKNOWN;
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (entry) {
+        ASSET_TYPE asset = entry->rec.asset;
+        if (media) *media = entry->rec.media;
+        pthread_mutex_unlock(&m_probe_lock);
+        return asset;
+    }
+    pthread_mutex_unlock(&m_probe_lock);
+
+    MediaNode *mnode = NULL;
+    ASSET_TYPE asset = assetType(filename);
+    if (asset == ASSET_AUDIO) {
+        mnode = mediaOpen(filename);
+        if (!mnode) asset = ASSET_UNKNOWN;
+    }
+
+    pthread_mutex_lock(&m_probe_lock);
+    entry = _probe_reset(&fs);
+    entry->rec.asset = asset;
+    if (mnode) {
+        entry->rec.media = mnode->driver->type;
+        if (media) *media = entry->rec.media;
+    }
+    pthread_mutex_unlock(&m_probe_lock);
+
+    if (mnode) mnode->driver->close(mnode);
+
+    return asset;
+}
+
+/* 只查缓存，没有或已过期返回 MEDIA_UNKNOWN */
+MEDIA_TYPE probeMediaType(const char *filename)
+{
+    struct stat fs;
+    MEDIA_TYPE media = MEDIA_UNKNOWN;
+
+    if (!filename || stat(filename, &fs) != 0) return MEDIA_UNKNOWN;
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (entry && entry->rec.asset == ASSET_AUDIO) media = entry->rec.media;
+    pthread_mutex_unlock(&m_probe_lock);
+
+    return media;
+}
+
+/* 获取缓存的音频文件信息，没有或已过期返回 false */
+bool probeInfoGet(const char *filename, ProbeInfo *info)
+{
+    struct stat fs;
+    bool ret = false;
+
+    if (!filename || !info || stat(filename, &fs) != 0) return false;
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (entry && entry->rec.asset == ASSET_AUDIO && entry->rec.info) {
+        memset(info, 0x0, sizeof(ProbeInfo));
+        info->asset = entry->rec.asset;
+        info->media = entry->rec.media;
+        info->idver = entry->rec.idver;
+        memcpy(info->id, entry->rec.id, LEN_DOMMEID);
+        info->tinfo.samples = entry->rec.samples;
+        info->tinfo.channels = entry->rec.channels;
+        info->tinfo.hz = entry->rec.hz;
+        info->tinfo.kbps = entry->rec.kbps;
+        info->tinfo.length = entry->rec.length;
+
+        char *values[5] = {info->ainfo.title, info->ainfo.artist, info->ainfo.album,
+                           info->ainfo.year, info->ainfo.track};
+        for (int i = 0; i < 5; i++) {
+            if (entry->strings[i]) strncpy(values[i], entry->strings[i], LEN_MEDIA_TOKEN - 1);
+        }
+        info->ainfo.length = entry->rec.length;
+
+        ret = true;
+    }
+    pthread_mutex_unlock(&m_probe_lock);
+
+    return ret;
+}
+
+/* 用已打开的媒体文件更新缓存（包括已计算的 ID） */
+void probeMediaSet(MediaNode *mnode)
+{
+    struct stat fs;
+
+    if (!mnode || stat(mnode->filename, &fs) != 0) return;
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (!entry) entry = _probe_reset(&fs);
+    entry->rec.asset = ASSET_AUDIO;
+    _probe_fill(entry, mnode);
+    pthread_mutex_unlock(&m_probe_lock);
+}
+
+static int64_t _dir_mtime(const char *filename)
+{
+    struct stat fs;
+    char dirname[PATH_MAX];
+
+    snprintf(dirname, sizeof(dirname), "%s", filename);
+    char *p = strrchr(dirname, '/');
+    if (p) *p = 0;
+
+    if (stat(p ? dirname : ".", &fs) != 0) return -1;
+
+    return fs.st_mtime;
+}
+
+/* 返回 1 有封面，0 没有，-1 未知 */
+int probeCoverGet(const char *filename)
+{
+    struct stat fs;
+    int cover = -1;
+
+    if (!filename || stat(filename, &fs) != 0) return -1;
+
+    int64_t dirmtime = _dir_mtime(filename);
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (entry && entry->rec.dirmtime == dirmtime) cover = entry->rec.cover;
+    pthread_mutex_unlock(&m_probe_lock);
+
+    return cover;
+}
+
+void probeCoverSet(const char *filename, bool cover)
+{
+    struct stat fs;
+
+    if (!filename || stat(filename, &fs) != 0) return;
+
+    int64_t dirmtime = _dir_mtime(filename);
+
+    pthread_mutex_lock(&m_probe_lock);
+    struct probe_entry *entry = _probe_lookup(&fs);
+    if (entry && (entry->rec.cover != cover || entry->rec.dirmtime != dirmtime)) {
+        entry->rec.cover = cover ? 1 : 0;
+        entry->rec.dirmtime = dirmtime;
+        m_probe_dirty = true;
+    }
+    pthread_mutex_unlock(&m_probe_lock);
+}
+
+/* 调用者持有 m_probe_lock，删除 ID 不在任何媒体库中的音频记录 */
+static void _probe_prune(MLIST *plans)
+{
+    MLIST *gone;
+    char *key;
+    struct probe_entry *entry;
+
+    mlist_init(&gone, free);
+    MHASH_ITERATE(m_probes, key, entry) {
+        if (entry->rec.asset != ASSET_AUDIO || !entry->rec.info || !entry->rec.id[0]) continue;
+
+        bool found = false;
+        DommeStore *plan;
+        MLIST_ITERATE(plans, plan) {
+            if (dommeGetFile(plan, entry->rec.id)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) mlist_append(gone, strdup(key));
+    }
+
+    MLIST_ITERATE(gone, key) {
+        mhash_remove(m_probes, key);
+    }
+
+    if (mlist_length(gone) > 0) {
+        mtc_mt_dbg("%d probe records pruned", mlist_length(gone));
+        m_probe_dirty = true;
+    }
+
+    mlist_destroy(&gone);
+}
+
+/*
+ * 有变化时保存，一般在一轮索引结束后调用
+ * plans 为全部媒体库时（只扫描其中一个时不能清理，其他库的记录会被误删）顺带清理已删除曲目的记录
+ */
+bool probeCacheSave(MLIST *plans)
+{
+    char filename[PATH_MAX], tmpname[PATH_MAX];
+    bool ret = false;
+
+    pthread_mutex_lock(&m_probe_lock);
+
+    if (m_probes && plans) _probe_prune(plans);
+
+    if (!m_probes || !m_probe_dirty) goto done;
+
+    snprintf(filename, sizeof(filename), "%s.avm/", mdf_get_value(g_config, "libraryRoot", ""));
+    if (!mos_mkdir(filename, 0755)) {
+        mtc_mt_warn("create directory %s failure", filename);
+        goto done;
+    }
+
+    _probe_filename(filename, sizeof(filename));
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+    FILE *fp = fopen(tmpname, "wb");
+    if (!fp) {
+        mtc_mt_warn("open %s failure %s", tmpname, strerror(errno));
+        goto done;
+    }
+
+    struct probe_header header = {
+        .magic = PROBE_MAGIC,
+        .version = PROBE_VERSION,
+        .count = mhash_length(m_probes),
+        .reserve = 0
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    char *key;
+    struct probe_entry *entry;
+    MHASH_ITERATE(m_probes, key, entry) {
+        if (!ok) break;
+
+        ok = fwrite(&entry->rec, sizeof(entry->rec), 1, fp) == 1;
+        for (int i = 0; i < 5 && ok; i++) {
+            if (entry->rec.lens[i] > 0) ok = fwrite(entry->strings[i], entry->rec.lens[i], 1, fp) == 1;
+        }
+    }
+
+    fclose(fp);
+
+    if (!ok || rename(tmpname, filename) != 0) {
+        mtc_mt_warn("save %s failure %s", filename, strerror(errno));
+        remove(tmpname);
+        goto done;
+    }
+
+    m_probe_dirty = false;
+    ret = true;
+
+done:
+    pthread_mutex_unlock(&m_probe_lock);
+    return ret;
+}
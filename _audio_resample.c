@@ -0,0 +1,225 @@
+/*
+ * 多相 FIR 重采样（用于固定输出采样率模式 audio.fixed_rate）
+ * 转换比按最大公约数化简为 L/M（如 44100 => 48000 为 160/147），原型滤波器为 Blackman 窗 sinc，
+ * 拆成 L 组系数，每个输出样本只做一次 taps 长度的点乘（NEON / SSE2 向量化）。
+ * 样本以 s32 输入输出，内部使用 float
+ */
+#define RESAMPLE_MAX_PHASES 1024
+#define RESAMPLE_IN_FRAMES 1024
+
+static struct {
+    char *name;
+    int taps;                   /* 每相抽头数，4 的倍数 */
+    double rolloff;             /* 截止频率相对奈奎斯特频率 */
+} m_resample_presets[] = {
+    {"low",    8,  0.80},
+    {"medium", 16, 0.90},
+    {"high",   32, 0.95},
+    {NULL, 0, 0}
+};
+
+static int _gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+#if defined(PCM_NEON)
+static inline float _dot(const float *a, const float *b, int n)
+{
+    float32x4_t acc = vdupq_n_f32(0);
+    for (int i = 0; i < n; i += 4) acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+#elif defined(PCM_SSE2)
+static inline float _dot(const float *a, const float *b, int n)
+{
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+}
+#else
+static inline float _dot(const float *a, const float *b, int n)
+{
+    float sum = 0;
+    for (int i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+#endif
+
+static inline int32_t _float_to_s32(float v)
+{
+    if (v >= 1.0f) return INT32_MAX;
+    else if (v <= -1.0f) return INT32_MIN;
+    else return (int32_t)(v * 2147483648.0f);
+}
+
+static int _preset_index(const char *quality)
+{
+    for (int i = 0; m_resample_presets[i].name; i++) {
+        if (quality && !strcmp(m_resample_presets[i].name, quality)) return i;
+    }
+
+    return 1;
+}
+
+/* 不支持的转换比（化简后相位数过多）返回 NULL */
+Resampler* resamplerCreate(int inrate, int outrate, int channels, const char *quality)
+{
+    if (inrate <= 0 || outrate <= 0 || channels <= 0) return NULL;
+
+    int g = _gcd(inrate, outrate);
+    int L = outrate / g, M = inrate / g;
+    if (L > RESAMPLE_MAX_PHASES) {
+        mtc_mt_warn("can't resample %d => %d", inrate, outrate);
+        return NULL;
+    }
+
+    int preset = _preset_index(quality);
+    int taps = m_resample_presets[preset].taps;
+    /* 降采样时按比例加长滤波器，保证过渡带相对输出采样率不变 */
+    if (M > L) taps = ((taps * M / L) + 3) & ~3;
+
+    Resampler *rs = mos_calloc(1, sizeof(Resampler));
+    rs->inrate = inrate;
+    rs->outrate = outrate;
+    rs->channels = channels;
+    rs->L = L;
+    rs->M = M;
+    rs->taps = taps;
+    rs->quality = m_resample_presets[preset].name;
+    rs->coeffs = mos_calloc((size_t)L * taps, sizeof(float));
+
+    /* 原型滤波器工作在 L * inrate 上 */
+    double fc = 0.5 * (L < M ? (double)L / M : 1.0) * m_resample_presets[preset].rolloff / L;
+    int len = L * taps;
+    double center = (len - 1) / 2.0;
+    for (int p = 0; p < L; p++) {
+        double sum = 0;
+        for (int j = 0; j < taps; j++) {
+            int n = j * L + p;
+            double x = n - center;
+            double sinc = x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+            double w = 0.42 - 0.5 * cos(2 * M_PI * (n + 0.5) / len) + 0.08 * cos(4 * M_PI * (n + 0.5) / len);
+            /* 按输入样本从旧到新排列，和历史缓冲顺序一致 */
+            rs->coeffs[p * taps + (taps - 1 - j)] = sinc * w;
+            sum += sinc * w;
+        }
+        /* 每相单独归一化，保证直流增益为 1 */
+        for (int j = 0; j < taps; j++) rs->coeffs[p * taps + j] /= sum;
+    }
+
+    rs->buflen = taps + RESAMPLE_IN_FRAMES;
+    rs->buf = mos_calloc((size_t)channels * rs->buflen, sizeof(float));
+    rs->fill = taps - 1;
+    rs->pos = taps - 1;
+    rs->phase = 0;
+
+    mtc_mt_dbg("resample %d => %d, %d/%d, %d taps %s", inrate, outrate, L, M, taps, rs->quality);
+
+    return rs;
+}
+
+void resamplerFree(Resampler *rs)
+{
+    if (!rs) return;
+
+    mos_free(rs->coeffs);
+    mos_free(rs->buf);
+    mos_free(rs);
+}
+
+/* 最多 RESAMPLE_IN_FRAMES 帧输入对应的最大输出帧数 */
+size_t resamplerMaxOutput(Resampler *rs)
+{
+    return (size_t)RESAMPLE_IN_FRAMES * rs->L / rs->M + 2;
+}
+
+/*
+ * 输入 frames 帧（不超过 RESAMPLE_IN_FRAMES）交错 s32 数据，输出至 dst，返回输出帧数
+ * dst 至少能容纳 resamplerMaxOutput() 帧
+ */
+size_t resamplerProcess(Resampler *rs, const int32_t *src, size_t frames, int32_t *dst)
+{
+    int channels = rs->channels, taps = rs->taps;
+    size_t outframes = 0;
+
+    if (frames > RESAMPLE_IN_FRAMES) frames = RESAMPLE_IN_FRAMES;
+
+    /* 拆声道追加到历史数据之后 */
+    for (int c = 0; c < channels; c++) {
+        float *cbuf = rs->buf + (size_t)c * rs->buflen + rs->fill;
+        for (size_t i = 0; i < frames; i++) cbuf[i] = src[i * channels + c] * (1.0f / 2147483648.0f);
+    }
+    rs->fill += frames;
+
+    /* pos 为当前输出样本所需的最新输入样本 */
+    while (rs->pos < rs->fill) {
+        const float *coeff = rs->coeffs + (size_t)rs->phase * taps;
+        for (int c = 0; c < channels; c++) {
+            const float *x = rs->buf + (size_t)c * rs->buflen + rs->pos - (taps - 1);
+            dst[outframes * channels + c] = _float_to_s32(_dot(coeff, x, taps));
+        }
+        outframes++;
+
+        rs->phase += rs->M;
+        rs->pos += rs->phase / rs->L;
+        rs->phase %= rs->L;
+    }
+
+    /* 保留 taps - 1 个历史样本（此时 pos >= fill） */
+    size_t drop = rs->fill - (taps - 1);
+    for (int c = 0; c < channels; c++) {
+        float *cbuf = rs->buf + (size_t)c * rs->buflen;
+        memmove(cbuf, cbuf + drop, (rs->fill - drop) * sizeof(float));
+    }
+    rs->fill -= drop;
+    rs->pos -= drop;
+
+    return outframes;
+}
+
+/*
+ * trace.benchmark 打开时输出各档位的 CPU 占用（立体声 10 秒音频）
+ */
+void resamplerBenchmark()
+{
+    int rates[][2] = {{44100, 48000}, {48000, 44100}, {96000, 48000}};
+    int seconds = 10;
+
+    for (int r = 0; r < 3; r++) {
+        int inrate = rates[r][0], outrate = rates[r][1];
+        int32_t *src = mos_calloc(RESAMPLE_IN_FRAMES * 2, sizeof(int32_t));
+        for (int i = 0; i < RESAMPLE_IN_FRAMES * 2; i++) src[i] = (int32_t)(mos_rand(65536) - 32768) * 65536;
+
+        for (int q = 0; m_resample_presets[q].name; q++) {
+            Resampler *rs = resamplerCreate(inrate, outrate, 2, m_resample_presets[q].name);
+            if (!rs) continue;
+
+            int32_t *dst = mos_calloc(resamplerMaxOutput(rs) * 2, sizeof(int32_t));
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+            for (long done = 0; done < (long)inrate * seconds; done += RESAMPLE_IN_FRAMES)
+                resamplerProcess(rs, src, RESAMPLE_IN_FRAMES, dst);
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+            double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            mtc_mt_dbg("resample %d => %d %-6s %2d taps: %.1f%% CPU, %.0fx realtime",
+                       inrate, outrate, rs->quality, rs->taps,
+                       secs * 100 / seconds, secs > 0 ? seconds / secs : 0);
+
+            mos_free(dst);
+            resamplerFree(rs);
+        }
+
+        mos_free(src);
+    }
+}
@@ -0,0 +1,324 @@
+/*
+ * 媒体文件定位索引（sample => 文件偏移）
+ * 索引点间隔 audio.seek_interval 毫秒，保存在 libroot/.avm/seek/ 下，以文件名的 md5 命名，
+ * 用媒体文件的大小和修改时间判断索引是否过期。
+ * 拖动、CUE 分轨起播时，二分查找到最近的索引点，然后最多再解码一个间隔即可。
+ * 生成索引要读整个文件，索引媒体库时不做，播放、流式传输时也不做（播放线程可能是实时优先级），
+ * 首次需要时排队，由后台线程生成，在此之前由调用者按字节比例或解码库自己的办法定位。
+ * 自带 SEEKTABLE 的 FLAC 直接使用文件中的索引，不生成
+ */
+#define SEEK_MAGIC 0x4B454553    /* "SEEK" */
+#define SEEK_VERSION 3    /* 2: 记录编码器延迟；3: MP3 不含 Xing/Info 标签帧 */
+#define SEEK_PENDING_MAX 64
+
+static MLIST *m_seek_pending = NULL;    /* 待生成索引的文件名 */
+static bool m_seek_running = false;
+static pthread_t m_seek_worker;
+static pthread_mutex_t m_seek_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_seek_cond = PTHREAD_COND_INITIALIZER;
+
+struct seek_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fsize;
+    int64_t  mtime;
+    uint32_t hz;
+    uint32_t interval;
+    uint64_t dataoffset;
+    uint32_t count;
+    uint32_t delay;
+};
+
+static void _seek_filename(const char *filename, char *out, size_t outlen)
+{
+    unsigned char sum[16] = {0};
+    char hexsum[33] = {0};
+
+    mhash_md5_buf((unsigned char*)filename, strlen(filename), sum);
+    mstr_bin2hexstr(sum, 16, hexsum);
+    mstr_tolower(hexsum);
+
+    snprintf(out, outlen, "%s.avm/seek/%s.idx", mdf_get_value(g_config, "libraryRoot", ""), hexsum);
+}
+
+SeekIndex* seekIndexCreate(uint32_t hz, uint64_t dataoffset)
+{
+    if (hz == 0) return NULL;
+
+    int ms = mdf_get_int_value(g_config, "audio.seek_interval", 200);
+    if (ms <= 0) ms = 200;
+
+    SeekIndex *sindex = mos_calloc(1, sizeof(SeekIndex));
+    sindex->hz = hz;
+    sindex->interval = (uint64_t)hz * ms / 1000;
+    sindex->dataoffset = dataoffset;
+    sindex->delay = 0;
+    sindex->count = 0;
+    sindex->size = 256;
+    sindex->points = mos_calloc(sindex->size, sizeof(SeekPoint));
+    sindex->dumped = false;
+
+    return sindex;
+}
+
+void seekIndexFree(SeekIndex *sindex)
+{
+    if (!sindex) return;
+
+    mos_free(sindex->points);
+    mos_free(sindex);
+}
+
+/* sample 为帧头 offset 处解码出的第一个 PCM 帧序号，需递增调用 */
+void seekIndexAppend(SeekIndex *sindex, uint64_t sample, uint64_t offset)
+{
+    if (!sindex) return;
+
+    if (sindex->count > 0 &&
+        sample < sindex->points[sindex->count - 1].sample + sindex->interval) return;
+
+    if (sindex->count >= sindex->size) {
+        /* 扩容失败时保留原索引，只是少了后面的点 */
+        SeekPoint *points = mos_calloc(sindex->size * 2, sizeof(SeekPoint));
+        if (!points) {
+            mtc_mt_warn("seek index grow to %u failure", sindex->size * 2);
+            return;
+        }
+        memcpy(points, sindex->points, sindex->count * sizeof(SeekPoint));
+        mos_free(sindex->points);
+        sindex->points = points;
+        sindex->size *= 2;
+    }
+
+    sindex->points[sindex->count].sample = sample;
+    sindex->points[sindex->count].offset = offset;
+    sindex->count++;
+}
+
+/*
+ * sample 为曲目时间轴上的位置（与扣除了编码器延迟、填充的 tinfo.samples 一致），
+ * 返回不超过其解码输出位置（sample + delay）的最后一个索引点，
+ * 从该点起解码后需丢弃 sample + delay - point->sample 帧
+ */
+SeekPoint* seekIndexFind(SeekIndex *sindex, uint64_t sample)
+{
+    if (!sindex || sindex->count == 0) return NULL;
+
+    sample += sindex->delay;
+
+    if (sample < sindex->points[0].sample) return NULL;
+
+    uint32_t low = 0, high = sindex->count - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low + 1) / 2;
+        if (sindex->points[mid].sample <= sample) low = mid;
+        else high = mid - 1;
+    }
+
+    return &sindex->points[low];
+}
+
+SeekIndex* seekIndexLoad(const char *filename)
+{
+    struct stat fs;
+    struct seek_header header;
+    char idxname[PATH_MAX];
+
+    if (!filename || stat(filename, &fs) != 0) return NULL;
+
+    _seek_filename(filename, idxname, sizeof(idxname));
+
+    FILE *fp = fopen(idxname, "rb");
+    if (!fp) return NULL;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != SEEK_MAGIC || header.version != SEEK_VERSION ||
+        header.fsize != (uint64_t)fs.st_size || header.mtime != (int64_t)fs.st_mtime ||
+        header.hz == 0 || header.count == 0) {
+        mtc_mt_dbg("seek index %s outdated", idxname);
+        fclose(fp);
+        return NULL;
+    }
+
+    SeekIndex *sindex = mos_calloc(1, sizeof(SeekIndex));
+    sindex->hz = header.hz;
+    sindex->interval = header.interval;
+    sindex->dataoffset = header.dataoffset;
+    sindex->delay = header.delay;
+    sindex->count = header.count;
+    sindex->size = header.count;
+    sindex->points = mos_calloc(header.count, sizeof(SeekPoint));
+    sindex->dumped = true;
+
+    if (fread(sindex->points, sizeof(SeekPoint), header.count, fp) != header.count) {
+        mtc_mt_warn("read seek index %s failure", idxname);
+        seekIndexFree(sindex);
+        sindex = NULL;
+    }
+
+    fclose(fp);
+
+    return sindex;
+}
+
+bool seekIndexDump(SeekIndex *sindex, const char *filename)
+{
+    struct stat fs;
+    char idxname[PATH_MAX], tmpname[PATH_MAX];
+
+    if (!sindex || sindex->count == 0 || !filename || stat(filename, &fs) != 0) return false;
+
+    snprintf(idxname, sizeof(idxname), "%s.avm/seek/", mdf_get_value(g_config, "libraryRoot", ""));
+    if (!mos_mkdir(idxname, 0755)) {
+        mtc_mt_warn("create directory %s failure", idxname);
+        return false;
+    }
+
+    _seek_filename(filename, idxname, sizeof(idxname));
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", idxname);
+
+    FILE *fp = fopen(tmpname, "wb");
+    if (!fp) {
+        mtc_mt_warn("open %s failure %s", tmpname, strerror(errno));
+        return false;
+    }
+
+    struct seek_header header = {
+        .magic = SEEK_MAGIC,
+        .version = SEEK_VERSION,
+        .fsize = fs.st_size,
+        .mtime = fs.st_mtime,
+        .hz = sindex->hz,
+        .interval = sindex->interval,
+        .dataoffset = sindex->dataoffset,
+        .count = sindex->count,
+        .delay = sindex->delay
+    };
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(sindex->points, sizeof(SeekPoint), sindex->count, fp) != sindex->count) {
+        mtc_mt_warn("write %s failure", tmpname);
+        fclose(fp);
+        remove(tmpname);
+        return false;
+    }
+
+    fclose(fp);
+
+    /* 整体替换，防止播放线程读到半截索引 */
+    if (rename(tmpname, idxname) != 0) {
+        mtc_mt_warn("rename %s failure %s", tmpname, strerror(errno));
+        remove(tmpname);
+        return false;
+    }
+
+    sindex->dumped = true;
+
+    return true;
+}
+
+/* 媒体文件已删除（CUE 整轨的所有分轨都已删除）时，一并删除其索引文件 */
+void seekIndexRemove(const char *filename)
+{
+    char idxname[PATH_MAX];
+
+    if (!filename) return;
+
+    _seek_filename(filename, idxname, sizeof(idxname));
+    if (remove(idxname) == 0) mtc_mt_dbg("seek index %s removed", idxname);
+}
+
+static void* _seek_worker(void *arg)
+{
+    while (m_seek_running) {
+        pthread_mutex_lock(&m_seek_lock);
+        while (m_seek_running && mlist_length(m_seek_pending) == 0) pthread_cond_wait(&m_seek_cond, &m_seek_lock);
+        char *filename = m_seek_running ? mlist_popx(m_seek_pending) : NULL;
+        pthread_mutex_unlock(&m_seek_lock);
+
+        if (!filename) continue;
+
+        MediaNode *mnode = mediaOpen(filename);
+        if (mnode) {
+            mediaSeekIndex(mnode, true);
+            mnode->driver->close(mnode);
+
+            /* 整个文件都读过了，不要挤掉正在用的缓存 */
+            ioDropFile(filename);
+        }
+
+        mos_free(filename);
+    }
+
+    return NULL;
+}
+
+void seekIndexStart()
+{
+    if (m_seek_running) return;
+
+    mlist_init(&m_seek_pending, free);
+    m_seek_running = true;
+    pthread_create(&m_seek_worker, NULL, _seek_worker, NULL);
+}
+
+void seekIndexStop()
+{
+    if (!m_seek_running) return;
+
+    pthread_mutex_lock(&m_seek_lock);
+    m_seek_running = false;
+    pthread_cond_broadcast(&m_seek_cond);
+    pthread_mutex_unlock(&m_seek_lock);
+
+    pthread_join(m_seek_worker, NULL);
+    mlist_destroy(&m_seek_pending);
+}
+
+/* 排队由后台线程生成索引，已在队列中或队列已满时忽略 */
+void seekIndexQueue(const char *filename)
+{
+    if (!filename) return;
+
+    pthread_mutex_lock(&m_seek_lock);
+    if (m_seek_running && mlist_length(m_seek_pending) < SEEK_PENDING_MAX) {
+        bool queued = false;
+        char *item;
+        MLIST_ITERATE(m_seek_pending, item) {
+            if (!strcmp(item, filename)) {
+                queued = true;
+                break;
+            }
+        }
+        if (!queued) {
+            mlist_append(m_seek_pending, strdup(filename));
+            pthread_cond_signal(&m_seek_cond);
+        }
+    }
+    pthread_mutex_unlock(&m_seek_lock);
+}
+
+/*
+ * 获取媒体文件的定位索引：已有 => 文件自带 => 索引文件 => 扫描生成并保存
+ * build 为 false 时不扫描（不读整个文件），没有索引时排队由后台生成，返回 NULL
+ * 返回的索引归 mnode 所有，随 close 释放
+ */
+SeekIndex* mediaSeekIndex(MediaNode *mnode, bool build)
+{
+    if (!mnode) return NULL;
+
+    if (!mnode->sindex && mnode->driver->seek_index_native) mnode->sindex = mnode->driver->seek_index_native(mnode);
+    if (!mnode->sindex) mnode->sindex = seekIndexLoad(mnode->filename);
+    if (!mnode->sindex && !build && mnode->driver->seek_index_build) seekIndexQueue(mnode->filename);
+
+    if (!mnode->sindex && build && mnode->driver->seek_index_build) {
+        mnode->sindex = mnode->driver->seek_index_build(mnode);
+        if (mnode->sindex)
+            mtc_mt_dbg("%s seek index built with %u points", mnode->filename, mnode->sindex->count);
+    }
+
+    /* 解析 tinfo 时顺带生成的索引，也一并保存 */
+    if (build && mnode->sindex && !mnode->sindex->dumped) seekIndexDump(mnode->sindex, mnode->filename);
+
+    return mnode->sindex;
+}
@@ -0,0 +1,482 @@
+/*
+ * 并行遍历媒体库目录
+ * 目录、文件都是任务，每个线程一个双端队列：自己从尾部压入、取出（后进先出，先往深处走），
+ * 空闲时从其他线程队列的头部一次窃取一半（较浅的目录，分出去的工作量大）。目录用 getdents64 一次读一大块，
+ * 发现的新文件随即作为任务探测、索引，不必等整棵目录树遍历完。
+ * 探测得到的曲目先放在线程本地的 IndexBatch 中，成批加入媒体库，探测期间不持有任何全局锁。
+ * 增量扫描时每个已知目录一个检查任务，stat 后只列出修改时间变了的目录（见 _audio_dirsnap.c）
+ */
+#define WALK_BUF (32 * 1024)
+#define WALK_DEQUE_INIT 64
+#define WALK_STEAL_MAX 32
+
+typedef enum {
+    WALK_DIR = 0,               /* 列出目录 */
+    WALK_CHECK,                 /* 对照快照检查目录 */
+    WALK_FILE,                  /* 探测、索引文件 */
+} WALK_KIND;
+
+struct walk_task {
+    WALK_KIND kind;
+    char *path;                 /* 相对 basedir 的目录，WALK_FILE 时为 plan->dirs 中的字符串，其余为拷贝 */
+    char *name;                 /* WALK_FILE 的文件名 */
+};
+
+struct walk_deque {
+    pthread_mutex_t lock;
+    struct walk_task **tasks;   /* 环形缓冲 */
+    uint32_t head;
+    uint32_t count;
+    uint32_t size;
+};
+
+typedef struct {
+    DommeStore *plan;
+    struct scan_known *known;   /* 可为空，全部当作新文件 */
+    MHASH *snap;                /* 可为空，不为空时记入快照，且只进入快照中没有的子目录 */
+    MHASH *gone;                /* 增量扫描：消失的目录 */
+    MHASH *changed;             /* 增量扫描：目录项有变化的目录 -> 文件名集合 */
+
+    pthread_mutex_t lock;       /* 保护以上集合及 known->notmedia */
+    pthread_cond_t cond;        /* 有新任务，或全部完成 */
+
+    int nworker;
+    struct walk_deque *deques;
+
+    uint32_t pending;           /* 未完成的任务 */
+    uint32_t queued;            /* 在队列中的任务 */
+    uint32_t idle;              /* 等待中的线程 */
+
+    uint32_t listed;            /* 列出的目录 */
+    uint32_t found;             /* 发现的新文件 */
+    uint32_t tracks;            /* 加入媒体库的曲目（ID 冲突的不算） */
+} Walker;
+
+struct walk_arg {
+    Walker *w;
+    int self;
+};
+
+/* linux/dirent.h 中没有导出 */
+struct walk_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int _index_file(IndexBatch *batch, char *fpath, const char *fname, const char *filename);
+
+static bool _walk_is_music(const char *name)
+{
+    return strncmp(name, "music.db", 8) && strcmp(name, "notMusic.cache") && strncmp(name, "dirsnap.cache", 13);
+}
+
+static void _walk_deque_push(struct walk_deque *dq, struct walk_task **tasks, uint32_t n)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count + n > dq->size) {
+        uint32_t size = dq->size ? dq->size : WALK_DEQUE_INIT;
+        while (size < dq->count + n) size *= 2;
+        struct walk_task **grown = mos_calloc(size, sizeof(struct walk_task*));
+        for (uint32_t i = 0; i < dq->count; i++) grown[i] = dq->tasks[(dq->head + i) % dq->size];
+        mos_free(dq->tasks);
+        dq->tasks = grown;
+        dq->head = 0;
+        dq->size = size;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        dq->tasks[(dq->head + dq->count) % dq->size] = tasks[i];
+        dq->count++;
+    }
+    pthread_mutex_unlock(&dq->lock);
+}
+
+/* 自己从尾部取 */
+static struct walk_task* _walk_deque_pop(struct walk_deque *dq)
+{
+    struct walk_task *task = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        task = dq->tasks[(dq->head + dq->count) % dq->size];
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    return task;
+}
+
+/*
+ * 别人从头部窃取一半（至多 WALK_STEAL_MAX 个），返回其中第一个，其余放入自己的队列，
+ * 一次加锁领走一批，不必每个任务都来窃取
+ */
+static struct walk_task* _walk_deque_steal(struct walk_deque *dq, struct walk_deque *mine)
+{
+    struct walk_task *stolen[WALK_STEAL_MAX];
+    uint32_t n = 0;
+
+    if (__atomic_load_n(&dq->count, __ATOMIC_RELAXED) == 0) return NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    n = (dq->count + 1) / 2;
+    if (n > WALK_STEAL_MAX) n = WALK_STEAL_MAX;
+    for (uint32_t i = 0; i < n; i++) {
+        stolen[i] = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) % dq->size;
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    if (n == 0) return NULL;
+    if (n > 1) _walk_deque_push(mine, stolen + 1, n - 1);
+
+    return stolen[0];
+}
+
+static void _walk_push(Walker *w, int self, WALK_KIND kind, char *path, char *name)
+{
+    struct walk_task *task = mos_calloc(1, sizeof(struct walk_task));
+    task->kind = kind;
+    task->path = path;
+    task->name = name;
+
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+    _walk_deque_push(&w->deques[self], &task, 1);
+
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static struct walk_task* _walk_take(Walker *w, int self)
+{
+    struct walk_task *task = _walk_deque_pop(&w->deques[self]);
+
+    for (int i = 1; !task && i < w->nworker; i++) {
+        task = _walk_deque_steal(&w->deques[(self + i) % w->nworker], &w->deques[self]);
+    }
+
+    if (task) __atomic_sub_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+
+    return task;
+}
+
+static void _walk_task_free(struct walk_task *task)
+{
+    if (task->kind != WALK_FILE) mos_free(task->path);
+    mos_free(task->name);
+    mos_free(task);
+}
+
+/* 路径索引与成批加入的曲目共用 m_indexer_lock */
+static char* _walk_intern(Walker *w, const char *subdir)
+{
+    pthread_mutex_lock(&m_indexer_lock);
+    char *dir = dommeStoreDir(w->plan, subdir, true);
+    pthread_mutex_unlock(&m_indexer_lock);
+
+    return dir;
+}
+
+static bool _walk_known(Walker *w, const char *dir, const char *name, const char *filename)
+{
+    if (!w->known) return false;
+
+    /* 已索引文件集合遍历期间只读 */
+    DommeFile key = {.dir = (char*)dir, .name = (char*)name};
+    if (mhash_lookup(w->known->files, &key)) return true;
+
+    pthread_mutex_lock(&w->lock);
+    bool known = mhash_lookup(w->known->notmedia, (void*)filename) != NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    return known;
+}
+
+/*
+ * 列出目录，新文件、新子目录压入自己的队列
+ * names 不为空时收集目录下的文件名，用来与媒体库比较得出删除的文件
+ */
+static void _walk_list(Walker *w, int self, const char *subdir, MHASH *names)
+{
+    DommeStore *plan = w->plan;
+
+    mtc_mt_dbg("scan directory %s", subdir);
+
+    char *dir = _walk_intern(w, subdir);
+
+    char fullpath[PATH_MAX];
+    snprintf(fullpath, sizeof(fullpath), "%s%s", plan->basedir, subdir);
+
+    int fd = open(fullpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        mtc_mt_warn("open directory %s failure %s", fullpath, strerror(errno));
+        return;
+    }
+
+    /* 列出之前取修改时间，列出过程中的变化留给下次 */
+    struct stat st;
+    bool record = w->snap && fstat(fd, &st) == 0;
+    uint32_t count = 0;
+    uint64_t hash = 0;
+
+    char buf[WALK_BUF] __attribute__ ((aligned(8)));
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < n;) {
+            struct walk_dirent64 *ent = (struct walk_dirent64*)(buf + pos);
+            pos += ent->d_reclen;
+
+            const char *name = ent->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+
+            unsigned char type = ent->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat est;
+                if (fstatat(fd, name, &est, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                if (S_ISDIR(est.st_mode)) type = DT_DIR;
+                else if (S_ISREG(est.st_mode)) type = DT_REG;
+            }
+
+            if (type == DT_DIR) {
+                count++;
+                hash += _dirsnap_name_hash(name, 'd');
+
+                char dirname[PATH_MAX];
+                snprintf(dirname, sizeof(dirname), "%s%s/", subdir, name);
+
+                bool known = false;
+                if (w->snap) {
+                    pthread_mutex_lock(&w->lock);
+                    known = mhash_lookup(w->snap, dirname) != NULL;
+                    pthread_mutex_unlock(&w->lock);
+                }
+                if (!known) _walk_push(w, self, WALK_DIR, strdup(dirname), NULL);
+            } else if (type == DT_REG && _walk_is_music(name)) {
+                count++;
+                hash += _dirsnap_name_hash(name, 'f');
+                if (names) mhash_insert(names, strdup(name), (void*)1);
+
+                char filename[PATH_MAX];
+                snprintf(filename, sizeof(filename), "%s%s", fullpath, name);
+                if (!_walk_known(w, dir, name, filename)) {
+                    __atomic_add_fetch(&w->found, 1, __ATOMIC_RELAXED);
+                    _walk_push(w, self, WALK_FILE, dir, strdup(name));
+                }
+            }
+        }
+    }
+    if (n < 0) mtc_mt_warn("read directory %s failure %s", fullpath, strerror(errno));
+
+    close(fd);
+
+    if (record) {
+        pthread_mutex_lock(&w->lock);
+        _dirsnap_record(w->snap, subdir, &st, count, hash);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    __atomic_add_fetch(&w->listed, 1, __ATOMIC_RELAXED);
+}
+
+/* 对照快照，修改时间变了才列出，目录项也变了的记入 changed */
+static void _walk_check(Walker *w, int self, const char *subdir)
+{
+    pthread_mutex_lock(&w->lock);
+    DirSnap *item = mhash_lookup(w->snap, (void*)subdir);
+    DirSnap old;
+    if (item) old = *item;
+    pthread_mutex_unlock(&w->lock);
+
+    if (!item) return;
+
+    char fullpath[PATH_MAX];
+    snprintf(fullpath, sizeof(fullpath), "%s%s", w->plan->basedir, subdir);
+
+    struct stat st;
+    if (stat(fullpath, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        mtc_mt_dbg("directory %s gone", subdir);
+
+        pthread_mutex_lock(&w->lock);
+        mhash_insert(w->gone, strdup(subdir), (void*)1);
+        mhash_remove(w->snap, (void*)subdir);
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+
+    if (_dirsnap_same(&old, &st)) return;
+
+    MHASH *names;
+    mhash_init(&names, mhash_str_hash, mhash_str_comp, _dirsnap_key_free);
+    _walk_list(w, self, subdir, names);
+
+    /* 目录项没有变化（如在其中改写过文件），不必比较 */
+    pthread_mutex_lock(&w->lock);
+    item = mhash_lookup(w->snap, (void*)subdir);
+    if (item && item->count == old.count && item->hash == old.hash) mhash_destroy(&names);
+    else mhash_insert(w->changed, strdup(subdir), names);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* 本地攒下的曲目加入媒体库 */
+static void _walk_merge(Walker *w, IndexBatch *batch)
+{
+    int added = _batch_merge(w->plan, batch);
+    if (added > 0) __atomic_add_fetch(&w->tracks, added, __ATOMIC_RELAXED);
+}
+
+static void _walk_file(Walker *w, struct walk_task *task, IndexBatch *batch)
+{
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s%s", w->plan->basedir, task->path, task->name);
+
+    int count = _index_file(batch, task->path, task->name, filename);
+    if (count < 0 && w->known) {
+        pthread_mutex_lock(&w->lock);
+        _known_notmedia(w->known, filename);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    if (batch->count >= INDEX_BATCH) _walk_merge(w, batch);
+}
+
+static void* _walk_worker(void *arg)
+{
+    struct walk_arg *warg = arg;
+    Walker *w = warg->w;
+    int self = warg->self;
+
+    char threadname[24];
+    snprintf(threadname, sizeof(threadname), "indexer%02d", self);
+    int loglevel = mtc_level_str2int(mdf_get_value(g_config, "trace.worker", "debug"));
+    mtc_mt_initf(threadname, loglevel, g_log_tostdout ? "-" : "%slog/%s.log", g_location, threadname);
+
+    IndexBatch batch = {NULL, 0, 0};
+    int done = 0;
+    while (true) {
+        struct walk_task *task = _walk_take(w, self);
+        if (task) {
+            switch (task->kind) {
+            case WALK_DIR:
+                _walk_list(w, self, task->path, NULL);
+                break;
+            case WALK_CHECK:
+                _walk_check(w, self, task->path);
+                break;
+            case WALK_FILE:
+                _walk_file(w, task, &batch);
+                done++;
+                break;
+            }
+            _walk_task_free(task);
+
+            if (__atomic_sub_fetch(&w->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+                pthread_mutex_lock(&w->lock);
+                pthread_cond_broadcast(&w->cond);
+                pthread_mutex_unlock(&w->lock);
+            }
+            continue;
+        }
+
+        /* 没有任务可做，先把攒下的曲目交出去，免得等到结束才在媒体库中出现 */
+        _walk_merge(w, &batch);
+
+        pthread_mutex_lock(&w->lock);
+        __atomic_add_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&w->queued, __ATOMIC_SEQ_CST) == 0 &&
+               __atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) > 0) pthread_cond_wait(&w->cond, &w->lock);
+        __atomic_sub_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+        bool finished = __atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&w->lock);
+
+        if (finished) break;
+    }
+
+    _walk_merge(w, &batch);
+    _batch_free(&batch);
+
+    mtc_mt_dbg("%s done with %d files", threadname, done);
+
+    return NULL;
+}
+
+static Walker* _walk_create(DommeStore *plan, struct scan_known *known, MHASH *snap)
+{
+    Walker *w = mos_calloc(1, sizeof(Walker));
+    w->plan = plan;
+    w->known = known;
+    w->snap = snap;
+    mhash_init(&w->gone, mhash_str_hash, mhash_str_comp, _dirsnap_key_free);
+    mhash_init(&w->changed, mhash_str_hash, mhash_str_comp, _dirsnap_free_names);
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->nworker = sysconf(_SC_NPROCESSORS_ONLN);
+    if (w->nworker <= 0) w->nworker = 2;
+    w->deques = mos_calloc(w->nworker, sizeof(struct walk_deque));
+    for (int i = 0; i < w->nworker; i++) pthread_mutex_init(&w->deques[i].lock, NULL);
+
+    return w;
+}
+
+/* 起始任务，轮流放入各线程的队列 */
+static void _walk_seed(Walker *w, WALK_KIND kind, const char *subdir)
+{
+    int self = __atomic_load_n(&w->pending, __ATOMIC_RELAXED) % w->nworker;
+    _walk_push(w, self, kind, strdup(subdir), NULL);
+}
+
+/* 运行至所有任务完成，索引期间每 3 秒告诉在线用户一次 */
+static void _walk_run(Walker *w, AudioEntry *me)
+{
+    if (__atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) == 0) return;
+
+    pthread_t *threads = mos_calloc(w->nworker, sizeof(pthread_t));
+    struct walk_arg *args = mos_calloc(w->nworker, sizeof(struct walk_arg));
+    for (int i = 0; i < w->nworker; i++) {
+        args[i].w = w;
+        args[i].self = i;
+        pthread_create(&threads[i], NULL, _walk_worker, &args[i]);
+    }
+
+    for (int i = 0; i < w->nworker; i++) {
+        while (true) {
+            struct timespec timeout;
+            clock_gettime(CLOCK_REALTIME, &timeout);
+            timeout.tv_sec += 3;
+            if (pthread_timedjoin_np(threads[i], NULL, &timeout) == 0) break;
+
+            if (__atomic_load_n(&w->found, __ATOMIC_RELAXED) > 0) _onStoreIndexing(me);
+        }
+    }
+    mos_free(threads);
+    mos_free(args);
+
+    mtc_mt_dbg("%u directories listed, %u new files, %u tracks indexed", w->listed, w->found, w->tracks);
+
+    if (w->found > 0) _onStoreIndexDone(me);
+}
+
+static void _walk_free(Walker *w)
+{
+    if (!w) return;
+
+    for (int i = 0; i < w->nworker; i++) {
+        pthread_mutex_destroy(&w->deques[i].lock);
+        mos_free(w->deques[i].tasks);
+    }
+    mos_free(w->deques);
+
+    mhash_destroy(&w->gone);
+    mhash_destroy(&w->changed);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+
+    mos_free(w);
+}
@@ -1,5 +1,8 @@
 #include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/inotify.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <iconv.h>
 #include <libgen.h>
@@ -19,7 +22,34 @@ static char* _action_string(PLAY_ACTION act)
     }
 }
 
+/* 其他线程设置播放动作，唤醒空闲的播放线程（播放中的曲目在解码循环中检查 me->act） */
+static void _set_act(AudioEntry *me, PLAY_ACTION act)
+{
+    pthread_mutex_lock(&me->lock);
+    me->act = act;
+    pthread_cond_signal(&me->cond);
+    pthread_mutex_unlock(&me->lock);
+}
+
 static int _scan_directory(const struct dirent *ent);
+static bool _order_current(AudioEntry *me);
+
+/* 媒体插件解析文件头用 */
+static inline uint32_t _be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+#include "_audio_seek.c"
+#include "_audio_id.c"
+#include "_audio_probe.c"
+#include "_audio_pcm.c"
+#include "_audio_resample.c"
+#include "_audio_output.c"
+#include "_audio_order.c"
+#include "_audio_history.c"
+#include "_audio_nowplaying.c"
+#include "_audio_io.c"
 
 #include "_media_flac.c"
 #include "_media_mp3.c"
@@ -32,53 +62,157 @@ MediaEntry *media_plugins[] = {
     NULL
 };
 
-MEDIA_TYPE mediaType(const char *filename)
+#define SNIFF_HEAD_SIZE 4096
+
+/* 文件头特征，offset2 为 0 时只比较第一段 */
+static struct {
+    MEDIA_TYPE type;
+    size_t offset;
+    const char *magic;
+    size_t offset2;
+    const char *magic2;
+} m_signatures[] = {
+    {MEDIA_FLAC, 0, "fLaC", 0, NULL},
+    {MEDIA_WAV,  0, "RIFF", 8, "WAVE"},
+    {MEDIA_WAV,  0, "RF64", 8, "WAVE"},
+    {MEDIA_UNKNOWN, 0, NULL, 0, NULL}
+};
+
+static struct {
+    const char *suffix;
+    MEDIA_TYPE type;
+} m_suffixes[] = {
+    {".mp3",  MEDIA_MP3},
+    {".flac", MEDIA_FLAC},
+    {".wav",  MEDIA_WAV},
+    {NULL, MEDIA_UNKNOWN}
+};
+
+static MediaEntry* _media_driver(MEDIA_TYPE type)
+{
+    for (int i = 0; media_plugins[i]; i++) {
+        if (media_plugins[i]->type == type) return media_plugins[i];
+    }
+
+    return NULL;
+}
+
+/* MPEG 音频帧头：11 位同步字，版本、层、码率、采样率不能为保留值 */
+static bool _mpeg_frame(const uint8_t *buf, size_t len)
 {
+    if (len < 4) return false;
 
-    if (!filename) return MEDIA_UNKNOWN;
+    return buf[0] == 0xFF && (buf[1] & 0xE0) == 0xE0 &&
+        ((buf[1] >> 3) & 0x3) != 1 && ((buf[1] >> 1) & 0x3) != 0 &&
+        (buf[2] >> 4) != 0xF && ((buf[2] >> 2) & 0x3) != 3;
+}
 
-    int index = 0;
-    while (media_plugins[index]) {
-        if (media_plugins[index]->check(filename) == true) return media_plugins[index]->type;
+static MEDIA_TYPE _sniff_buf(const uint8_t *buf, size_t len)
+{
+    for (int i = 0; m_signatures[i].magic; i++) {
+        size_t mlen = strlen(m_signatures[i].magic);
+        if (len < m_signatures[i].offset + mlen ||
+            memcmp(buf + m_signatures[i].offset, m_signatures[i].magic, mlen)) continue;
+
+        if (m_signatures[i].magic2) {
+            size_t mlen2 = strlen(m_signatures[i].magic2);
+            if (len < m_signatures[i].offset2 + mlen2 ||
+                memcmp(buf + m_signatures[i].offset2, m_signatures[i].magic2, mlen2)) continue;
+        }
 
-        index++;
+        return m_signatures[i].type;
     }
 
+    if (_mpeg_frame(buf, len)) return MEDIA_MP3;
+
     return MEDIA_UNKNOWN;
 }
 
-MediaNode* mediaOpen(const char *filename)
+/*
+ * 读取文件头（跳过 ID3v2 标签）判断格式，判断不了时参考扩展名
+ * 不打开任何解码器
+ */
+MEDIA_TYPE mediaType(const char *filename)
 {
-    MediaNode *mnode;
+    uint8_t buf[SNIFF_HEAD_SIZE];
+    MEDIA_TYPE type = MEDIA_UNKNOWN;
+
+    if (!filename) return MEDIA_UNKNOWN;
 
-    size_t namelen = strlen(filename);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return MEDIA_UNKNOWN;
 
-    if (!filename) return NULL;
+    ssize_t len = pread(fd, buf, sizeof(buf), 0);
+    if (len >= 10 && !memcmp(buf, "ID3", 3)) {
+        /* ID3v2 后面可能是 MP3，也可能是 FLAC */
+        size_t taglen = 10 + (((buf[6] & 0x7F) << 21) | ((buf[7] & 0x7F) << 14) |
+                              ((buf[8] & 0x7F) << 7) | (buf[9] & 0x7F));
+        if (buf[5] & 0x10) taglen += 10;
 
-    int index = 0;
-    while (media_plugins[index]) {
-        mnode = media_plugins[index]->open(filename);
-        if (mnode) {
-            memcpy(mnode->filename, filename, namelen > PATH_MAX ? PATH_MAX : namelen);
-            mnode->driver = media_plugins[index];
+        len = pread(fd, buf, 16, taglen);
+        type = len > 0 ? _sniff_buf(buf, len) : MEDIA_UNKNOWN;
+        if (type == MEDIA_UNKNOWN) type = MEDIA_MP3;
+    } else if (len > 0) type = _sniff_buf(buf, len);
 
-            return mnode;
+    close(fd);
+
+    if (type == MEDIA_UNKNOWN) {
+        for (int i = 0; m_suffixes[i].suffix; i++) {
+            if (mstr_endwith(filename, m_suffixes[i].suffix, true)) return m_suffixes[i].type;
         }
+    }
 
-        index++;
+    return type;
+}
+
+/*
+ * 按探测缓存或文件头选定插件，只用一个解码器打开
+ */
+MediaNode* mediaOpen(const char *filename)
+{
+    if (!filename) return NULL;
+
+    MEDIA_TYPE type = probeMediaType(filename);
+    if (type == MEDIA_UNKNOWN) type = mediaType(filename);
+
+    MediaEntry *driver = _media_driver(type);
+    if (!driver) return NULL;
+
+    MediaNode *mnode = driver->open(filename);
+    if (mnode) {
+        size_t namelen = strlen(filename);
+        memcpy(mnode->filename, filename, namelen >= PATH_MAX ? PATH_MAX - 1 : namelen);
+        mnode->driver = driver;
     }
 
-    return NULL;
+    return mnode;
+}
+
+/*
+ * 媒体 ID 只有索引、导入时需要，播放、封面等不要调用。
+ * 计算后缓存在 mnode->md5 中，失败返回 NULL
+ */
+const char* mediaIdGet(MediaNode *mnode)
+{
+    if (!mnode) return NULL;
+
+    if (mnode->md5[0] == 0 && mnode->driver->id_get) mnode->driver->id_get(mnode);
+
+    return mnode->md5[0] ? mnode->md5 : NULL;
 }
 
 #include "_audio_init.c"
+#include "_audio_dirsnap.c"
 #include "_audio_indexer.c"
 #include "_audio_method.c"
 
-static double _get_normalized_volume(snd_mixer_elem_t *elem)
+static double _get_normalized_volume(AudioEntry *me)
 {
+    snd_mixer_elem_t *elem = me->mixer;
     long max, min, value;
 
+    if (!elem) return me->out.gain;
+
     if (snd_mixer_selem_get_playback_dB_range(elem, &min, &max) < 0) {
         mtc_mt_err("get db range failure");
         return 0;
@@ -94,8 +228,9 @@ static double _get_normalized_volume(snd_mixer_elem_t *elem)
     return exp10((value - max) / 6000.0);
 }
 
-static void _set_normalized_volume(snd_mixer_elem_t *elem, float volume)
+static void _set_normalized_volume(AudioEntry *me, float volume)
 {
+    snd_mixer_elem_t *elem = me->mixer;
     long min, max, value;
 
     if (volume < 0.017170) volume = 0.017170;
@@ -103,6 +238,12 @@ static void _set_normalized_volume(snd_mixer_elem_t *elem, float volume)
 
     mtc_mt_dbg("set value %f", volume);
 
+    if (!elem) {
+        /* 没有硬件音量，输出时软件调节 */
+        outputGain(me, volume);
+        return;
+    }
+
     if (snd_mixer_selem_get_playback_dB_range(elem, &min, &max)) {
         mtc_mt_err("get db range failure");
         return;
@@ -115,227 +256,90 @@ static void _set_normalized_volume(snd_mixer_elem_t *elem, float volume)
     snd_mixer_selem_set_playback_dB_all(elem, value, 0);
 }
 
-static bool _in_playlist(MLIST *playlist, char *id)
-{
-    if (!id || !playlist || mlist_length(playlist) == 0) return false;
-
-    char *track;
-    MLIST_ITERATE(playlist, track) {
-        if (track && !strcmp(track, id)) return true;
-    }
-
-    return false;
-}
-
-uint32_t albumFreeTrack(DommeAlbum *disk)
-{
-    if (!disk) return 0;
-
-    uint32_t count = 0;
-
-    DommeFile *mfile;
-    MLIST_ITERATE(disk->tracks, mfile) {
-        if (!mfile->touched) count++;
-    }
-
-    return count;
-}
-
-uint32_t albumFreeReset(DommeAlbum *disk)
-{
-    if (!disk) return 0;
-
-    DommeFile *mfile;
-    MLIST_ITERATE(disk->tracks, mfile) {
-        mfile->touched = false;
-    }
-    disk->pos = 0;
-
-    return mlist_length(disk->tracks);
-}
-
-uint32_t artistFreeTrack(DommeArtist *artist)
-{
-    if (!artist) return 0;
-
-    uint32_t count = 0;
-
-    DommeAlbum *disk;
-    MLIST_ITERATE(artist->albums, disk) {
-        count += albumFreeTrack(disk);
-    }
-
-    return count;
-}
-
-uint32_t artistFreeReset(DommeArtist *artist)
-{
-    if (!artist) return 0;
-
-    DommeAlbum *disk;
-    MLIST_ITERATE(artist->albums, disk) {
-        albumFreeReset(disk);
-    }
-    artist->pos = 0;
-
-    return artist->count_track;
-}
-
-uint32_t dommeFreeReset(DommeStore *plan)
+DommeStore* dommeStoreDefault(MLIST *plans)
 {
-    if (!plan) return 0;
+    if (!plans) return NULL;
 
-    DommeArtist *artist;
-    MLIST_ITERATE(plan->artists, artist) {
-        artistFreeReset(artist);
+    DommeStore *plan = NULL;
+    MLIST_ITERATE(plans, plan) {
+        if (plan->moren) return plan;
     }
-    plan->count_touched = 0;
-    plan->pos = 0;
 
-    return plan->count_track;
+    return plan;
 }
 
-uint32_t albumFreeCount(DommeAlbum *disk)
+DommeStore* dommeStoreFind(MLIST *plans, char *name)
 {
-    if (!disk) return 0;
-
-    uint32_t freecount = 0;
+    if (!plans || !name) return NULL;
 
-    DommeFile *mfile;
-    MLIST_ITERATE(disk->tracks, mfile) {
-        if (!mfile->touched) freecount++;
+    DommeStore *plan;
+    MLIST_ITERATE(plans, plan) {
+        if (!strcmp(plan->name, name)) return plan;
     }
 
-    return freecount;
+    return NULL;
 }
 
-uint32_t artistFreeCount(DommeArtist *artist)
+/* 当前播放顺序与播放范围（媒体库、艺术家、专辑）及随机方式一致 */
+static bool _order_current(AudioEntry *me)
 {
-    if (!artist) return 0;
-
-    uint32_t freecount = 0;
-
-    DommeAlbum *disk;
-    MLIST_ITERATE(artist->albums, disk) {
-        freecount += albumFreeCount(disk);
-    }
-
-    return freecount;
+    return orderMatch(me->order, me->plan, me->artist, me->artist ? me->album : NULL, me->shuffle);
 }
 
-DommeStore* dommeStoreDefault(MLIST *plans)
+/* 播放顺序中只有曲目 ID，到媒体库中查找，已删除的曲目跳过 */
+static DommeFile* _order_next(AudioEntry *me)
 {
-    if (!plans) return NULL;
+    for (uint32_t i = 0; i < me->order->count; i++) {
+        const char *id = orderNext(me->order, me->loopon);
+        if (!id) return NULL;
 
-    DommeStore *plan = NULL;
-    MLIST_ITERATE(plans, plan) {
-        if (plan->moren) return plan;
+        DommeFile *mfile = dommeGetFile(me->plan, (char*)id);
+        if (mfile) return mfile;
     }
 
-    return plan;
+    return NULL;
 }
 
-DommeStore* dommeStoreFind(MLIST *plans, char *name)
+static DommeFile* _order_prev(AudioEntry *me)
 {
-    if (!plans || !name) return NULL;
-
-    DommeStore *plan;
-    MLIST_ITERATE(plans, plan) {
-        if (!strcmp(plan->name, name)) return plan;
+    const char *id;
+    while ((id = orderPrev(me->order)) != NULL) {
+        DommeFile *mfile = dommeGetFile(me->plan, (char*)id);
+        if (mfile) return mfile;
     }
 
     return NULL;
 }
 
-/* 用户指明了播放范围 */
-char* _told_todo(AudioEntry *me)
+static void _scope_done(AudioEntry *me)
 {
-    if (!me || !me->plan) return NULL;
-
-    if (me->trackid) return me->trackid;
-    else if (me->album && me->artist) {
-        /* 指明专辑 */
-        DommeArtist *artist = artistFind(me->plan->artists, me->artist);
-        DommeAlbum *disk = albumFind(artist->albums, me->album);
-        if (disk) {
-            disk->pos = 0;
-            if (me->shuffle) disk->pos = mos_rand(mlist_length(disk->tracks));
-
-            DommeFile *mfile = mlist_getx(disk->tracks, disk->pos);
-            if (mfile) {
-                mfile->touched = true;
-                return mfile->id;
-            }
-        }
-
+    if (me->album && me->artist) {
         mtc_mt_warn("no track to play %s %s", me->artist, me->album);
         free(me->album);
         free(me->artist);
         me->album = me->artist = NULL;
-        return NULL;
     } else if (me->artist) {
-        /* 指明艺术家 */
-        DommeArtist *artist = artistFind(me->plan->artists, me->artist);
-        if (artist) {
-            artist->pos = 0;
-            if (me->shuffle) artist->pos = mos_rand(mlist_length(artist->albums));
-
-            DommeAlbum *disk = mlist_getx(artist->albums, artist->pos);
-            if (disk) {
-                disk->pos = me->shuffle ? mos_rand(mlist_length(disk->tracks)) : 0;
-                DommeFile *mfile = mlist_getx(disk->tracks, disk->pos);
-                if (mfile) {
-                    mfile->touched = true;
-                    return mfile->id;
-                }
-            }
-        }
-
         mtc_mt_warn("no track to play %s", me->artist);
         free(me->artist);
         me->artist = NULL;
-        return NULL;
-    } else {
-        /* 指明媒体库 */
-        dommeFreeReset(me->plan);
-        if (me->shuffle) {
-            /* 随机艺术家比随机曲目更科学 */
-            me->plan->pos = mos_rand(mlist_length(me->plan->artists));
-            DommeArtist *artist = mlist_getx(me->plan->artists, me->plan->pos);
-            if (artist) {
-                artist->pos = mos_rand(mlist_length(artist->albums));
-                DommeAlbum *disk = mlist_getx(artist->albums, artist->pos);
-                if (disk) {
-                    disk->pos = mos_rand(mlist_length(disk->tracks));
-                    DommeFile *mfile = mlist_getx(disk->tracks, disk->pos);
-                    if (mfile) {
-                        me->plan->count_touched = 1;
-                        mfile->touched = true;
-                        return mfile->id;
-                    }
-                }
-            }
-        } else {
-            me->plan->pos = 0;
-            DommeArtist *artist = mlist_getx(me->plan->artists, me->plan->pos);
-            if (artist) {
-                artist->pos = 0;
-                DommeAlbum *disk = mlist_getx(artist->albums, artist->pos);
-                if (disk) {
-                    disk->pos = 0;
-                    DommeFile *mfile = mlist_getx(disk->tracks, disk->pos);
-                    if (mfile) {
-                        me->plan->count_touched = 1;
-                        mfile->touched = true;
-                        return mfile->id;
-                    }
-                }
-            }
-        }
+    } else mtc_mt_warn("no track to play %s", me->plan->name);
+}
+
+/* 用户指明了播放范围 */
+char* _told_todo(AudioEntry *me)
+{
+    if (!me || !me->plan) return NULL;
+
+    if (me->trackid) return me->trackid;
 
-        mtc_mt_warn("no track to play %s", me->plan->name);
-        return NULL;
+    /* 指明专辑、艺术家或媒体库，该范围从头开始 */
+    if (orderStart(me->order, me->plan, me->artist, me->artist ? me->album : NULL, me->shuffle, NULL)) {
+        DommeFile *mfile = _order_next(me);
+        if (mfile) return mfile->id;
     }
+
+    _scope_done(me);
+    return NULL;
 }
 
 /* 当前范围内轮到下一首 */
@@ -343,11 +347,6 @@ char* _next_todo(AudioEntry *me)
 {
     if (!me || !me->plan) return NULL;
 
-    DommeFile *mfile;
-    DommeAlbum *disk;
-    DommeArtist *artist;
-    DommeStore *plan = me->plan;
-
     if (me->trackid) {
         if (me->trackid != me->track->id) {
             /* 用户切了新歌 */
@@ -359,183 +358,18 @@ char* _next_todo(AudioEntry *me)
                 return NULL;
             }
         }
-    } else if (me->album && me->artist) {
-        mtc_mt_dbg("album's next");
-        /* 专辑内下一首 */
-        artist = artistFind(plan->artists, me->artist);
-        disk = albumFind(artist->albums, me->album);
-        if (disk) {
-            if (me->shuffle) {
-                uint32_t freecount = albumFreeCount(disk);
-                if (freecount == 0) {
-                    if (me->loopon) freecount = albumFreeReset(disk);
-                    else goto album_done;
-                }
-                uint32_t pos = mos_rand(freecount);
-                MLIST_ITERATE(disk->tracks, mfile) {
-                    if (!mfile->touched) {
-                        if (pos == 0) {
-                            mfile->touched = true;
-                            return mfile->id;
-                        }
-                        pos--;
-                    }
-                }
-            } else {
-                if (disk->pos >= mlist_length(disk->tracks) - 1) {
-                    if (me->loopon) {
-                        albumFreeReset(disk);
-                        disk->pos = 0;
-                        mfile = mlist_getx(disk->tracks, disk->pos);
-                        if (mfile) {
-                            mfile->touched = true;
-                            return mfile->id;
-                        }
-                    } else goto album_done;
-                } else {
-                    disk->pos += 1;
-                    mfile = mlist_getx(disk->tracks, disk->pos);
-                    if (mfile) {
-                        mfile->touched = true;
-                        return mfile->id;
-                    }
-                }
-            }
-        }
-
-    album_done:
-        mtc_mt_warn("no track to play %s %s", me->artist, me->album);
-        free(me->album);
-        free(me->artist);
-        me->album = me->artist = NULL;
-        return NULL;
-    } else if (me->artist) {
-        mtc_mt_dbg("artist's next");
-        /* 艺术家内下一首 */
-        artist = artistFind(plan->artists, me->artist);
-        if (artist) {
-            if (me->shuffle) {
-                /* 随机播放艺术家 */
-                uint32_t freecount = artistFreeCount(artist);
-                if (freecount == 0) {
-                    if (me->loopon) freecount = artistFreeReset(artist);
-                    else goto artist_done;
-                }
-                uint32_t pos = mos_rand(freecount);
-                MLIST_ITERATE(artist->albums, disk) {
-                    MLIST_ITERATEB(disk->tracks, mfile) {
-                        if (!mfile->touched) {
-                            if (pos == 0) {
-                                mfile->touched = true;
-                                return mfile->id;
-                            }
-                            pos--;
-                        }
-                    }
-                }
-            } else {
-                /* 顺序播放艺术家 */
-                disk = mlist_getx(artist->albums, artist->pos);
-                if (disk) {
-                    if (disk->pos >= mlist_length(disk->tracks) -1) {
-                        if (artist->pos >= mlist_length(artist->albums) - 1) {
-                            /* 弹尽粮绝 */
-                            if (me->loopon) {
-                                artistFreeReset(artist);
-                                //artist->pos = 0; TODO
-                                disk = mlist_getx(artist->albums, artist->pos);
-                                mfile = mlist_getx(disk->tracks, disk->pos);
-                                if (mfile) {
-                                    mfile->touched = true;
-                                    return mfile->id;
-                                }
-                            } else goto artist_done;
-                        } else {
-                            /* 播放下一张专辑 */
-                            artist->pos++;
-                            disk = mlist_getx(artist->albums, artist->pos);
-                            disk->pos = 0;
-                            mfile = mlist_getx(disk->tracks, disk->pos);
-                            if (mfile) {
-                                mfile->touched = true;
-                                return mfile->id;
-                            }
-                        }
-                    } else {
-                        /* 播放下一首曲目 */
-                        disk->pos++;
-                        mfile = mlist_getx(disk->tracks, disk->pos);
-                        if (mfile) {
-                            mfile->touched = true;
-                            return mfile->id;
-                        }
-                    }
-                }
-            }
-        }
+    }
 
-    artist_done:
-        mtc_mt_warn("no track to play %s", me->artist);
-        free(me->artist);
-        me->artist = NULL;
-        return NULL;
-    } else {
-        mtc_mt_dbg("library's next");
-        /* 媒体库内下一首 */
-        if (plan->count_touched >= plan->count_track) {
-            if (me->loopon) dommeFreeReset(plan);
-            else return NULL;
-        }
+    /* 切换了随机方式，或者媒体库有增删，从当前曲目接着往下排 */
+    if (!_order_current(me)) {
+        orderStart(me->order, me->plan, me->artist, me->artist ? me->album : NULL, me->shuffle, me->track->id);
+    }
 
-        if (me->shuffle) {
-            /* 随机播放 */
-        rerand:
-            plan->pos = mos_rand(mlist_length(plan->artists));
-            artist = mlist_getx(plan->artists, plan->pos);
-            int freeCount = artistFreeTrack(artist);
-            if (freeCount > 0) {
-                int pos = mos_rand(freeCount);
-                MLIST_ITERATE(artist->albums, disk) {
-                    MLIST_ITERATEB(disk->tracks, mfile) {
-                        if (!mfile->touched) {
-                            if (pos == 0) {
-                                mfile->touched = true;
-                                plan->count_touched++;
-                                return mfile->id;
-                            }
-                            pos--;
-                        }
-                    }
-                }
-            } else goto rerand;
-        } else {
-            /* 顺序播放 */
-        nextartist:
-            artist = mlist_getx(plan->artists, plan->pos);
-            if (artistFreeTrack(artist) > 0) {
-            nextdisk:
-                disk = mlist_getx(artist->albums, artist->pos);
-                if (albumFreeTrack(disk) > 0) {
-                    disk->pos++;
-                    mfile = mlist_getx(disk->tracks, disk->pos);
-                    if (mfile) {
-                        mfile->touched = true;
-                        plan->count_touched++;
-                        return mfile->id;
-                    }
-                } else if (artist->pos < mlist_length(artist->albums) - 1) {
-                    artist->pos++;
-                    goto nextdisk;
-                }
-            } else if (plan->pos < mlist_length(plan->artists) - 1) {
-                plan->pos++;
-                goto nextartist;
-            }
-        }
+    DommeFile *mfile = _order_next(me);
+    if (mfile) return mfile->id;
 
-        mtc_mt_warn("no track to play %s", plan->name);
-        return NULL;
-    }
+    _scope_done(me);
+    return NULL;
 }
 
 static bool _play_raw(AudioEntry *me, char *filename, DommeFile *mfile)
@@ -575,9 +409,10 @@ static bool _play_raw(AudioEntry *me, char *filename, DommeFile *mfile)
             track->percent = 0;
             track->samples_eat = 0;
         } else {
-            /* CUE 脚本指定了曲目起始位置 */
-            track->percent = (float)mfile->index / (mfile->length * 1000);
-            track->samples_eat = track->tinfo.samples * track->percent;
+            /* CUE 脚本指定了曲目起始位置，按采样率换算成精确的 PCM 帧 */
+            track->samples_eat = (uint64_t)mfile->index * track->tinfo.hz / 1000;
+            track->percent = track->tinfo.samples > 0 ?
+                (float)track->samples_eat / track->tinfo.samples : 0;
         }
     } else track->samples_eat = track->tinfo.samples * track->percent;
 
@@ -588,24 +423,18 @@ static bool _play_raw(AudioEntry *me, char *filename, DommeFile *mfile)
                mnode->driver->name, track->tinfo.channels == 2 ? "Stero" : "Mono",
                track->tinfo.samples, track->tinfo.hz, track->tinfo.kbps, track->tinfo.length);
 
+    nowPlayingTrack(me, mfile, mnode->driver->name);
+    timerPause(me->infotimer, false);
+
     Channel *slot = channelFind(me->base.channels, "PLAYING_INFO", false);
     if (!channelEmpty(slot) && mfile) {
         uint8_t bufsend[LEN_PACKET_NORMAL];
+        NowPlaying now;
+        nowPlayingRead(me, &now);
 
         MDF *dnode;
         mdf_init(&dnode);
-        mdf_set_value(dnode, "id", track->id);
-        mdf_set_int_value(dnode ,"length", track->tinfo.length);
-        mdf_set_int_value(dnode, "pos", track->tinfo.length * track->percent);
-        mdf_set_value(dnode, "title", mfile->title);
-        mdf_set_value(dnode, "artist", mfile->artist->name);
-        mdf_set_value(dnode, "album", mfile->disk->title);
-
-        mdf_set_value(dnode, "file_type", mnode->driver->name);
-        mdf_set_valuef(dnode, "bps=%dkbps", track->tinfo.kbps);
-        mdf_set_valuef(dnode, "rate=%.1fkhz", (float)track->tinfo.hz / 1000);
-        mdf_set_double_value(dnode, "volume", _get_normalized_volume(me->mixer));
-        mdf_set_bool_value(dnode, "shuffle", me->shuffle);
+        nowPlayingFill(&now, dnode);
 
         MessagePacket *packet = packetMessageInit(bufsend, LEN_PACKET_NORMAL);
         size_t sendlen = packetResponseFill(packet, SEQ_PLAY_INFO, CMD_PLAY_INFO, true, NULL, dnode);
@@ -618,8 +447,17 @@ static bool _play_raw(AudioEntry *me, char *filename, DommeFile *mfile)
 
     /* 播放 */
     me->act = ACT_NONE;
+    uint64_t xruns = me->out.xruns;
 
-    if (!mnode->driver->play(mnode, me)) {
+    ioTrackOpen(&track->io, filename);
+    bool played = mnode->driver->play(mnode, me);
+    ioTrackClose(&track->io);
+    nowPlayingStop(me);
+    if (me->out.xruns != xruns)
+        mtc_mt_warn("%ju xruns while playing %s, %ju total",
+                    (uintmax_t)(me->out.xruns - xruns), filename, (uintmax_t)me->out.xruns);
+
+    if (!played) {
         mtc_mt_err("play %s failure", filename);
         mnode->driver->close(mnode);
         return false;
@@ -651,29 +489,29 @@ static void* _player(void *arg)
 {
     AudioEntry *me = (AudioEntry*)arg;
     struct audioTrack *track = me->track;
-    int rv = 0;
 
     int loglevel = mtc_level_str2int(mdf_get_value(g_config, "trace.worker", "debug"));
     mtc_mt_initf("player", loglevel, g_log_tostdout ? "-"  :"%slog/%s.log", g_location, "player");
 
     mtc_mt_dbg("I am audio player");
 
+    outputRealtime(me);
+
+    if (mdf_get_bool_value(g_config, "trace.benchmark", false)) {
+        pcmBenchmark();
+        resamplerBenchmark();
+    }
+
     char filename[PATH_MAX];
     snprintf(filename, sizeof(filename), "%sconnect.mp3", g_location);
     _play_raw(me, filename, NULL);
     if (mdf_get_bool_value(g_runtime, "autoplay", false)) me->act = ACT_PLAY;
 
     while (me->running) {
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 1;
-
         pthread_mutex_lock(&me->lock);
-        while (me->act == ACT_NONE &&
-               (rv = pthread_cond_timedwait(&me->cond, &me->lock, &timeout)) == ETIMEDOUT) {
-            timeout.tv_sec += 1;
-            if (!me->running) break;
-        }
+        while (me->running && me->act == ACT_NONE) pthread_cond_wait(&me->cond, &me->lock);
+
+        WAKEUP(WAKE_PLAYER);
 
         mtc_mt_dbg("%s", _action_string(me->act));
 
@@ -682,13 +520,6 @@ static void* _player(void *arg)
             break;
         }
 
-        if (me->act == ACT_NONE && rv != 0) {
-            mtc_mt_err("timedwait error %s", strerror(errno));
-            pthread_mutex_unlock(&me->lock);
-            continue;
-        }
-
-        /* rv == 0 */
         pthread_mutex_unlock(&me->lock);
 
         /*
@@ -709,15 +540,33 @@ static void* _player(void *arg)
 
             break;
         case ACT_NEXT:
-            /* 自动切换下一首 */
+        {
+            /* 沿播放历史退回过时先沿历史前进，否则自动切换下一首 */
             me->act = ACT_NONE;
+            const char *id = _order_current(me) ? NULL : historyNext(me->history);
+            DommeFile *mfile = id ? dommeGetFile(me->plan, (char*)id) : NULL;
+            if (mfile) {
+                track->id = mfile->id;
+                _play(me);
+            }
+
             break;
+        }
         case ACT_PREV:
-            track->id = (char*)mlist_popx(me->playlist);
-            if (track->id) {
+        {
+            /* 范围内播放时沿播放顺序后退，否则取播放历史 */
+            DommeFile *mfile = !me->trackid && _order_current(me) ? _order_prev(me) : NULL;
+            if (mfile) {
+                track->id = mfile->id;
+                _play(me);
+                break;
+            }
+
+            const char *id = historyPrev(me->history);
+            mfile = id ? dommeGetFile(me->plan, (char*)id) : NULL;
+            if (mfile) {
+                track->id = mfile->id;
                 _play(me);
-                free(track->id);
-                track->id = NULL;
             } else {
                 mtc_mt_warn("nothing to play");
                 me->act = ACT_NONE;
@@ -725,6 +574,7 @@ static void* _player(void *arg)
             }
 
             break;
+        }
         case ACT_DRAG:
             if (track->id) {
                 track->percent = me->dragto;
@@ -767,17 +617,13 @@ static void* _player(void *arg)
             break;
         }
 
-        if (track->id && !_in_playlist(me->playlist, track->id)) {
-            mtc_mt_dbg("add %s to playlist", track->id);
-            mlist_append(me->playlist, strdup(track->id));
-        }
+        historyPush(me->history, track->id);
+        historySave(me->history, false);
 
         while (me->act == ACT_NONE && (track->id = _next_todo(me)) != NULL) {
             _play(me);
-            if (track->id && !_in_playlist(me->playlist, track->id)) {
-                mtc_mt_dbg("add %s to playlist", track->id);
-                mlist_append(me->playlist, strdup(track->id));
-            }
+            historyPush(me->history, track->id);
+            historySave(me->history, false);
         }
     }
 
@@ -788,13 +634,23 @@ static bool _push_trackinfo(void *data)
 {
     AudioEntry *me = (AudioEntry*)data;
 
+    /* 代数须在读取状态之前取得，之后的恢复才能撤销本次暂停 */
+    uint32_t gen = timerResumeGen(me->infotimer);
+
     Channel *slot = channelFind(me->base.channels, "PLAYING_INFO", false);
-    if (!channelEmpty(slot) && me->track->id && me->track->playing) {
-        uint8_t bufsend[LEN_IDIOT];
-        packetIdiotFill(bufsend, IDIOT_PLAY_STEP);
-        channelSend(slot, bufsend, LEN_IDIOT);
+    NowPlaying now;
+    nowPlayingRead(me, &now);
+
+    /* 开始播放、有新的订阅者时恢复 */
+    if (channelEmpty(slot) || !now.playing || !now.id[0]) {
+        timerPauseSelf(me->infotimer, gen);
+        return true;
     }
 
+    uint8_t bufsend[LEN_IDIOT];
+    packetIdiotFill(bufsend, IDIOT_PLAY_STEP);
+    channelSend(slot, bufsend, LEN_IDIOT);
+
     return true;
 }
 
@@ -826,7 +682,7 @@ bool audio_process(BeeEntry *be, QueueEntry *qe)
 
     switch (qe->command) {
     case CMD_STORE_SWITCH:
-        me->act = ACT_STOP;
+        _set_act(me, ACT_STOP);
         /* TODO wait _play() ? */
         char *name = mdf_get_value(qe->nodein, "name", NULL);
         if (name) me->plan = dommeStoreFind(me->plans, name);
@@ -835,24 +691,11 @@ bool audio_process(BeeEntry *be, QueueEntry *qe)
     {
         Channel *slot = channelFind(me->base.channels, "PLAYING_INFO", true);
         channelJoin(slot, qe->client);
+        timerPause(me->infotimer, false);
 
-        if (track->id && track->playing) {
-            DommeFile *mfile = dommeGetFile(me->plan, track->id);
-            if (mfile) {
-                mdf_set_value(qe->nodeout, "id", track->id);
-                mdf_set_int_value(qe->nodeout ,"length", track->tinfo.length);
-                mdf_set_int_value(qe->nodeout, "pos", track->tinfo.length * track->percent);
-                mdf_set_value(qe->nodeout, "title", mfile->title);
-                mdf_set_value(qe->nodeout, "artist", mfile->artist->name);
-                mdf_set_value(qe->nodeout, "album", mfile->disk->title);
-
-                mdf_set_value(qe->nodeout, "file_type", track->media_name);
-                mdf_set_valuef(qe->nodeout, "bps=%dkbps", track->tinfo.kbps);
-                mdf_set_valuef(qe->nodeout, "rate=%.1fkhz", (float)track->tinfo.hz / 1000);
-                mdf_set_double_value(qe->nodeout, "volume", _get_normalized_volume(me->mixer));
-                mdf_set_bool_value(qe->nodeout, "shuffle", me->shuffle);
-            }
-        }
+        NowPlaying now;
+        nowPlayingRead(me, &now);
+        if (now.playing && now.id[0]) nowPlayingFill(&now, qe->nodeout);
 
         MessagePacket *packet = packetMessageInit(qe->client->bufsend, LEN_PACKET_NORMAL);
         size_t sendlen = packetResponseFill(packet, qe->seqnum, qe->command, true, NULL, qe->nodeout);
@@ -864,11 +707,13 @@ bool audio_process(BeeEntry *be, QueueEntry *qe)
     case CMD_SET_SHUFFLE:
     {
         me->shuffle = mdf_get_bool_value(qe->nodein, "shuffle", false);
+        nowPlayingShuffle(me, me->shuffle);
     }
     break;
     case CMD_SET_VOLUME:
     {
-        _set_normalized_volume(me->mixer, mdf_get_double_value(qe->nodein, "volume", 0.2));
+        _set_normalized_volume(me, mdf_get_double_value(qe->nodein, "volume", 0.2));
+        nowPlayingVolume(me, _get_normalized_volume(me));
     }
     break;
     case CMD_PLAY:
@@ -879,7 +724,7 @@ bool audio_process(BeeEntry *be, QueueEntry *qe)
 
         /*
          * TODO memory leak
-         * 此时释放内存，会导致播放线程往 playlist 里面加入历史记录的时候访问已释放内存空间，暂不释放
+         * 此时释放内存，会导致播放线程记录播放历史的时候访问已释放内存空间，暂不释放
          */
         //mos_free(me->trackid);
         me->trackid = NULL;
@@ -890,24 +735,24 @@ bool audio_process(BeeEntry *be, QueueEntry *qe)
         if (name) me->artist = strdup(name);
         if (title) me->album = strdup(title);
 
-        me->act = ACT_PLAY;
+        _set_act(me, ACT_PLAY);
     }
     break;
     case CMD_PAUSE:
-        me->act = ACT_PAUSE;
+        _set_act(me, ACT_PAUSE);
         break;
     case CMD_RESUME:
-        me->act = ACT_RESUME;
+        _set_act(me, ACT_RESUME);
         break;
     case CMD_NEXT:
-        me->act = ACT_NEXT;
+        _set_act(me, ACT_NEXT);
         break;
     case CMD_PREVIOUS:
-        me->act = ACT_PREV;
+        _set_act(me, ACT_PREV);
         break;
     case CMD_DRAGTO:
         me->dragto = mdf_get_double_value(qe->nodein, "percent", 0.0);
-        me->act = ACT_DRAG;
+        _set_act(me, ACT_DRAG);
         break;
     default:
         break;
@@ -922,20 +767,25 @@ void audio_stop(BeeEntry *be)
 
     mtc_mt_dbg("stop worker %s", be->name);
 
-    me->act = ACT_STOP;
     me->running = false;
+    _set_act(me, ACT_STOP);
     pthread_cancel(me->worker);
     pthread_join(me->worker, NULL);
 
     pthread_cancel(me->indexer);
     pthread_join(me->indexer, NULL);
 
+    seekIndexStop();
+
     pthread_mutex_destroy(&me->lock);
+    pthread_mutex_destroy(&me->nowlock);
     pthread_mutex_destroy(&me->index_lock);
 
     mos_free(me->track);
     mlist_destroy(&me->plans);
-    mlist_destroy(&me->playlist);
+    historySave(me->history, true);
+    historyFree(me->history);
+    orderFree(me->order);
 }
 
 BeeEntry* _start_audio()
@@ -961,10 +811,13 @@ BeeEntry* _start_audio()
     me->loopon = false;
     me->remain = -1;
     me->dragto = 0.0;
-    mlist_init(&me->playlist, free);
+    me->history = historyCreate(mdf_get_int_value(g_config, "audio.history_size", 200));
+    historyLoad(me->history);
+    me->order = orderCreate();
 
     me->track = mos_calloc(1, sizeof(struct audioTrack));
     memset(me->track, 0x0, sizeof(struct audioTrack));
+    me->track->io.fd = -1;
     me->track->id = NULL;
     me->track->playing = false;
 
@@ -975,15 +828,11 @@ BeeEntry* _start_audio()
     me->track->percent = 0;
     me->track->samples_eat = 0;
 
-    int rv = snd_pcm_open(&me->pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
-    if (rv < 0) {
-        mtc_mt_err("Can't open default PCM device. %s", snd_strerror(rv));
-        return NULL;
-    }
+    if (!outputOpen(me)) return NULL;
 
     snd_mixer_t *mixer_handle;
     snd_mixer_open(&mixer_handle, 0);
-    snd_mixer_attach(mixer_handle, "default");
+    snd_mixer_attach(mixer_handle, mdf_get_value(g_config, "audio.mixer", "default"));
     snd_mixer_selem_register(mixer_handle, NULL, NULL);
     snd_mixer_load(mixer_handle);
 
@@ -993,24 +842,28 @@ BeeEntry* _start_audio()
     //snd_mixer_selem_id_set_name(sid, "Master");
     //me->mixer = snd_mixer_find_selem(mixer_handle, sid);
     me->mixer = snd_mixer_first_elem(mixer_handle);
-    if (!me->mixer) {
-        mtc_mt_err("Can't find mixer.");
-        return NULL;
-    }
+    if (!me->mixer) mtc_mt_warn("Can't find mixer, use software volume.");
+
+    me->nowseq = 0;
+    me->now.volume = _get_normalized_volume(me);
+    me->now.shuffle = me->shuffle;
 
     me->running = true;
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutex_init(&me->lock, &attr);
+    pthread_mutex_init(&me->nowlock, &attr);
     pthread_mutexattr_destroy(&attr);
     pthread_cond_init(&me->cond, NULL);
 
+    seekIndexStart();
     pthread_create(&me->worker, NULL, _player, me);
 
     pthread_mutex_init(&me->index_lock, NULL);
     pthread_create(&me->indexer, NULL, dommeIndexerStart, me);
 
     g_timers = timerAdd(g_timers, 2, false, me, _push_trackinfo);
+    me->infotimer = g_timers;
 
     return (BeeEntry*)me;
 }
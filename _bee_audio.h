@@ -3,6 +3,9 @@
 
 #include <alsa/asoundlib.h>
 
+#include "asset.h"
+#include "timer.h"
+
 #define LEN_DOMMEID 11
 #define LEN_MEDIA_TOKEN 128
 
@@ -31,18 +34,17 @@ typedef struct {
     char *title;
     char *year;
     MLIST *tracks;
-    uint32_t pos;               /* 当前播放曲目 */
 } DommeAlbum;
 
 typedef struct {
     char *name;
     MLIST *albums;
     uint32_t count_track;
-    uint32_t pos;               /* 当前播放专辑 */
 } DommeArtist;
 
-typedef struct {
+typedef struct dommeFile {
     char id[LEN_DOMMEID];
+    uint8_t idver;              /* ID 版本，0、1 为旧的 MD5 ID */
 
     char *dir;                  /* directory part of filename */
     char *name;                 /* name part of filename */
@@ -56,24 +58,76 @@ typedef struct {
     DommeAlbum  *disk;
     DommeArtist *artist;
 
-    bool touched;
+    struct dommeFile *twin;     /* 同一文件的下一首（CUE 分轨共用整轨文件），见 DommeDir */
 } DommeFile;
 
+/*
+ * 路径索引：每个目录一项，以 plan->dirs 中的字符串为键，
+ * 由 dommeStoreAddTrack()、dommeStoreRemoveTrack() 维护，按路径查找、按目录删除曲目不必遍历整个媒体库
+ */
+typedef struct {
+    char *path;                 /* plan->dirs 中的字符串 */
+    MHASH *files;               /* 文件名 -> DommeFile，同一文件的其他曲目经 twin 串起 */
+} DommeDir;
+
 typedef struct {
     char *name;
     char *basedir;              /* libroot + config.json中的path + [/] */
     bool moren;                 /* 默认媒体库 */
 
     MLIST *dirs;
+    MHASH *dirindex;            /* 目录 -> DommeDir */
     MHASH *mfiles;
     MLIST *artists;
 
     uint32_t count_album;
     uint32_t count_track;
-    uint32_t count_touched;
-    uint32_t pos;               /* 当前播放艺术家 */
+    uint32_t version;           /* 增删曲目时更新，全局递增，播放顺序据此判断是否需要重建 */
 } DommeStore;
 
+/* 成批加入媒体库的曲目，见 dommeStoreAddTracks() */
+typedef struct {
+    DommeFile *mfile;
+    char *artist;
+    char *album;
+    char *year;
+} DommeTrackAdd;
+
+/* 播放范围内的播放顺序，见 _audio_order.c */
+typedef struct {
+    DommeStore *plan;
+    uint32_t version;
+    char *artist;               /* 范围，均为 NULL 时为整个媒体库 */
+    char *album;
+    bool shuffle;
+
+    char (*ids)[LEN_DOMMEID];   /* 范围内可播放曲目的 ID（索引线程会释放 DommeFile，不保存指针） */
+    uint32_t count;
+    uint32_t *perm;             /* 随机播放时各分组内就地洗牌 */
+    uint32_t *played;           /* 已播放的下标序列 */
+    uint32_t nplayed;
+    uint32_t pos;               /* 当前曲目为 played[pos-1] */
+
+    uint32_t *gstart;           /* 分组（艺术家或专辑）在 ids 中的起始下标 */
+    uint32_t *gcount;
+    uint32_t *gdrawn;           /* 组内已抽取数 */
+    uint32_t *live;             /* 尚有曲目未抽取的分组 */
+    uint32_t ngroup;
+    uint32_t nlive;
+} PlayOrder;
+
+/* 播放历史，见 _audio_history.c */
+typedef struct {
+    char (*ids)[LEN_DOMMEID];   /* size 个槽位 */
+    uint32_t size;
+    uint32_t first;             /* 最早一条记录的序号 */
+    uint32_t last;              /* 下一条记录的序号 */
+    uint32_t cursor;            /* 当前曲目的序号 */
+    MHASH *members;             /* 曲目 ID => 最近一条记录的序号 + 1 */
+    time_t savetime;
+    bool dirty;
+} PlayHistory;
+
 /*
  * ================ AUDIO ================
  */
@@ -94,6 +148,20 @@ typedef struct {
     uint32_t length;            /* track length in seconds */
 } ArtInfo;
 
+/* 播放文件的 I/O 提示，见 _audio_io.c */
+typedef struct {
+    int fd;                     /* 单独打开的只读 fd，只用来下达提示 */
+    uint64_t size;
+    uint64_t window;            /* 预读窗口 */
+    uint64_t ahead;             /* 已 WILLNEED 至此 */
+    uint64_t behind;            /* 已 DONTNEED 至此 */
+    bool drop;                  /* 大文件，丢弃已播放的部分 */
+    bool prefetch;
+    bool prefetched;            /* 已预读下一首 */
+    const void *map;            /* 解码器的映射 */
+    size_t maplen;
+} MediaIO;
+
 struct audioTrack {
     char *id;                   /* 当前正在播放的曲目 */
     bool playing;
@@ -106,6 +174,68 @@ struct audioTrack {
 
     float percent;              /* 当前播放进度，或拖拽百分比 */
     uint64_t samples_eat;
+
+    MediaIO io;
+};
+
+typedef struct {
+    int inrate;
+    int outrate;
+    int channels;
+    int L;                      /* 插值因子 */
+    int M;                      /* 抽取因子 */
+    int taps;                   /* 每相抽头数 */
+    const char *quality;
+    float *coeffs;              /* L 组系数，每组 taps 个 */
+    float *buf;                 /* 每声道 buflen 个样本（历史 + 新输入） */
+    size_t buflen;
+    size_t fill;
+    size_t pos;                 /* 下一个输出样本对应的最新输入样本 */
+    int phase;
+} Resampler;
+
+/* 正在播放信息的快照，见 _audio_nowplaying.c */
+typedef struct {
+    bool playing;
+    char id[LEN_DOMMEID];
+    char title[LEN_MEDIA_TOKEN];
+    char artist[LEN_MEDIA_TOKEN];
+    char album[LEN_MEDIA_TOKEN];
+    const char *media_name;     /* 媒体插件名，静态字符串 */
+    TechInfo tinfo;
+    uint64_t samples;           /* 已播放的 PCM 帧 */
+    double volume;
+    bool shuffle;
+    uint64_t xruns;
+} NowPlaying;
+
+struct audioOutput {
+    char *device;
+    snd_pcm_format_t format;    /* 声卡样本格式 */
+    snd_pcm_format_t sformat;   /* 解码器输出格式 */
+    bool mmap;                  /* 是否 MMAP_INTERLEAVED 访问 */
+    bool direct;                /* 解码器可直接写入声卡缓冲区 */
+    int channels;               /* 声卡声道数 */
+    int src_channels;           /* 音源声道数 */
+    int hz;
+    int bits;                   /* 音源位宽 */
+    float gain;                 /* 软件音量（没有 mixer 时使用） */
+    int fixed_rate;             /* 固定输出采样率，0 为跟随音源 */
+    int rate;                   /* 声卡采样率 */
+    Resampler *resampler;
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t mmap_offset;
+    void *area;                 /* 当前 outputBegin() 返回的区域 */
+    void *stage;                /* RW 访问时的中转缓冲 */
+    void *scratch;              /* 非直接输出时的解码缓冲 */
+    void *upmix;
+    void *widen;                /* 重采样前的 s32 缓冲 */
+    void *resampled;
+    uint32_t dither[4];
+    int rt_cpu;                 /* 播放线程独占的 CPU，-1 为不绑定 */
+    bool mlock;                 /* 播放缓冲已锁定在内存中 */
+    uint64_t xruns;
 };
 
 struct watcher {
@@ -139,6 +269,7 @@ typedef struct {
 
     snd_pcm_t *pcm;
     snd_mixer_elem_t *mixer;
+    struct audioOutput out;
 
     MLIST *plans;               /* 所有媒体库列表 */
     DommeStore *plan;           /* 当前使用的媒体库 */
@@ -154,19 +285,56 @@ typedef struct {
     int remain;
     float dragto;
 
-    MLIST *playlist;            /* 播放列表 */
+    PlayHistory *history;       /* 播放历史 */
+    PlayOrder *order;
 
     struct audioTrack *track;
+
+    pthread_mutex_t nowlock;    /* 写者互斥 */
+    uint32_t nowseq;            /* seqlock 序号，奇数时正在写入 */
+    NowPlaying now;
+
+    TimerEntry *infotimer;      /* 播放进度推送，没有在播放或没有订阅者时暂停 */
 } AudioEntry;
 
+/*
+ * ================ SEEK ================
+ */
+typedef struct {
+    uint64_t sample;            /* 该点开始的 PCM 帧序号（解码输出的位置，含编码器延迟） */
+    uint64_t offset;            /* 该点对应音频帧在文件中的偏移 */
+} SeekPoint;
+
+typedef struct {
+    uint32_t hz;
+    uint32_t interval;          /* 索引点最小间隔（PCM 帧数） */
+    uint64_t dataoffset;        /* 第一个音频帧在文件中的偏移 */
+    uint32_t delay;             /* 编码器延迟，曲目时间轴上的位置 + delay 为解码输出的位置 */
+    uint32_t count;
+    uint32_t size;
+    SeekPoint *points;
+    bool dumped;                /* 已保存至索引文件 */
+} SeekIndex;
+
 /*
  * ================ MEDIA ================
  */
+typedef struct {
+    ASSET_TYPE asset;
+    MEDIA_TYPE media;
+    uint8_t idver;              /* 0 为尚未计算 ID */
+    char id[LEN_DOMMEID];
+    TechInfo tinfo;
+    ArtInfo ainfo;
+} ProbeInfo;
+
 typedef struct {
     char filename[PATH_MAX];
-    char md5[33];
+    char md5[33];               /* 媒体 ID，由 mediaIdGet() 按需计算，空串为尚未计算 */
+    uint8_t idver;              /* 媒体 ID 版本 */
     TechInfo tinfo;
     ArtInfo ainfo;
+    SeekIndex *sindex;
     struct _media_entry *driver;
 } MediaNode;
 
@@ -174,18 +342,111 @@ typedef struct _media_entry {
     MEDIA_TYPE type;
     const char *name;
 
-    bool (*check)(const char *filename);
-
     MediaNode* (*open)(const char *filename);
+    bool       (*id_get)(MediaNode *mnode);     /* 计算媒体 ID 至 mnode->md5，可能读取整个文件 */
     TechInfo*  (*tech_info_get)(MediaNode *mnode);
     ArtInfo*   (*art_info_get)(MediaNode *mnode);
     uint8_t*   (*cover_get)(MediaNode *mnode, size_t *imagelen);
     bool       (*play)(MediaNode *mnode, AudioEntry *audio);
     void       (*close)(MediaNode *mnode);
+
+    SeekIndex* (*seek_index_build)(MediaNode *mnode);   /* 扫描整个文件生成索引 */
+    SeekIndex* (*seek_index_native)(MediaNode *mnode);  /* 文件自带的索引（FLAC SEEKTABLE），不保存 */
 } MediaEntry;
 
+void pcmS16ToS32(int32_t *dst, const int16_t *src, size_t n);
+void pcmS16ToS24(uint8_t *dst, const int16_t *src, size_t n);
+void pcmS32ToS16(int16_t *dst, const int32_t *src, size_t n, uint32_t *seed);
+void pcmS32ToS24(uint8_t *dst, const int32_t *src, size_t n);
+void pcmUpmixS16(int16_t *dst, const int16_t *src, size_t frames);
+void pcmUpmixS32(int32_t *dst, const int32_t *src, size_t frames);
+void pcmGain(void *buf, snd_pcm_format_t format, size_t n, float gain);
+bool pcmConvert(void *dst, snd_pcm_format_t dformat,
+                const void *src, snd_pcm_format_t sformat, size_t n, uint32_t *seed);
+void pcmBenchmark();
+
+Resampler* resamplerCreate(int inrate, int outrate, int channels, const char *quality);
+void resamplerFree(Resampler *rs);
+size_t resamplerMaxOutput(Resampler *rs);
+size_t resamplerProcess(Resampler *rs, const int32_t *src, size_t frames, int32_t *dst);
+void resamplerBenchmark();
+
+bool outputOpen(AudioEntry *me);
+void outputRealtime(AudioEntry *me);
+void outputYieldCPU(AudioEntry *me);
+void outputDrop(AudioEntry *me);
+bool outputSetup(AudioEntry *me, int channels, int hz, int bits);
+void outputGain(AudioEntry *me, float gain);
+void* outputBegin(AudioEntry *me, snd_pcm_uframes_t *frames);
+snd_pcm_sframes_t outputCommit(AudioEntry *me, snd_pcm_uframes_t frames);
+bool outputPassthrough(AudioEntry *me, snd_pcm_format_t format);
+snd_pcm_sframes_t outputPCM(AudioEntry *me, const void *buf, snd_pcm_uframes_t frames);
+void* outputBuffer(AudioEntry *me, snd_pcm_uframes_t *frames);
+snd_pcm_sframes_t outputWrite(AudioEntry *me, const void *buf, snd_pcm_format_t format,
+                              int channels, snd_pcm_uframes_t frames);
+
 MEDIA_TYPE mediaType(const char *filename);
 MediaNode* mediaOpen(const char *filename);
+const char* mediaIdGet(MediaNode *mnode);
+bool mediaFingerprint(const char *filename, uint64_t start, uint64_t end, char id[33]);
+int mediaIdVersion();
+
+ASSET_TYPE probeAssetType(const char *filename, MEDIA_TYPE *media);
+bool probeInfoGet(const char *filename, ProbeInfo *info);
+MEDIA_TYPE probeMediaType(const char *filename);
+void probeMediaSet(MediaNode *mnode);
+int  probeCoverGet(const char *filename);
+void probeCoverSet(const char *filename, bool cover);
+bool probeCacheSave(MLIST *plans);
+
+SeekIndex* seekIndexCreate(uint32_t hz, uint64_t dataoffset);
+void seekIndexFree(SeekIndex *sindex);
+void seekIndexAppend(SeekIndex *sindex, uint64_t sample, uint64_t offset);
+SeekPoint* seekIndexFind(SeekIndex *sindex, uint64_t sample);
+SeekIndex* seekIndexLoad(const char *filename);
+bool seekIndexDump(SeekIndex *sindex, const char *filename);
+void seekIndexRemove(const char *filename);
+void seekIndexStart();
+void seekIndexStop();
+void seekIndexQueue(const char *filename);
+SeekIndex* mediaSeekIndex(MediaNode *mnode, bool build);
+
+PlayOrder* orderCreate();
+void orderFree(PlayOrder *order);
+bool orderStart(PlayOrder *order, DommeStore *plan, const char *artist, const char *album,
+                bool shuffle, const char *first);
+bool orderMatch(PlayOrder *order, DommeStore *plan, const char *artist, const char *album, bool shuffle);
+const char* orderNext(PlayOrder *order, bool loop);
+const char* orderPrev(PlayOrder *order);
+const char* orderPeek(PlayOrder *order, bool loop);
+
+void nowPlayingRead(AudioEntry *me, NowPlaying *now);
+void nowPlayingTrack(AudioEntry *me, DommeFile *mfile, const char *media_name);
+void nowPlayingStop(AudioEntry *me);
+void nowPlayingPosition(AudioEntry *me, uint64_t samples);
+void nowPlayingVolume(AudioEntry *me, double volume);
+void nowPlayingShuffle(AudioEntry *me, bool shuffle);
+void nowPlayingFill(NowPlaying *now, MDF *node);
+
+PlayHistory* historyCreate(uint32_t size);
+void historyFree(PlayHistory *history);
+void historyPush(PlayHistory *history, const char *id);
+const char* historyPrev(PlayHistory *history);
+const char* historyNext(PlayHistory *history);
+void historyLoad(PlayHistory *history);
+void historySave(PlayHistory *history, bool force);
+
+void ioTrackOpen(MediaIO *io, const char *filename);
+void ioTrackMap(MediaIO *io, const void *addr, size_t len);
+void ioTrackAdvance(MediaIO *io, uint64_t offset);
+void ioTrackClose(MediaIO *io);
+void ioPrefetch(const char *filename);
+void ioPlayProgress(AudioEntry *me);
+void ioDropBehind(int fd, off_t offset, off_t len);
+void ioDropFile(const char *filename);
+void ioStat(MDF *node);
+
+void indexerBenchmark();
 
 /*
  * ================ method ================
@@ -194,6 +455,9 @@ DommeStore* dommeStoreCreate();
 void dommeStoreFree(void *p);
 MERR* dommeLoadFromFilef(DommeStore *plan, char *fmt, ...);
 DommeFile* dommeGetFile(DommeStore *plan, char *id);
+char* dommeStoreDir(DommeStore *plan, const char *dir, bool create);
+DommeFile* dommeStoreFindPath(DommeStore *plan, const char *dir, const char *name);
+void dommeStoreRemoveTrack(DommeStore *plan, DommeFile *mfile);
 
 DommeArtist* artistFind(MLIST *artists, char *name);
 DommeAlbum* albumFind(MLIST *albums, char *title);
@@ -41,6 +41,31 @@ static char* _size_2_string(uint64_t len)
     return res;
 }
 
+/* 各循环的唤醒次数，及距上次查询的每秒唤醒数（空闲时应接近 0，查询本身会唤醒 main、worker 各一次） */
+static void _wakeup_stat(MDF *node)
+{
+    static const char *names[WAKE_MAX] = {"main", "timer", "worker", "pusher", "player", "indexer"};
+    static uint64_t lastcount = 0;
+    static double lasttime = 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double now = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    uint64_t total = 0;
+    for (int i = 0; i < WAKE_MAX; i++) {
+        uint64_t count = __atomic_load_n(&g_wakeups[i], __ATOMIC_RELAXED);
+        mdf_set_int64_value(node, names[i], count);
+        total += count;
+    }
+
+    if (lasttime > 0 && now > lasttime)
+        mdf_set_double_value(node, "perSecond", (total - lastcount) / (now - lasttime));
+
+    lastcount = total;
+    lasttime = now;
+}
+
 static struct diskinfo _get_disk_space(const char *path)
 {
     struct diskinfo fsinfo = {.capacity = 0, .occupy = 0, .percent = 0.0};
@@ -220,10 +245,11 @@ struct fsentity* _media_info_get(const char *path, struct fsentity *nodes, int *
     while ((entry = readdir(dir)) != NULL) {
         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
 
+        MEDIA_TYPE mtype = MEDIA_UNKNOWN;
         if (entry->d_type == DT_REG) {
             snprintf(filename, sizeof(filename), "%s%s", path, entry->d_name);
 
-            if (assetType(filename) == ASSET_UNKNOWN) continue;
+            if (probeAssetType(filename, &mtype) == ASSET_UNKNOWN) continue;
         } else if (entry->d_type != DT_DIR) continue;
 
         /* 剩下的都是有用的 */
@@ -233,7 +259,7 @@ struct fsentity* _media_info_get(const char *path, struct fsentity *nodes, int *
         if (entry->d_type == DT_DIR) item->type = 0;
         else if (entry->d_type == DT_REG) {
             item->type = 1;
-            if (mediaType(filename) != MEDIA_UNKNOWN) tracknum++;
+            if (mtype != MEDIA_UNKNOWN) tracknum++;
         }
 
         item->next = nodes;
@@ -355,6 +381,14 @@ bool hdw_process(BeeEntry *be, QueueEntry *qe)
         }
         mdf_object_2_array(snode, NULL);
 
+        /* 同步转码 */
+        transcodeStat(mdf_get_or_create_node(qe->nodeout, "transcode"));
+
+        _wakeup_stat(mdf_get_or_create_node(qe->nodeout, "wakeups"));
+
+        /* 页缓存压力 */
+        ioStat(mdf_get_or_create_node(qe->nodeout, "pagecache"));
+
         packet = packetMessageInit(qe->client->bufsend, LEN_PACKET_NORMAL);
         sendlen = packetResponseFill(packet, qe->seqnum, qe->command, true, NULL, qe->nodeout);
     }
@@ -1,3 +1,11 @@
+#include <poll.h>
+#include <sys/sendfile.h>
+
+#define STREAM_CHUNK (256 * 1024)   /* 每次 sendfile 的长度，也是检查是否放弃的粒度 */
+#define DROP_CHUNK (1024 * 1024)    /* 推送时每读这么多丢弃一次页缓存 */
+#define STREAM_INDEX_WAIT 15        /* 秒，流式传输等待后台生成定位索引的最长时间 */
+#define STREAM_RETRY_MS 500         /* 等待定位索引的请求每隔多久重试一次 */
+
 typedef struct {
     BeeEntry base;
 
@@ -13,7 +21,10 @@ typedef struct {
     char *storepath;
 
     MLIST *synclist;            /* list of struct reqitem* */
+    MLIST *waitlist;            /* 等待定位索引生成的 SYNC_STREAM 请求 */
     MLIST *clients;             /* list of NetBinaryNode* */
+    bool sweep;                 /* 有用户断开，空闲时清理 */
+    bool delivered;             /* 有转码完成，待通知手机 */
 } StorageEntry;
 
 struct reqitem {
@@ -22,10 +33,16 @@ struct reqitem {
     char *id;
     char *artist;
     char *album;
+    uint64_t sample;            /* SYNC_STREAM 起始 PCM 帧 */
+    uint32_t streamgen;
+    time_t deadline;            /* SYNC_STREAM 等待定位索引的截止时间 */
+    bool waiting;               /* 已转入 waitlist，不能释放 */
 
     NetBinaryNode *client;
 };
 
+#include "_storage_transcode.c"
+
 static void _client_destroy(void *p)
 {
     if (!p) return;
@@ -81,6 +98,28 @@ void reqitem_free(void *arg)
     mos_free(item);
 }
 
+/* 发送文件内容，读过的部分随即丢出页缓存，同步整个媒体库时不会挤掉 music.db 等常用数据 */
+static void _push_contents(NetBinaryNode *client, FILE *fp)
+{
+    int fd = fileno(fp);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint8_t buf[4096] = {0};
+    size_t len = 0;
+    off_t done = 0, dropped = 0;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        SSEND(client->base.fd, buf, len);
+
+        done += len;
+        if (done - dropped >= DROP_CHUNK) {
+            ioDropBehind(fd, dropped, done - dropped);
+            dropped = done;
+        }
+    }
+
+    ioDropBehind(fd, dropped, 0);
+}
+
 bool _push_raw(StorageEntry *me, struct reqitem *item)
 {
     NetBinaryNode *client = item->client;
@@ -113,11 +152,7 @@ bool _push_raw(StorageEntry *me, struct reqitem *item)
         return false;
     }
 
-    uint8_t buf[4096] = {0};
-    size_t len = 0;
-    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        SSEND(client->base.fd, buf, len);
-    }
+    _push_contents(client, fp);
 
     fclose(fp);
 
@@ -152,11 +187,7 @@ bool _push_puppet(NetBinaryNode *client, const char *filename, const char *pupna
         return false;
     }
 
-    uint8_t buf[4096] = {0};
-    size_t len = 0;
-    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        SSEND(client->base.fd, buf, len);
-    }
+    _push_contents(client, fp);
 
     fclose(fp);
 
@@ -198,11 +229,7 @@ bool _push_store_file(StorageEntry *me, struct reqitem *item)
         return false;
     }
 
-    uint8_t buf[4096] = {0};
-    size_t len = 0;
-    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        SSEND(client->base.fd, buf, len);
-    }
+    _push_contents(client, fp);
 
     fclose(fp);
 
@@ -226,8 +253,11 @@ bool _push_track_cover(StorageEntry *me, struct reqitem *item)
 
         uint8_t *imgbuf = NULL;
         size_t coversize = 0;
-        MediaNode *mnode = mediaOpen(filename);
-        if (mnode) imgbuf = mnode->driver->cover_get(mnode, &coversize);
+        MediaNode *mnode = probeCoverGet(filename) != 0 ? mediaOpen(filename) : NULL;
+        if (mnode) {
+            imgbuf = mnode->driver->cover_get(mnode, &coversize);
+            probeCoverSet(filename, imgbuf != NULL);
+        }
 
         if (!imgbuf) {
             if (mnode) mnode->driver->close(mnode);
@@ -276,8 +306,11 @@ bool _push_artist_cover(StorageEntry *me, struct reqitem *item)
 
                 uint8_t *imgbuf = NULL;
                 size_t coversize = 0;
-                MediaNode *mnode = mediaOpen(filename);
-                if (mnode) imgbuf = mnode->driver->cover_get(mnode, &coversize);
+                MediaNode *mnode = probeCoverGet(filename) != 0 ? mediaOpen(filename) : NULL;
+                if (mnode) {
+                    imgbuf = mnode->driver->cover_get(mnode, &coversize);
+                    probeCoverSet(filename, imgbuf != NULL);
+                }
 
                 if (!imgbuf) {
                     if (mnode) mnode->driver->close(mnode);
@@ -329,8 +362,11 @@ bool _push_album_cover(StorageEntry *me, struct reqitem *item)
 
                 uint8_t *imgbuf = NULL;
                 size_t coversize = 0;
-                MediaNode *mnode = mediaOpen(filename);
-                if (mnode) imgbuf = mnode->driver->cover_get(mnode, &coversize);
+                MediaNode *mnode = probeCoverGet(filename) != 0 ? mediaOpen(filename) : NULL;
+                if (mnode) {
+                    imgbuf = mnode->driver->cover_get(mnode, &coversize);
+                    probeCoverSet(filename, imgbuf != NULL);
+                }
 
                 if (!imgbuf) {
                     if (mnode) mnode->driver->close(mnode);
@@ -375,11 +411,272 @@ bool _push_pong(StorageEntry *me, struct reqitem *item)
     return true;
 }
 
+/* 零拷贝发送 fd 中 [offset, offset + len)，客户端断开或放弃时返回 false */
+static bool _stream_range(NetBinaryNode *client, uint32_t gen, int fd, off_t offset, size_t len)
+{
+    while (len > 0) {
+        if (client->base.dropped || __atomic_load_n(&client->streamgen, __ATOMIC_RELAXED) != gen)
+            return false;
+
+        ssize_t rv = sendfile(client->base.fd, fd, &offset, len > STREAM_CHUNK ? STREAM_CHUNK : len);
+        if (rv < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* 手机消费慢时在此等待，即为流控 */
+                struct pollfd pfd = {.fd = client->base.fd, .events = POLLOUT};
+                poll(&pfd, 1, 1000);
+                continue;
+            } else if (errno == EINTR) continue;
+
+            mtc_mt_warn("sendfile failure %s", strerror(errno));
+            return false;
+        } else if (rv == 0) {
+            mtc_mt_warn("file shrinked while streaming");
+            return false;
+        }
+
+        ioDropBehind(fd, offset - rv, rv);
+        len -= rv;
+    }
+
+    return true;
+}
+
+/* 重写后的文件头由若干段组成，每段为 data 中的内容 + 文件中 [offset, offset + len) */
+struct stream_part {
+    uint8_t data[42];
+    size_t datalen;
+    off_t offset;
+    size_t len;
+};
+
+/*
+ * 从索引点开始传输时，文件头中描述整个文件的字段不再成立，需要重写：
+ * FLAC 只保留 STREAMINFO（总采样数改为剩余采样数，MD5 清零）和 VORBIS_COMMENT，
+ *      SEEKTABLE、CUESHEET 的偏移都是相对整个文件的，与 PICTURE、PADDING 等一并去掉
+ * MP3  只保留 ID3v2 标签，去掉 Xing/Info/VBRI 帧（其中的帧数、TOC 描述的是整个文件）
+ * 返回段数，无法重写时返回 -1
+ */
+static int _stream_header(int fd, MEDIA_TYPE type, uint64_t headlen, uint64_t sample,
+                          struct stream_part parts[2])
+{
+    uint8_t buf[42];
+
+    memset(parts, 0x0, 2 * sizeof(struct stream_part));
+
+    if (type == MEDIA_FLAC) {
+        if (headlen < 42 || pread(fd, buf, 42, 0) != 42 ||
+            memcmp(buf, "fLaC", 4) || (buf[4] & 0x7F) != 0) return -1;
+
+        /* STREAMINFO 第 13 字节起 36 位总采样数，其后 16 字节 MD5 */
+        uint64_t total = ((uint64_t)(buf[21] & 0x0F) << 32) |
+            ((uint64_t)buf[22] << 24) | (buf[23] << 16) | (buf[24] << 8) | buf[25];
+        uint64_t remain = total > sample ? total - sample : 0;
+        buf[21] = (buf[21] & 0xF0) | ((remain >> 32) & 0x0F);
+        buf[22] = remain >> 24;
+        buf[23] = remain >> 16;
+        buf[24] = remain >> 8;
+        buf[25] = remain;
+        memset(buf + 26, 0x0, 16);
+
+        bool last = buf[4] & 0x80;
+        buf[4] |= 0x80;
+
+        memcpy(parts[0].data, buf, 42);
+        parts[0].datalen = 42;
+
+        uint64_t pos = 42;
+        uint8_t head[4];
+        while (!last && pos + 4 <= headlen && pread(fd, head, 4, pos) == 4) {
+            last = head[0] & 0x80;
+            size_t len = (head[1] << 16) | (head[2] << 8) | head[3];
+            if (pos + 4 + len > headlen) return -1;
+
+            if ((head[0] & 0x7F) == 4) {
+                /* VORBIS_COMMENT 成为最后一个元数据块 */
+                parts[0].data[4] &= 0x7F;
+                parts[1].data[0] = 0x84;
+                memcpy(parts[1].data + 1, head + 1, 3);
+                parts[1].datalen = 4;
+                parts[1].offset = pos + 4;
+                parts[1].len = len;
+                return 2;
+            }
+
+            pos += 4 + len;
+        }
+
+        return 1;
+    } else if (type == MEDIA_MP3) {
+        if (headlen >= 10 && pread(fd, buf, 10, 0) == 10 && !memcmp(buf, "ID3", 3)) {
+            uint64_t len = 10 + (((buf[6] & 0x7F) << 21) | ((buf[7] & 0x7F) << 14) |
+                                 ((buf[8] & 0x7F) << 7) | (buf[9] & 0x7F));
+            if (buf[5] & 0x10) len += 10;
+            parts[0].len = len < headlen ? len : headlen;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * 从 item->sample 所在的索引点起流式传输曲目
+ * 传输内容为重写后的文件头 + 索引点至文件尾，手机端可以直接解码播放。
+ * 文件名为 stream/<id>/<实际起始帧>，实际起始帧为不大于 item->sample 的索引点。
+ * 索引点来自 FLAC 自带的 SEEKTABLE 或已生成的定位索引文件；都没有时已排队由后台生成，
+ * 请求转入 waitlist 稍后重试，超过 STREAM_INDEX_WAIT 仍没有时才传输整个文件（从头播放时也传输整个文件）
+ */
+bool _push_stream(StorageEntry *me, struct reqitem *item)
+{
+    NetBinaryNode *client = item->client;
+    if (client->base.fd <= 0 || !item->id || !me->plan || !me->storepath) return false;
+
+    if (__atomic_load_n(&client->streamgen, __ATOMIC_RELAXED) != item->streamgen) {
+        mtc_mt_dbg("stream %s abandoned before start", item->id);
+        return false;
+    }
+
+    DommeFile *mfile = dommeGetFile(me->plan, item->id);
+    if (!mfile) {
+        mtc_mt_warn("%s not exist", item->id);
+        return false;
+    }
+
+    char filename[PATH_MAX] = {0};
+    snprintf(filename, sizeof(filename), "%s%s%s%s", me->libroot, me->storepath, mfile->dir, mfile->name);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        mtc_mt_warn("open %s failure %s", filename, strerror(errno));
+        return false;
+    }
+
+    struct stat fs;
+    if (fstat(fd, &fs) != 0) {
+        close(fd);
+        return false;
+    }
+
+    struct stream_part parts[2] = {{.datalen = 0, .offset = 0, .len = fs.st_size}};
+    int partc = 1;
+    uint64_t offset = fs.st_size, sample = 0;
+    if (item->sample > 0) {
+        MediaNode *mnode = mediaOpen(filename);
+        SeekIndex *sindex = mediaSeekIndex(mnode, false);
+        if (!sindex && mnode && mnode->driver->seek_index_build) {
+            time_t now = time(NULL);
+            if (item->deadline == 0) item->deadline = now + STREAM_INDEX_WAIT;
+            if (now < item->deadline) {
+                mtc_mt_dbg("stream %s waiting for seek index", mfile->name);
+                mnode->driver->close(mnode);
+                close(fd);
+
+                pthread_mutex_lock(&me->lock);
+                item->waiting = true;
+                mlist_append(me->waitlist, item);
+                pthread_mutex_unlock(&me->lock);
+                return true;
+            }
+            mtc_mt_warn("no seek index for %s after %ds, stream whole file", mfile->name, STREAM_INDEX_WAIT);
+        }
+
+        SeekPoint *point = seekIndexFind(sindex, item->sample);
+        if (point && point->offset > mnode->sindex->dataoffset && point->offset < (uint64_t)fs.st_size) {
+            int count = _stream_header(fd, mnode->driver->type, mnode->sindex->dataoffset, point->sample, parts);
+            if (count >= 0) {
+                partc = count;
+                offset = point->offset;
+                /* 换算回曲目时间轴（MP3 的索引点含编码器延迟） */
+                sample = point->sample > mnode->sindex->delay ? point->sample - mnode->sindex->delay : 0;
+            } else parts[0] = (struct stream_part){.datalen = 0, .offset = 0, .len = fs.st_size};
+        }
+        if (mnode) mnode->driver->close(mnode);
+    }
+
+    uint64_t total = fs.st_size - offset;
+    for (int i = 0; i < partc; i++) total += parts[i].datalen + parts[i].len;
+
+    mtc_mt_dbg("stream %s from %ju to %d", mfile->name, (uintmax_t)sample, client->base.fd);
+
+    posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* CMD_SYNC */
+    char nameWithPath[PATH_MAX];
+    snprintf(nameWithPath, sizeof(nameWithPath), "stream/%s/%ju", item->id, (uintmax_t)sample);
+
+    uint8_t bufsend[LEN_PACKET_NORMAL];
+    MessagePacket *packet = packetMessageInit(bufsend, LEN_PACKET_NORMAL);
+    size_t sendlen = packetBFileFill(packet, nameWithPath, total);
+    packetCRCFill(packet);
+
+    if (!SSEND(client->base.fd, bufsend, sendlen)) {
+        close(fd);
+        return false;
+    }
+
+    /* file contents */
+    bool ok = true;
+    for (int i = 0; i < partc && ok; i++) {
+        if (parts[i].datalen > 0) ok = SSEND(client->base.fd, parts[i].data, parts[i].datalen);
+        if (ok) ok = _stream_range(client, item->streamgen, fd, parts[i].offset, parts[i].len);
+    }
+    if (ok) ok = _stream_range(client, item->streamgen, fd, offset, fs.st_size - offset);
+
+    /*
+     * 中途放弃后已声明的长度不再成立，手机端无法找到下一个包的边界，
+     * 关闭连接（由主线程发现后释放），手机重连后重新请求
+     */
+    if (!ok && !client->base.dropped) {
+        mtc_mt_dbg("stream %s abandoned, reset connection", mfile->name);
+        shutdown(client->base.fd, SHUT_RDWR);
+    }
+
+    close(fd);
+
+    return ok;
+}
+
+/* 同步转码版本，尚未转码时排队，转码失败或未启用时同步原文件 */
+bool _push_transcode(StorageEntry *me, struct reqitem *item)
+{
+    NetBinaryNode *client = item->client;
+    if (client->base.fd <= 0 || !item->id || !item->name || !me->plan || !me->storepath) return false;
+
+    DommeFile *mfile = dommeGetFile(me->plan, item->id);
+    if (!mfile) {
+        mtc_mt_warn("%s not exist", item->id);
+        return false;
+    }
+
+    char filename[PATH_MAX] = {0}, cachename[PATH_MAX] = {0};
+    snprintf(filename, sizeof(filename), "%s%s%s%s", me->libroot, me->storepath, mfile->dir, mfile->name);
+
+    /* CUE 分轨共用整轨文件，下一首的开始即本曲的结束，最后一首到文件尾 */
+    int end = 0;
+    for (DommeFile *sibling = dommeStoreFindPath(me->plan, mfile->dir, mfile->name); sibling; sibling = sibling->twin) {
+        if (sibling->index > mfile->index && (end == 0 || sibling->index < end)) end = sibling->index;
+    }
+
+    int ret = transcodeGet(item->name, item->id, filename, mfile->index, end, mfile->length,
+                           client, cachename, sizeof(cachename));
+    if (ret > 0) {
+        snprintf(filename, sizeof(filename), "%s%s", me->libroot, cachename);
+        return _push_puppet(client, filename, cachename);
+    } else if (ret == 0) {
+        mtc_mt_dbg("%s %s transcoding", item->name, mfile->name);
+        return true;
+    }
+
+    char nameWithPath[PATH_MAX];
+    snprintf(nameWithPath, sizeof(nameWithPath), "%s%s%s", me->storepath, mfile->dir, mfile->name);
+    return _push_puppet(client, filename, nameWithPath);
+}
+
 void* _pusher(void *arg)
 {
     StorageEntry *me = (StorageEntry*)arg;
-    uint8_t idle_count = 0;
-    int rv = 0;
 
     int loglevel = mtc_level_str2int(mdf_get_value(g_config, "trace.worker", "debug"));
     mtc_mt_initf("pusher", loglevel, g_log_tostdout ? "-"  :"%slog/%s.log", g_location, "pusher");
@@ -387,40 +684,72 @@ void* _pusher(void *arg)
     mtc_mt_dbg("I am binary pusher");
 
     while (me->running) {
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 1;
-
         pthread_mutex_lock(&me->lock);
 
-        while (mlist_length(me->synclist) == 0 &&
-               (rv = pthread_cond_timedwait(&me->cond, &me->lock, &timeout)) == ETIMEDOUT) {
-            timeout.tv_sec += 1;
-
-            if (++idle_count >= 3) {
-                mtc_mt_noise("check my users in freetime");
-
-                idle_count = 0;
+        /* 只在有同步请求、有用户断开时醒来，有等待定位索引的请求时定时重试 */
+        while (me->running && mlist_length(me->synclist) == 0 && !me->sweep && !me->delivered) {
+            if (mlist_length(me->waitlist) == 0) {
+                pthread_cond_wait(&me->cond, &me->lock);
+                continue;
+            }
 
-                NetBinaryNode *client;
-                MLIST_ITERATE(me->clients, client) {
-                    if (client->base.dropped) {
-                        mlist_delete(me->clients, _moon_i);
-                        _moon_i--;
-                    }
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += STREAM_RETRY_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&me->cond, &me->lock, &ts) == ETIMEDOUT) {
+                struct reqitem *witem;
+                while ((witem = mlist_popx(me->waitlist)) != NULL) {
+                    witem->waiting = false;
+                    mlist_append(me->synclist, witem);
                 }
             }
-
-            if (!me->running) break;
         }
 
+        WAKEUP(WAKE_PUSHER);
+
         if (!me->running) {
             pthread_mutex_unlock(&me->lock);
             break;
         }
 
-        if (mlist_length(me->synclist) == 0 && rv != 0) {
-            mtc_mt_err("timedwait error %s", strerror(errno));
+        /* 转码完成，通知等待的手机（可能追加同步请求，不能持有 me->lock） */
+        if (me->delivered) {
+            me->delivered = false;
+            pthread_mutex_unlock(&me->lock);
+
+            transcodeDeliver();
+            continue;
+        }
+
+        /* 队列中可能还有断开用户的请求，清空后再清理 */
+        if (mlist_length(me->synclist) == 0) {
+            mtc_mt_noise("check my users in freetime");
+
+            me->sweep = false;
+
+            /* 等待定位索引的请求也引用着用户 */
+            struct reqitem *witem;
+            MLIST_ITERATE(me->waitlist, witem) {
+                if (witem->client->base.dropped) {
+                    reqitem_free(witem);
+                    mlist_delete(me->waitlist, _moon_i);
+                    _moon_i--;
+                }
+            }
+
+            NetBinaryNode *client;
+            MLIST_ITERATE(me->clients, client) {
+                if (client->base.dropped) {
+                    transcodeForget(client);
+                    mlist_delete(me->clients, _moon_i);
+                    _moon_i--;
+                }
+            }
+
             pthread_mutex_unlock(&me->lock);
             continue;
         }
@@ -430,8 +759,6 @@ void* _pusher(void *arg)
 
         if (!item) continue;
 
-        idle_count = 0;
-
         switch (item->type) {
         case SYNC_RAWFILE:
             _push_raw(me, item);
@@ -451,6 +778,13 @@ void* _pusher(void *arg)
         case SYNC_PONG:
             _push_pong(me, item);
             break;
+        case SYNC_STREAM:
+            _push_stream(me, item);
+            if (item->waiting) continue;
+            break;
+        case SYNC_TRANSCODE:
+            _push_transcode(me, item);
+            break;
         default:
             break;
         }
@@ -461,7 +795,7 @@ void* _pusher(void *arg)
     return NULL;
 }
 
-void _push(StorageEntry *me, char *name, char *id, char *artist, char *album,
+void _push(StorageEntry *me, char *name, char *id, char *artist, char *album, uint64_t sample,
            SYNC_TYPE stype, NetBinaryNode *client)
 {
     if (!me) return;
@@ -476,9 +810,14 @@ void _push(StorageEntry *me, char *name, char *id, char *artist, char *album,
     if (id)     item->id     = strdup(id);
     if (artist) item->artist = strdup(artist);
     if (album)  item->album  = strdup(album);
+    item->sample = sample;
     item->client = client;
     item->type = stype;
 
+    /* 新的流式请求（多为切歌）令该客户端之前的流式传输放弃 */
+    if (stype == SYNC_STREAM)
+        item->streamgen = __atomic_add_fetch(&client->streamgen, 1, __ATOMIC_RELAXED);
+
     pthread_mutex_lock(&me->lock);
     if (!client->in_business) {
         client->in_business = true;
@@ -495,7 +834,46 @@ void binaryPush(BeeEntry *be, SYNC_TYPE stype, NetBinaryNode *client)
 
     StorageEntry *me = (StorageEntry*)be;
 
-    _push(me, NULL, NULL, NULL, NULL, stype, client);
+    _push(me, NULL, NULL, NULL, NULL, 0, stype, client);
+}
+
+/*
+ * 转码结束，在 pusher 线程中同步给等待的手机，filename 为空（失败）时再次请求即得到原文件
+ * 手机释放前已由 transcodeForget() 移出等待列表，client 一定有效
+ */
+static void _transcode_ready(void *arg, const char *profile, const char *id, const char *filename,
+                             NetBinaryNode *client)
+{
+    StorageEntry *me = (StorageEntry*)arg;
+
+    if (client->base.dropped) return;
+
+    if (filename) _push(me, (char*)filename, NULL, NULL, NULL, 0, SYNC_RAWFILE, client);
+    else _push(me, (char*)profile, (char*)id, NULL, NULL, 0, SYNC_TRANSCODE, client);
+}
+
+/* 转码工作线程完成一个任务，唤醒 pusher */
+static void _transcode_wake(void *arg)
+{
+    StorageEntry *me = (StorageEntry*)arg;
+
+    pthread_mutex_lock(&me->lock);
+    me->delivered = true;
+    pthread_cond_signal(&me->cond);
+    pthread_mutex_unlock(&me->lock);
+}
+
+/* binary 用户断开 */
+void binaryDropped(BeeEntry *be)
+{
+    if (!be) return;
+
+    StorageEntry *me = (StorageEntry*)be;
+
+    pthread_mutex_lock(&me->lock);
+    me->sweep = true;
+    pthread_cond_signal(&me->cond);
+    pthread_mutex_unlock(&me->lock);
 }
 
 bool storage_process(BeeEntry *be, QueueEntry *qe)
@@ -546,7 +924,7 @@ bool storage_process(BeeEntry *be, QueueEntry *qe)
 
                 SSEND(qe->client->base.fd, qe->client->bufsend, sendlen);
 
-                _push(me, "music.db", NULL, NULL, NULL, SYNC_STORE_FILE, qe->client->binary);
+                _push(me, "music.db", NULL, NULL, NULL, 0, SYNC_STORE_FILE, qe->client->binary);
             } else {
                 /* 文件没更新 */
                 MessagePacket *packet = packetMessageInit(qe->client->bufsend, LEN_PACKET_NORMAL);
@@ -564,10 +942,12 @@ bool storage_process(BeeEntry *be, QueueEntry *qe)
         char *id     = mdf_get_value(qe->nodein, "id", NULL);
         char *artist = mdf_get_value(qe->nodein, "artist", NULL);
         char *album  = mdf_get_value(qe->nodein, "album", NULL);
+        uint64_t sample = mdf_get_int64_value(qe->nodein, "sample", 0);
 
         SYNC_TYPE type = mdf_get_int_value(qe->nodein, "type", SYNC_RAWFILE);
+        if (type == SYNC_TRANSCODE) name = mdf_get_value(qe->nodein, "profile", name);
 
-        _push(me, name, id, artist, album, type, qe->client->binary);
+        _push(me, name, id, artist, album, sample, type, qe->client->binary);
     }
     break;
     case CMD_REMOVE:
@@ -584,7 +964,7 @@ bool storage_process(BeeEntry *be, QueueEntry *qe)
                  * 因为独特(SB)的设计，删除文件时，能及时更新plan，新增时则不能
                  * 再次强调，CMD_DB_MD5为同步前必传，以更新plan
                  */
-                mhash_remove(me->plan->mfiles, id);
+                dommeStoreRemoveTrack(me->plan, mfile);
             }
         }
     }
@@ -612,7 +992,7 @@ bool storage_process(BeeEntry *be, QueueEntry *qe)
             MHASH_ITERATE(plan->mfiles, key, mfile) {
                 snprintf(filename, sizeof(filename), "%s%s%s", plan->basedir, mfile->dir, mfile->name);
 
-                _push(me, filename, NULL, NULL, NULL, SYNC_RAWFILE, qe->client->binary);
+                _push(me, filename, NULL, NULL, NULL, 0, SYNC_RAWFILE, qe->client->binary);
             }
 
             dommeStoreFree(plan);
@@ -623,6 +1003,7 @@ bool storage_process(BeeEntry *be, QueueEntry *qe)
         pthread_mutex_lock(&me->lock);
         mlist_clear(me->synclist);
         pthread_mutex_unlock(&me->lock);
+        if (qe->client->binary) __atomic_add_fetch(&qe->client->binary->streamgen, 1, __ATOMIC_RELAXED);
         break;
     default:
         break;
@@ -641,10 +1022,15 @@ void storage_stop(BeeEntry *be)
     pthread_cancel(me->worker);
     pthread_join(me->worker, NULL);
 
+    transcodeStop();
+
     pthread_mutex_destroy(&me->lock);
 
     if (me->plan) dommeStoreFree(me->plan);
     mlist_destroy(&me->synclist);
+    struct reqitem *item;
+    while ((item = mlist_popx(me->waitlist)) != NULL) reqitem_free(item);
+    mlist_destroy(&me->waitlist);
     mlist_destroy(&me->clients);
 }
 
@@ -665,7 +1051,10 @@ BeeEntry* _start_storage()
     me->storename = NULL;
     me->storepath = NULL;
     mlist_init(&me->synclist, reqitem_free);
+    mlist_init(&me->waitlist, NULL);
     mlist_init(&me->clients, _client_destroy);
+    me->sweep = false;
+    me->delivered = false;
 
     me->running = true;
     pthread_mutexattr_t attr;
@@ -676,6 +1065,8 @@ BeeEntry* _start_storage()
 
     pthread_create(&me->worker, NULL, _pusher, me);
 
+    transcodeInit(me->libroot, _transcode_ready, _transcode_wake, me);
+
     return (BeeEntry*)me;
 }
 
@@ -2,18 +2,20 @@
 #include "dr_flac.h"
 
 #define FLAC_DECODE_SAMPLE 1024
-#define FLAC_DECODE_BUFLEN 32768 /* 8 channels, 1024 samples, 4 bytes/sample */
 
 typedef struct {
     MediaNode base;
     drflac *pflac;
+    bool metaloaded;            /* 已解析标签及封面位置 */
+    uint64_t pictureoffset;     /* 内嵌封面图片数据在文件中的位置 */
+    uint32_t picturelen;
     uint8_t *imagebuf;
     size_t imagelen;
+    drflac_seekpoint *seekpoints;   /* 由定位索引转换而来，交给 dr_flac 使用 */
 } MediaNodeFlac;
 
 typedef struct {
     MediaEntry base;
-    drflac_int32 psamples[FLAC_DECODE_BUFLEN];
 } MediaEntryFlac;
 
 static uint8_t* _read_file(char *filename, size_t *imagelen)
@@ -91,58 +93,203 @@ static uint8_t* _scan_cover(char *pathname, size_t *imagelen)
     return _scan_me(pathname, imagelen);
 }
 
-static void _on_meta(void *data, drflac_metadata *meta)
+static bool _flac_pread(int fd, void *buf, size_t len, uint64_t offset)
 {
-    MediaNodeFlac *mnode = (MediaNodeFlac*)data;
-
-    if (meta->type == DRFLAC_METADATA_BLOCK_TYPE_STREAMINFO) {
-        mstr_bin2hexstr(meta->data.streaminfo.md5, 16, mnode->base.md5);
-        mstr_tolower(mnode->base.md5);
-    } else if (meta->type == DRFLAC_METADATA_BLOCK_TYPE_PICTURE &&
-               meta->data.picture.pictureDataSize > 0) {
-        mnode->imagebuf = mos_calloc(1, meta->data.picture.pictureDataSize);
-        mnode->imagelen = meta->data.picture.pictureDataSize;
-        memcpy(mnode->imagebuf, meta->data.picture.pPictureData, mnode->imagelen);
-    } else if (meta->type == DRFLAC_METADATA_BLOCK_TYPE_VORBIS_COMMENT) {
-        const char *comment = NULL;
-        drflac_uint32 comment_len = 0;
-        drflac_vorbis_comment_iterator piter;
-        drflac_init_vorbis_comment_iterator(&piter,
-                                            meta->data.vorbis_comment.commentCount,
-                                            meta->data.vorbis_comment.pComments);
-
-        while ((comment = drflac_next_vorbis_comment(&piter, &comment_len)) != NULL) {
-            if (comment_len > LEN_MEDIA_TOKEN) comment_len = LEN_MEDIA_TOKEN;
-
-            if (!strncasecmp(comment, "TITLE", 5)) {
-                comment += 6;
-                memcpy(mnode->base.ainfo.title, comment, comment_len - 6);
-            } else if (!strncasecmp(comment, "ARTIST", 6)) {
-                comment += 7;
-                memcpy(mnode->base.ainfo.artist, comment, comment_len - 7);
-            } else if (!strncasecmp(comment, "ALBUM", 5)) {
-                comment += 6;
-                memcpy(mnode->base.ainfo.album, comment, comment_len - 6);
-            } else if (!strncasecmp(comment, "TRACKNUMBER", 11)) {
-                comment += 12;
-                memcpy(mnode->base.ainfo.track, comment, comment_len - 12);
-            } else if (!strncasecmp(comment, "DATE", 4)) {
-                comment += 5;
-                memcpy(mnode->base.ainfo.year, comment, comment_len - 5);
+    size_t got = 0;
+    while (got < len) {
+        ssize_t rv = pread(fd, (uint8_t*)buf + got, len - got, offset + got);
+        if (rv <= 0) {
+            if (rv < 0 && errno == EINTR) continue;
+            return false;
+        }
+        got += rv;
+    }
+
+    return true;
+}
+
+static inline uint32_t _flac_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void _on_comment(MediaNodeFlac *mnode, const uint8_t *buf, uint32_t len)
+{
+    /* vendor_length vendor_string comment_count [length comment]... 均为小端 */
+    if (len < 8) return;
+
+    uint32_t pos = 4 + _flac_le32(buf);
+    if (pos > len - 4) return;
+    uint32_t count = _flac_le32(buf + pos);
+    pos += 4;
+
+    for (uint32_t i = 0; i < count && pos <= len - 4; i++) {
+        uint32_t comment_len = _flac_le32(buf + pos);
+        pos += 4;
+        if (comment_len > len - pos) break;
+
+        const char *comment = (const char*)buf + pos;
+        pos += comment_len;
+
+        if (comment_len > LEN_MEDIA_TOKEN) comment_len = LEN_MEDIA_TOKEN;
+
+        if (comment_len > 6 && !strncasecmp(comment, "TITLE=", 6)) {
+            memcpy(mnode->base.ainfo.title, comment + 6, comment_len - 6);
+        } else if (comment_len > 7 && !strncasecmp(comment, "ARTIST=", 7)) {
+            memcpy(mnode->base.ainfo.artist, comment + 7, comment_len - 7);
+        } else if (comment_len > 6 && !strncasecmp(comment, "ALBUM=", 6)) {
+            memcpy(mnode->base.ainfo.album, comment + 6, comment_len - 6);
+        } else if (comment_len > 12 && !strncasecmp(comment, "TRACKNUMBER=", 12)) {
+            memcpy(mnode->base.ainfo.track, comment + 12, comment_len - 12);
+        } else if (comment_len > 5 && !strncasecmp(comment, "DATE=", 5)) {
+            memcpy(mnode->base.ainfo.year, comment + 5, comment_len - 5);
+        }
+    }
+}
+
+/*
+ * 自行遍历 metadata 块：取 streaminfo 中的 MD5、解析 vorbis comment，
+ * PICTURE 块只记下图片数据的位置和长度，图片本身留到 cover_get() 时再读
+ */
+static void _flac_meta_load(MediaNodeFlac *mnode)
+{
+    if (mnode->metaloaded) return;
+    mnode->metaloaded = true;
+
+    int fd = open(mnode->base.filename, O_RDONLY);
+    if (fd < 0) {
+        mtc_mt_warn("open %s failure %s", mnode->base.filename, strerror(errno));
+        return;
+    }
+
+    uint64_t offset = mnode->pflac->firstFLACFramePosInBytes;
+    uint64_t pos = 4;
+    uint8_t header[4];
+    bool last = false, frontcover = false;
+
+    /* 跳过 fLaC 之前的 ID3 标签 */
+    uint8_t magic[10];
+    if (_flac_pread(fd, magic, 10, 0) && !memcmp(magic, "ID3", 3)) {
+        pos = 10 + (((magic[6] & 0x7F) << 21) | ((magic[7] & 0x7F) << 14) |
+                    ((magic[8] & 0x7F) << 7) | (magic[9] & 0x7F));
+        if (magic[5] & 0x10) pos += 10;
+        pos += 4;
+    }
+
+    while (!last && pos + 4 <= offset && _flac_pread(fd, header, 4, pos)) {
+        last = header[0] & 0x80;
+        uint8_t type = header[0] & 0x7F;
+        uint32_t blocklen = (header[1] << 16) | (header[2] << 8) | header[3];
+        pos += 4;
+
+        if (type == DRFLAC_METADATA_BLOCK_TYPE_STREAMINFO && blocklen >= 34) {
+            /* 编码器没有计算 MD5 时全为 0，留给 _flac_id_get() 处理 */
+            static const uint8_t zero[16] = {0};
+            uint8_t md5[16];
+            if (!mnode->base.md5[0] && _flac_pread(fd, md5, 16, pos + 18) && memcmp(md5, zero, 16)) {
+                mstr_bin2hexstr(md5, 16, mnode->base.md5);
+                mstr_tolower(mnode->base.md5);
+            }
+        } else if (type == DRFLAC_METADATA_BLOCK_TYPE_VORBIS_COMMENT) {
+            uint8_t *buf = mos_calloc(1, blocklen > 0 ? blocklen : 1);
+            if (_flac_pread(fd, buf, blocklen, pos)) _on_comment(mnode, buf, blocklen);
+            mos_free(buf);
+        } else if (type == DRFLAC_METADATA_BLOCK_TYPE_PICTURE && !frontcover) {
+            /* type mime_length mime desc_length desc width height depth colors data_length data，均为大端 */
+            uint8_t buf[8];
+            uint64_t ppos = pos;
+            if (!_flac_pread(fd, buf, 8, ppos)) break;
+            uint32_t ptype = _be32(buf);
+            ppos += 8 + _be32(buf + 4);
+            if (!_flac_pread(fd, buf, 4, ppos)) break;
+            ppos += 4 + _be32(buf) + 16;
+            if (!_flac_pread(fd, buf, 4, ppos)) break;
+            uint32_t datalen = _be32(buf);
+            ppos += 4;
+
+            /* 优先使用封面（type 3），否则取第一张 */
+            if (datalen > 0 && ppos + datalen <= pos + blocklen &&
+                (mnode->picturelen == 0 || ptype == 3)) {
+                mnode->pictureoffset = ppos;
+                mnode->picturelen = datalen;
+                frontcover = ptype == 3;
             }
         }
+
+        pos += blocklen;
     }
+
+    close(fd);
 }
 
-static bool _flac_verify(const char *filename)
+static uint8_t _flac_crc8(const uint8_t *buf, size_t len)
 {
-    if (!filename) return false;
+    uint8_t crc = 0;
 
-    drflac *pflac = drflac_open_file(filename, NULL);
-    if (pflac) {
-        drflac_close(pflac);
-        return true;
-    } else return false;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int j = 0; j < 8; j++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
+}
+
+/*
+ * 解析 buf 处的 FLAC 帧头，成功返回帧头长度（含 CRC-8），失败返回 0
+ * number: 固定块大小时为帧序号，可变块大小时为起始 PCM 帧序号
+ */
+static size_t _flac_frame_header(const uint8_t *buf, size_t len,
+                                 uint64_t *number, uint32_t *blocksize, bool *variable)
+{
+    if (len < 6 || buf[0] != 0xFF || (buf[1] & 0xFE) != 0xF8) return 0;
+
+    uint8_t bscode = buf[2] >> 4, srcode = buf[2] & 0x0F;
+    uint8_t chcode = buf[3] >> 4, sscode = (buf[3] >> 1) & 0x07;
+    if (bscode == 0 || srcode == 15 || chcode > 10 || sscode == 3 || (buf[3] & 0x01)) return 0;
+
+    /* UTF-8 风格编码的帧（样本）序号 */
+    size_t pos = 4, extra;
+    uint8_t x = buf[pos++];
+    uint64_t value;
+    if (x < 0x80) { value = x; extra = 0; }
+    else if ((x & 0xE0) == 0xC0) { value = x & 0x1F; extra = 1; }
+    else if ((x & 0xF0) == 0xE0) { value = x & 0x0F; extra = 2; }
+    else if ((x & 0xF8) == 0xF0) { value = x & 0x07; extra = 3; }
+    else if ((x & 0xFC) == 0xF8) { value = x & 0x03; extra = 4; }
+    else if ((x & 0xFE) == 0xFC) { value = x & 0x01; extra = 5; }
+    else if (x == 0xFE) { value = 0; extra = 6; }
+    else return 0;
+
+    /* 帧头全长：序号 + 可选的块大小、采样率 + CRC-8 */
+    size_t hlen = pos + extra + (bscode == 6 ? 1 : bscode == 7 ? 2 : 0) +
+        (srcode == 12 ? 1 : (srcode == 13 || srcode == 14) ? 2 : 0) + 1;
+    if (hlen > len) return 0;
+
+    for (size_t i = 0; i < extra; i++) {
+        x = buf[pos++];
+        if ((x & 0xC0) != 0x80) return 0;
+        value = (value << 6) | (x & 0x3F);
+    }
+
+    uint32_t bs;
+    if (bscode == 1) bs = 192;
+    else if (bscode <= 5) bs = 576 << (bscode - 2);
+    else if (bscode == 6) bs = buf[pos++] + 1;
+    else if (bscode == 7) {
+        bs = ((buf[pos] << 8) | buf[pos+1]) + 1;
+        pos += 2;
+    } else bs = 256 << (bscode - 8);
+
+    if (srcode == 12) pos += 1;
+    else if (srcode == 13 || srcode == 14) pos += 2;
+
+    if (_flac_crc8(buf, pos) != buf[pos]) return 0;
+
+    *number = value;
+    *blocksize = bs;
+    *variable = buf[1] & 0x01;
+
+    return pos + 1;
 }
 
 static MediaNode* _flac_open(const char *filename)
@@ -155,7 +302,8 @@ static MediaNode* _flac_open(const char *filename)
     mnode->imagebuf = NULL;
     mnode->imagelen = 0;
 
-    drflac *pflac = drflac_open_file_with_metadata(filename, _on_meta, mnode, NULL);
+    /* 播放只需要 streaminfo，标签和封面在 art_info_get()、cover_get() 时再解析 */
+    drflac *pflac = drflac_open_file(filename, NULL);
     if (pflac) {
         mnode->pflac = pflac;
 
@@ -167,11 +315,6 @@ static MediaNode* _flac_open(const char *filename)
         mnode->base.tinfo.length = (int)(pflac->totalPCMFrameCount / mnode->base.tinfo.hz) + 1;
         mnode->base.ainfo.length = mnode->base.tinfo.length;
 
-        if (!memcmp(mnode->base.md5, "0000000000", 10)) {
-            /* 通过 meta信息中 streaminfo 获取id失败，自己生成 */
-            mhash_file_md5_s(filename, mnode->base.md5);
-        }
-
         return (MediaNode*)mnode;
     } else {
         mos_free(mnode);
@@ -179,6 +322,22 @@ static MediaNode* _flac_open(const char *filename)
     }
 }
 
+/* 优先使用 streaminfo 中的 MD5（与标签无关，两个版本通用），没有时再计算 */
+static bool _flac_id_get(MediaNode *mnode)
+{
+    MediaNodeFlac *flacnode = (MediaNodeFlac*)mnode;
+
+    mnode->idver = mediaIdVersion();
+    _flac_meta_load(flacnode);
+    if (mnode->md5[0]) return true;
+
+    if (mnode->idver == MEDIA_ID_MD5) return mhash_file_md5_s(mnode->filename, mnode->md5) >= 0;
+
+    uint64_t start = 0;
+    if (mdf_get_bool_value(g_config, "audio.id_skip_tags", true)) start = flacnode->pflac->firstFLACFramePosInBytes;
+    return mediaFingerprint(mnode->filename, start, 0, mnode->md5);
+}
+
 static TechInfo* _flac_get_tinfo(MediaNode *mnode)
 {
     if (!mnode) return NULL;
@@ -190,6 +349,8 @@ static ArtInfo* _flac_get_ainfo(MediaNode *mnode)
 {
     if (!mnode) return NULL;
 
+    _flac_meta_load((MediaNodeFlac*)mnode);
+
     if (mnode->ainfo.title[0] == 0 ||
         mnode->ainfo.artist[0] == 0 ||
         mnode->ainfo.album[0] == 0) return NULL;
@@ -202,6 +363,23 @@ static uint8_t* _flac_get_cover(MediaNode *mnode, size_t *imagelen)
 
     if (!flacnode) return NULL;
 
+    _flac_meta_load(flacnode);
+
+    if (!flacnode->imagebuf && flacnode->picturelen > 0) {
+        int fd = open(mnode->filename, O_RDONLY);
+        if (fd >= 0) {
+            flacnode->imagebuf = mos_calloc(1, flacnode->picturelen);
+            if (_flac_pread(fd, flacnode->imagebuf, flacnode->picturelen, flacnode->pictureoffset)) {
+                flacnode->imagelen = flacnode->picturelen;
+            } else {
+                mtc_mt_warn("read %s cover failure %s", mnode->filename, strerror(errno));
+                mos_free(flacnode->imagebuf);
+                flacnode->imagebuf = NULL;
+            }
+            close(fd);
+        }
+    }
+
     if (!flacnode->imagebuf) {
         /* flac 文件 meta 信息里没有封面，尝试在当前目录及 Cover、Covers、Artwork 目录下读取 */
         char *dumpname = strdup(mnode->filename);
@@ -225,66 +403,71 @@ static uint8_t* _flac_get_cover(MediaNode *mnode, size_t *imagelen)
 
 static bool _flac_play(MediaNode *mnode, AudioEntry *audio)
 {
-    static int channels = 0, hz = 0;
-    int rv;
-
     MediaNodeFlac *flacnode = (MediaNodeFlac*)mnode;
     if (!flacnode || !flacnode->pflac) return false;
 
-    MediaEntryFlac *flacentry = (MediaEntryFlac*)flacnode->base.driver;
-
     if (!audio) return false;
     struct audioTrack *track = audio->track;
 
-    if (track->percent != 0) {
-        drflac_uint64 index = track->tinfo.samples * track->percent;
-        drflac_seek_to_pcm_frame(flacnode->pflac, index);
-    }
-
-    if (track->media_switch || track->tinfo.channels != channels || track->tinfo.hz != hz) {
-        /* 设置播放参数 */
-        mtc_mt_dbg("set pcm params %d %dHZ", track->tinfo.channels, track->tinfo.hz);
-
-        switch (snd_pcm_state(audio->pcm)) {
-        case SND_PCM_STATE_RUNNING:
-            snd_pcm_drop(audio->pcm);
-            break;
-        case SND_PCM_STATE_XRUN:
-            snd_pcm_prepare(audio->pcm);
-            break;
-        default:
-            break;
-        }
-        rv = snd_pcm_set_params(audio->pcm,
-                                SND_PCM_FORMAT_S32_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                track->tinfo.channels, track->tinfo.hz, 1, 100000);
-        if (rv < 0) {
-            mtc_mt_err("can't set parameter. %s", snd_strerror(rv));
-            return false;
+    if (track->samples_eat > 0) {
+        /*
+         * 文件自带 SEEKTABLE 时 dr_flac 直接使用。否则使用已生成的索引，
+         * 还没有时（已排队由后台生成）由 dr_flac 自己按帧头二分查找
+         */
+        SeekIndex *sindex = flacnode->pflac->seekpointCount == 0 ? mediaSeekIndex(mnode, false) : NULL;
+        if (sindex && !flacnode->seekpoints) {
+            drflac *pflac = flacnode->pflac;
+            flacnode->seekpoints = mos_calloc(sindex->count, sizeof(drflac_seekpoint));
+            for (uint32_t i = 0; i < sindex->count; i++) {
+                flacnode->seekpoints[i].firstPCMFrame = sindex->points[i].sample;
+                flacnode->seekpoints[i].flacFrameOffset =
+                    sindex->points[i].offset - pflac->firstFLACFramePosInBytes;
+                flacnode->seekpoints[i].pcmFrameCount = 0;
+            }
+            /* 替换文件自带的 SEEKTABLE（其内存属于 pflac，无需释放） */
+            pflac->pSeekpoints = flacnode->seekpoints;
+            pflac->seekpointCount = sindex->count;
         }
-        channels = track->tinfo.channels;
-        hz = track->tinfo.hz;
+
+        drflac_seek_to_pcm_frame(flacnode->pflac, track->samples_eat);
     }
 
+    if (!outputSetup(audio, track->tinfo.channels, track->tinfo.hz, flacnode->pflac->bitsPerSample))
+        return false;
+
     track->playing = true;
+    bool direct = audio->out.direct;
 
-    int samples = 0;
-    while ((samples = drflac_read_pcm_frames_s32(flacnode->pflac, FLAC_DECODE_SAMPLE,
-                                                 flacentry->psamples)) > 0) {
+    drflac_uint64 samples = 0;
+    while (true) {
         if (audio->act != ACT_NONE) {
             mtc_mt_dbg("%s while playing", _action_string(audio->act));
             track->playing = false;
             return false;
         }
 
-        rv = snd_pcm_writei(audio->pcm, flacentry->psamples, samples);
-        if (rv == -EPIPE) {
-            mtc_mt_warn("XRUN");
-            snd_pcm_prepare(audio->pcm);
+        /* 尽量直接解码至声卡缓冲区 */
+        snd_pcm_uframes_t frames = FLAC_DECODE_SAMPLE;
+        void *buf = direct ? outputBegin(audio, &frames) : outputBuffer(audio, &frames);
+        if (!buf) {
+            track->playing = false;
+            return false;
         }
 
-        track->samples_eat += rv;
-        track->percent = (float)track->samples_eat / track->tinfo.samples;
+        if (audio->out.sformat == SND_PCM_FORMAT_S16_LE)
+            samples = drflac_read_pcm_frames_s16(flacnode->pflac, frames, buf);
+        else samples = drflac_read_pcm_frames_s32(flacnode->pflac, frames, buf);
+
+        snd_pcm_sframes_t rv = direct ? outputCommit(audio, samples) :
+            outputWrite(audio, buf, audio->out.sformat, track->tinfo.channels, samples);
+        if (samples == 0) break;
+
+        if (rv > 0) {
+            track->samples_eat += rv;
+            track->percent = (float)track->samples_eat / track->tinfo.samples;
+            nowPlayingPosition(audio, track->samples_eat);
+            ioPlayProgress(audio);
+        }
     }
 
     /* 播放正常完成 */
@@ -294,14 +477,112 @@ static bool _flac_play(MediaNode *mnode, AudioEntry *audio)
     return true;
 }
 
+/* 文件自带的 SEEKTABLE 转换为定位索引（流式传输用），跳过占位点 */
+static SeekIndex* _flac_seek_native(MediaNode *mnode)
+{
+    MediaNodeFlac *flacnode = (MediaNodeFlac*)mnode;
+    if (!flacnode || !flacnode->pflac || flacnode->seekpoints) return NULL;
+
+    drflac *pflac = flacnode->pflac;
+    if (pflac->seekpointCount == 0 || !pflac->pSeekpoints) return NULL;
+
+    SeekIndex *sindex = seekIndexCreate(pflac->sampleRate, pflac->firstFLACFramePosInBytes);
+    if (!sindex) return NULL;
+
+    sindex->interval = 0;
+    for (uint32_t i = 0; i < pflac->seekpointCount; i++) {
+        drflac_seekpoint *point = &pflac->pSeekpoints[i];
+        if (point->firstPCMFrame == (drflac_uint64)-1) continue;
+        if (sindex->count > 0 && point->firstPCMFrame <= sindex->points[sindex->count - 1].sample) continue;
+
+        seekIndexAppend(sindex, point->firstPCMFrame, pflac->firstFLACFramePosInBytes + point->flacFrameOffset);
+    }
+    sindex->dumped = true;
+
+    if (sindex->count == 0) {
+        seekIndexFree(sindex);
+        return NULL;
+    }
+
+    return sindex;
+}
+
+/*
+ * 逐帧扫描帧头生成定位索引
+ * FLAC 帧头里没有帧长度，只能找同步码，再用 CRC-8 及连续的样本序号排除误判
+ */
+static SeekIndex* _flac_seek_build(MediaNode *mnode)
+{
+    MediaNodeFlac *flacnode = (MediaNodeFlac*)mnode;
+    if (!flacnode || !flacnode->pflac) return NULL;
+
+    drflac *pflac = flacnode->pflac;
+
+    /* 有 SEEKTABLE 的文件不必扫描 */
+    if (pflac->seekpointCount > 0) return NULL;
+
+    int fd = open(mnode->filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat fs;
+    if (fstat(fd, &fs) != 0 || fs.st_size <= pflac->firstFLACFramePosInBytes) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = fs.st_size;
+    uint8_t *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) return NULL;
+
+    madvise(buf, size, MADV_SEQUENTIAL);
+
+    SeekIndex *sindex = seekIndexCreate(pflac->sampleRate, pflac->firstFLACFramePosInBytes);
+
+    uint64_t expect = 0, number, sample;
+    uint32_t blocksize, fixedsize = 0;
+    bool variable;
+    size_t pos = pflac->firstFLACFramePosInBytes, hlen;
+    while (pos < size) {
+        uint8_t *p = memchr(buf + pos, 0xFF, size - pos);
+        if (!p) break;
+
+        pos = p - buf;
+        hlen = _flac_frame_header(p, size - pos, &number, &blocksize, &variable);
+        if (hlen > 0) {
+            if (!variable && fixedsize == 0) fixedsize = blocksize;
+            sample = variable ? number : number * fixedsize;
+            if (sample == expect) {
+                seekIndexAppend(sindex, sample, pos);
+                expect = sample + blocksize;
+                pos += hlen;
+                continue;
+            }
+        }
+
+        pos++;
+    }
+
+    munmap(buf, size);
+
+    if (sindex->count == 0) {
+        seekIndexFree(sindex);
+        return NULL;
+    }
+
+    return sindex;
+}
+
 static void _flac_close(MediaNode *mnode)
 {
     if (!mnode) return;
 
     MediaNodeFlac *flacnode = (MediaNodeFlac*)mnode;
 
+    seekIndexFree(mnode->sindex);
     mos_free(flacnode->imagebuf);
     drflac_close(flacnode->pflac);
+    mos_free(flacnode->seekpoints);
     mos_free(flacnode);
 }
 
@@ -309,14 +590,14 @@ MediaEntryFlac media_flac = {
     .base = {
         .type = MEDIA_FLAC,
         .name = "FLAC",
-        .check = _flac_verify,
         .open          = _flac_open,
+        .id_get        = _flac_id_get,
         .tech_info_get = _flac_get_tinfo,
         .art_info_get  = _flac_get_ainfo,
         .cover_get     = _flac_get_cover,
         .play          = _flac_play,
-        .close         = _flac_close
-    },
-
-    .psamples = {0}
+        .close         = _flac_close,
+        .seek_index_build = _flac_seek_build,
+        .seek_index_native = _flac_seek_native
+    }
 };
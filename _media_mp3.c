@@ -11,6 +11,9 @@ typedef struct {
     mp3dec_map_info_t file;     /* buffer, size */
     uint8_t *imagebuf;
     size_t imagelen;
+    uint32_t delay;             /* LAME 头中的编码器延迟、填充（采样数） */
+    uint32_t padding;
+    size_t tagend;              /* Xing/Info/VBRI 标签帧之后第一个音频帧的偏移，没有标签时为 0 */
 } MediaNodeMp3;
 
 typedef struct {
@@ -22,6 +25,14 @@ struct bird_egg {
     AudioEntry *audio;
     MediaNodeMp3 *mnode;
     MediaEntryMp3 *mentry;
+    uint64_t skip;              /* 定位到索引点后，还需丢弃的 PCM 帧数 */
+};
+
+struct mp3_scan {
+    TechInfo *tinfo;
+    SeekIndex *sindex;
+    bool withindex;
+    size_t base;                /* 从 base 处开始遍历，回调中的 offset 需加上它 */
 };
 
 static int _iterate_info(void *user_data, const uint8_t *frame, int frame_size,
@@ -30,7 +41,14 @@ static int _iterate_info(void *user_data, const uint8_t *frame, int frame_size,
 {
     if (!frame) return 1;
 
-    TechInfo *outinfo = (TechInfo*)user_data;
+    struct mp3_scan *scan = (struct mp3_scan*)user_data;
+    TechInfo *outinfo = scan->tinfo;
+
+    if (scan->withindex) {
+        if (!scan->sindex) scan->sindex = seekIndexCreate(info->hz, scan->base + offset);
+        seekIndexAppend(scan->sindex, outinfo->samples, scan->base + offset);
+    }
+
     //d->samples += mp3dec_decode_frame(d->mp3d, frame, frame_size, NULL, info);
     outinfo->samples += hdr_frame_samples(frame);
     outinfo->channels = info->channels;
@@ -45,8 +63,7 @@ static int _iterate_callback(void *user_data, const uint8_t *frame, int frame_si
                              int free_format_bytes, size_t buf_size, uint64_t offset,
                              mp3dec_frame_info_t *info)
 {
-    static int channels = 0, hz = 0;
-    int rv;
+    snd_pcm_sframes_t rv;
 
     struct bird_egg *egg = (struct bird_egg*)user_data;
     AudioEntry *me = egg->audio;
@@ -61,31 +78,10 @@ static int _iterate_callback(void *user_data, const uint8_t *frame, int frame_si
     }
 
     if (!track->playing) {
-        if (track->media_switch || info->channels != channels || info->hz != hz) {
-            /* 设置播放参数 */
-            mtc_mt_dbg("set pcm params %d %dHZ", info->channels, info->hz);
-
-            switch (snd_pcm_state(me->pcm)) {
-            case SND_PCM_STATE_RUNNING:
-                snd_pcm_drop(me->pcm);
-                break;
-            case SND_PCM_STATE_XRUN:
-                snd_pcm_prepare(me->pcm);
-                break;
-            default:
-                break;
-            }
-            rv = snd_pcm_set_params(me->pcm,
-                                    SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                    info->channels, info->hz, 1, 100000);
-            if (rv < 0) {
-                mtc_mt_err("can't set parameter. %s", snd_strerror(rv));
-                track->percent = 0;
-                track->playing = false;
-                return 1;
-            }
-            channels = info->channels;
-            hz = info->hz;
+        if (!outputSetup(me, info->channels, info->hz, 16)) {
+            track->percent = 0;
+            track->playing = false;
+            return 1;
         }
 
         track->playing = true;
@@ -99,37 +95,42 @@ static int _iterate_callback(void *user_data, const uint8_t *frame, int frame_si
         return 1;
     }
 
-    memset(mp3entry->psamples, 0x0, sizeof(mp3entry->psamples));
     int samples = mp3dec_decode_frame(&mp3node->mp3d, frame, frame_size, mp3entry->psamples, info);
     if (samples > 0) {
-        rv = snd_pcm_writei(me->pcm, mp3entry->psamples, samples);
-        if (rv == -EPIPE) {
-            mtc_mt_warn("XRUN");
-            snd_pcm_prepare(me->pcm);
+        mp3d_sample_t *pcm = mp3entry->psamples;
+        if (egg->skip > 0) {
+            int drop = egg->skip > (uint64_t)samples ? samples : (int)egg->skip;
+            egg->skip -= drop;
+            samples -= drop;
+            pcm += drop * info->channels;
+            if (samples == 0) return 0;
         }
 
-        track->samples_eat += rv;
-        track->percent = (float)track->samples_eat / track->tinfo.samples;
-    } else mtc_mt_warn("decode frame failure");
-
-    return 0;
-}
+        /* 末尾的编码器填充不输出 */
+        if (mp3node->padding > 0 && track->samples_eat + samples > track->tinfo.samples) {
+            samples = track->samples_eat < track->tinfo.samples ? track->tinfo.samples - track->samples_eat : 0;
+            if (samples == 0) return 0;
+        }
 
-static bool _mp3_verify(const char *filename)
-{
-    mp3dec_map_info_t map_info;
-    if (!filename) return false;
+        if (info->channels > me->out.channels && !outputSetup(me, info->channels, info->hz, 16)) {
+            track->playing = false;
+            return 1;
+        }
 
-    if (mp3dec_open_file(filename, &map_info) == 0) {
-        if (mp3dec_detect_buf(map_info.buffer, map_info.size) == 0) {
-            mp3dec_close_file(&map_info);
-            return true;
+        rv = outputWrite(me, pcm, SND_PCM_FORMAT_S16_LE, info->channels, samples);
+        if (rv < 0) {
+            mtc_mt_err("write pcm failure %s", snd_strerror(rv));
+            track->playing = false;
+            return 1;
         }
 
-        mp3dec_close_file(&map_info);
-    }
+        track->samples_eat += rv;
+        track->percent = (float)track->samples_eat / track->tinfo.samples;
+        nowPlayingPosition(me, track->samples_eat);
+        ioPlayProgress(me);
+    } else mtc_mt_warn("decode frame failure");
 
-    return false;
+    return 0;
 }
 
 static MediaNode* _mp3_open(const char *filename)
@@ -147,7 +148,6 @@ static MediaNode* _mp3_open(const char *filename)
 
     if (mp3dec_open_file(filename, &mnode->file) == 0) {
         if (mp3dec_detect_buf(mnode->file.buffer, mnode->file.size) == 0) {
-            mp3_md5_buf(mnode->file.buffer, mnode->file.size, mnode->base.md5);
             return (MediaNode*)mnode;
         }
 
@@ -157,19 +157,163 @@ static MediaNode* _mp3_open(const char *filename)
     return NULL;
 }
 
-static TechInfo* _mp3_get_tinfo(MediaNode *mnode)
+static bool _mp3_id_get(MediaNode *mnode)
 {
-    if (!mnode) return NULL;
-
     MediaNodeMp3 *mp3node = (MediaNodeMp3*)mnode;
 
+    mnode->idver = mediaIdVersion();
+    if (mnode->idver == MEDIA_ID_MD5) return mp3_md5_buf(mp3node->file.buffer, mp3node->file.size, mnode->md5);
+
+    const uint8_t *buf = mp3node->file.buffer;
+    size_t size = mp3node->file.size;
+    if (mdf_get_bool_value(g_config, "audio.id_skip_tags", true)) mp3dec_skip_id3(&buf, &size);
+
+    uint64_t start = buf - mp3node->file.buffer;
+    return mediaFingerprint(mnode->filename, start, start + size, mnode->md5);
+}
+
+/*
+ * 不遍历整个文件获取 tinfo：
+ * 1. 第一帧中的 Xing/Info（含 LAME 扩展中的编码器延迟、填充）或 VBRI 头给出总帧数
+ * 2. 没有时，若开头若干帧及接近末尾的一帧码率一致，按 CBR 用数据长度估算
+ * 都不行（无头 VBR）返回 false，由调用者遍历
+ */
+static bool _mp3_header_info(MediaNodeMp3 *mp3node)
+{
+    MediaNode *mnode = (MediaNode*)mp3node;
+    TechInfo *tinfo = &mnode->tinfo;
+    mp3dec_frame_info_t info;
+    mp3dec_t dec;
+
+    const uint8_t *buf = mp3node->file.buffer;
+    size_t size = mp3node->file.size;
+    mp3dec_skip_id3(&buf, &size);
+    if (size < 4) return false;
+
+    mp3dec_init(&dec);
+    int spf = mp3dec_decode_frame(&dec, buf, size > 16384 ? 16384 : size, NULL, &info);
+    if (spf <= 0 || info.hz <= 0 || info.frame_bytes <= 0) return false;
+
+    const uint8_t *frame = buf + info.frame_offset;
+    size_t datalen = size - info.frame_offset;
+    if ((size_t)info.frame_bytes > datalen) return false;
+
+    /* 侧信息之后是 Xing/Info 标签 */
+    int sideinfo = HDR_TEST_MPEG1(frame) ? (HDR_IS_MONO(frame) ? 17 : 32) : (HDR_IS_MONO(frame) ? 9 : 17);
+    const uint8_t *tag = frame + 4 + sideinfo;
+    const uint8_t *vbri = frame + 4 + 32;
+    uint64_t frames = 0, bytes = 0;
+
+    /*
+     * 标签帧本身会被 minimp3 解码为一帧静音，其帧数不计入标签中的总帧数，
+     * 播放、遍历都从它之后开始（即便标签不可信，它也不是音频）
+     */
+    bool tagged = (info.frame_bytes >= 4 + sideinfo + 8 && (!memcmp(tag, "Xing", 4) || !memcmp(tag, "Info", 4))) ||
+        (info.frame_bytes >= 4 + 32 + 18 && !memcmp(vbri, "VBRI", 4));
+    mp3node->tagend = tagged ? (size_t)(frame - mp3node->file.buffer) + info.frame_bytes : 0;
+
+    if (info.frame_bytes >= 4 + sideinfo + 8 &&
+        (!memcmp(tag, "Xing", 4) || !memcmp(tag, "Info", 4))) {
+        uint32_t flags = _be32(tag + 4);
+        const uint8_t *p = tag + 8, *end = frame + info.frame_bytes;
+
+        if ((flags & 0x1) && p + 4 <= end) { frames = _be32(p); p += 4; }
+        if ((flags & 0x2) && p + 4 <= end) { bytes = _be32(p); p += 4; }
+        if (flags & 0x4) p += 100;
+        if (flags & 0x8) p += 4;
+
+        /* LAME 扩展：9 字节编码器名，第 21 字节起 12 位延迟 + 12 位填充 */
+        if (p + 24 <= end && (!memcmp(p, "LAME", 4) || !memcmp(p, "Lavc", 4) || !memcmp(p, "Lavf", 4))) {
+            mp3node->delay = (p[21] << 4) | (p[22] >> 4);
+            mp3node->padding = ((p[22] & 0x0F) << 8) | p[23];
+        }
+    } else if (info.frame_bytes >= 4 + 32 + 18 && !memcmp(vbri, "VBRI", 4)) {
+        mp3node->delay = (vbri[6] << 8) | vbri[7];
+        bytes = _be32(vbri + 10);
+        frames = _be32(vbri + 14);
+    }
+
+    if (frames > 0) {
+        /* 文件被截断或拼接过，标签不可信，延迟、填充也不用（遍历所得的总数未扣除） */
+        if (bytes > 0 && (bytes > datalen + datalen / 50 || bytes < datalen - datalen / 50)) {
+            mtc_mt_dbg("%s vbr tag says %ju bytes, got %zu", mnode->filename, (uintmax_t)bytes, datalen);
+            mp3node->delay = mp3node->padding = 0;
+            return false;
+        }
+
+        uint64_t samples = frames * spf;
+        if (samples > mp3node->delay + mp3node->padding) samples -= mp3node->delay + mp3node->padding;
+
+        tinfo->samples = samples;
+        tinfo->kbps = (int)(datalen * 8 * info.hz / ((uint64_t)frames * spf) / 1000);
+    } else {
+        /* CBR：连续 8 帧、末尾附近一帧码率一致。按数据长度估算的总数未扣除延迟、填充 */
+        mp3node->delay = mp3node->padding = 0;
+        const uint8_t *p = frame;
+        size_t left = datalen;
+        for (int i = 0; i < 8 && left > 4; i++) {
+            mp3dec_frame_info_t finfo;
+            if (mp3dec_decode_frame(&dec, p, left > 16384 ? 16384 : left, NULL, &finfo) <= 0 ||
+                finfo.bitrate_kbps != info.bitrate_kbps || finfo.frame_bytes <= 0) return false;
+            p += finfo.frame_offset + finfo.frame_bytes;
+            left = datalen - (p - frame);
+        }
+
+        if (datalen > 65536) {
+            mp3dec_frame_info_t finfo;
+            p = frame + datalen - 32768;
+            if (mp3dec_decode_frame(&dec, p, 16384, NULL, &finfo) <= 0 ||
+                finfo.bitrate_kbps != info.bitrate_kbps) return false;
+        }
+
+        if (info.bitrate_kbps <= 0) return false;
+
+        tinfo->samples = (uint64_t)datalen * 8 * info.hz / ((uint64_t)info.bitrate_kbps * 1000);
+        tinfo->kbps = info.bitrate_kbps;
+    }
+
+    tinfo->channels = info.channels;
+    tinfo->hz = info.hz;
+    tinfo->length = (int)(tinfo->samples / tinfo->hz) + 1;
+    mnode->ainfo.length = tinfo->length;
+
+    return tinfo->samples > 0;
+}
+
+/* 遍历所有帧获取 tinfo，顺便生成定位索引 */
+static SeekIndex* _mp3_scan(MediaNodeMp3 *mp3node)
+{
+    MediaNode *mnode = (MediaNode*)mp3node;
+    TechInfo tinfo = {0};
+    struct mp3_scan scan = {.tinfo = &tinfo, .sindex = NULL, .withindex = !mnode->sindex, .base = mp3node->tagend};
+
+    mp3dec_iterate_buf(mp3node->file.buffer + scan.base, mp3node->file.size - scan.base, _iterate_info, &scan);
+
+    /* 已从帧头标签获得的 tinfo（扣除了编码器延迟、填充）更准确，只在没有时采用遍历结果 */
     if (mnode->tinfo.samples == 0) {
-        mp3dec_iterate_buf(mp3node->file.buffer, mp3node->file.size, _iterate_info, &mnode->tinfo);
-        if (mnode->tinfo.hz <= 0) mnode->tinfo.hz = 44110;
-        mnode->tinfo.length = (int)(mnode->tinfo.samples / mnode->tinfo.hz) + 1;
+        if (tinfo.hz <= 0) tinfo.hz = 44110;
+        tinfo.length = (int)(tinfo.samples / tinfo.hz) + 1;
+        mnode->tinfo = tinfo;
         mnode->ainfo.length = mnode->tinfo.length;
     }
 
+    /* 索引点为解码输出的位置，与扣除了延迟的曲目时间轴差 delay */
+    if (scan.sindex) {
+        scan.sindex->delay = mp3node->delay;
+        mnode->sindex = scan.sindex;
+    }
+
+    return mnode->sindex;
+}
+
+static TechInfo* _mp3_get_tinfo(MediaNode *mnode)
+{
+    if (!mnode) return NULL;
+
+    MediaNodeMp3 *mp3node = (MediaNodeMp3*)mnode;
+
+    if (mnode->tinfo.samples == 0 && !_mp3_header_info(mp3node)) _mp3_scan(mp3node);
+
     return &mnode->tinfo;
 }
 
@@ -179,12 +323,7 @@ static ArtInfo* _mp3_get_ainfo(MediaNode *mnode)
 
     MediaNodeMp3 *mp3node = (MediaNodeMp3*)mnode;
 
-    if (mnode->tinfo.samples == 0) {
-        mp3dec_iterate_buf(mp3node->file.buffer, mp3node->file.size, _iterate_info, &mnode->tinfo);
-        if (mnode->tinfo.hz <= 0) mnode->tinfo.hz = 44110;
-        mnode->tinfo.length = (int)(mnode->tinfo.samples / mnode->tinfo.hz) + 1;
-        mnode->ainfo.length = mnode->tinfo.length;
-    }
+    if (mnode->tinfo.samples == 0 && !_mp3_header_info(mp3node)) _mp3_scan(mp3node);
 
     if (!mnode->ainfo.title[0]) {
         if (mp3_id3_get_buf(mp3node->file.buffer, mp3node->file.size,
@@ -236,9 +375,29 @@ static bool _mp3_play(MediaNode *mnode, AudioEntry *audio)
     if (!audio) return false;
     struct audioTrack *track = audio->track;
 
-    size_t offset = track->percent == 0.0 ? 0 : mp3node->file.size * track->percent;
-
-    struct bird_egg egg = {.audio = audio, .mnode = mp3node, .mentry = mp3entry};
+    struct bird_egg egg = {.audio = audio, .mnode = mp3node, .mentry = mp3entry, .skip = 0};
+
+    ioTrackMap(&track->io, mp3node->file.buffer, mp3node->file.size);
+
+    /*
+     * samples_eat 为曲目时间轴上的位置（tinfo.samples 已扣除编码器延迟、填充），
+     * 从头播放时也要丢弃延迟部分，两者才能对上
+     */
+    size_t offset = mp3node->tagend;
+    egg.skip = mp3node->delay;
+    if (track->samples_eat > 0) {
+        /* 还没有索引时已排队由后台生成，这次先按字节比例定位 */
+        SeekIndex *sindex = mediaSeekIndex(mnode, false);
+        SeekPoint *point = seekIndexFind(sindex, track->samples_eat);
+        if (point) {
+            offset = point->offset;
+            egg.skip = track->samples_eat + sindex->delay - point->sample;
+        } else {
+            offset = mp3node->tagend + (mp3node->file.size - mp3node->tagend) * track->percent;
+            egg.skip = 0;
+            mtc_mt_dbg("no seek index for %s, byte seek", mnode->filename);
+        }
+    }
     if (mp3dec_iterate_buf(mp3node->file.buffer + offset,
                            mp3node->file.size - offset, _iterate_callback, &egg) != 0) {
         mtc_mt_err("play buffer error failure");
@@ -248,12 +407,25 @@ static bool _mp3_play(MediaNode *mnode, AudioEntry *audio)
     return true;
 }
 
+static SeekIndex* _mp3_seek_build(MediaNode *mnode)
+{
+    if (!mnode) return NULL;
+
+    MediaNodeMp3 *mp3node = (MediaNodeMp3*)mnode;
+
+    /* 先从帧头标签取得编码器延迟 */
+    if (mnode->tinfo.samples == 0) _mp3_header_info(mp3node);
+
+    return _mp3_scan(mp3node);
+}
+
 static void _mp3_close(MediaNode *mnode)
 {
     if (!mnode) return;
 
     MediaNodeMp3 *mp3node = (MediaNodeMp3*)mnode;
 
+    seekIndexFree(mnode->sindex);
     mos_free(mp3node->imagebuf);
     mp3dec_close_file(&mp3node->file);
     mos_free(mp3node);
@@ -263,13 +435,14 @@ MediaEntryMp3 media_mp3 = {
     .base = {
         .type = MEDIA_MP3,
         .name = "MP3",
-        .check = _mp3_verify,
         .open          = _mp3_open,
+        .id_get        = _mp3_id_get,
         .tech_info_get = _mp3_get_tinfo,
         .art_info_get  = _mp3_get_ainfo,
         .cover_get     = _mp3_get_cover,
         .play          = _mp3_play,
-        .close         = _mp3_close
+        .close         = _mp3_close,
+        .seek_index_build = _mp3_seek_build
     },
 
     .psamples = {0}
@@ -2,7 +2,7 @@
 #include "dr_wav.h"
 
 #define WAV_DECODE_SAMPLE 1024
-#define WAV_DECODE_BUFLEN 32768 /* 8 channels, 1024 samples, 4 bytes/sample */
+#define WAV_MAP_WINDOW (16 * 1024 * 1024)  /* 分段映射，32 位系统上的大镜像文件也能映射 */
 
 typedef struct {
     MediaNode base;
@@ -13,20 +13,8 @@ typedef struct {
 
 typedef struct {
     MediaEntry base;
-    drwav_int32 psamples[WAV_DECODE_BUFLEN];
 } MediaEntryWav;
 
-static bool _wav_verify(const char *filename)
-{
-    if (!filename) return false;
-
-    drwav wav;
-    bool ret = drwav_init_file(&wav, filename, NULL) ? true : false;
-    drwav_uninit(&wav);
-
-    return ret;
-}
-
 static MediaNode* _wav_open(const char *filename)
 {
     if (!filename) return NULL;
@@ -52,6 +40,20 @@ static MediaNode* _wav_open(const char *filename)
     }
 }
 
+static bool _wav_id_get(MediaNode *mnode)
+{
+    MediaNodeWav *wavnode = (MediaNodeWav*)mnode;
+
+    mnode->idver = mediaIdVersion();
+    if (mnode->idver == MEDIA_ID_MD5) return mhash_file_md5_s(mnode->filename, mnode->md5) >= 0;
+
+    /* LIST 等标签块可能在 data 块前后，只取 data 块 */
+    if (mdf_get_bool_value(g_config, "audio.id_skip_tags", true) && wavnode->wav.dataChunkDataSize > 0)
+        return mediaFingerprint(mnode->filename, wavnode->wav.dataChunkDataPos,
+                                wavnode->wav.dataChunkDataPos + wavnode->wav.dataChunkDataSize, mnode->md5);
+    else return mediaFingerprint(mnode->filename, 0, 0, mnode->md5);
+}
+
 static TechInfo* _wav_get_tinfo(MediaNode *mnode)
 {
     if (!mnode) return NULL;
@@ -92,68 +94,156 @@ static uint8_t* _wav_get_cover(MediaNode *mnode, size_t *imagelen)
     return wavnode->imagebuf;
 }
 
-static bool _wav_play(MediaNode *mnode, AudioEntry *audio)
+/* 声卡可以原样播放的 PCM 格式，其余（8 位、浮点、压缩编码）需要 dr_wav 解码 */
+static snd_pcm_format_t _wav_pcm_format(drwav *wav)
 {
-    static int channels = 0, hz = 0;
-    int rv;
+    if (wav->translatedFormatTag != DR_WAVE_FORMAT_PCM) return SND_PCM_FORMAT_UNKNOWN;
+    if (wav->fmt.blockAlign != wav->channels * wav->bitsPerSample / 8) return SND_PCM_FORMAT_UNKNOWN;
+
+    switch (wav->bitsPerSample) {
+    case 16: return SND_PCM_FORMAT_S16_LE;
+    case 24: return SND_PCM_FORMAT_S24_3LE;
+    case 32: return SND_PCM_FORMAT_S32_LE;
+    default: return SND_PCM_FORMAT_UNKNOWN;
+    }
+}
 
-    MediaNodeWav *wavnode = (MediaNodeWav*)mnode;
-    if (!wavnode) return false;
+/*
+ * 映射 data 块，从 track->samples_eat 处起把 PCM 数据原样写入声卡
+ * 返回 1 播放完成，0 被用户动作打断或出错，-1 无法映射（改走解码）
+ */
+static int _wav_passthrough(MediaNodeWav *wavnode, AudioEntry *audio)
+{
+    struct audioTrack *track = audio->track;
+    drwav *wav = &wavnode->wav;
+    size_t fbytes = wav->fmt.blockAlign;
+    struct stat fs;
+
+    int fd = open(wavnode->base.filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &fs) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
 
-    MediaEntryWav *waventry = (MediaEntryWav*)wavnode->base.driver;
+    /* 以实际文件大小为准，截断的文件映射越界会 SIGBUS */
+    uint64_t dataend = wav->dataChunkDataPos + wav->totalPCMFrameCount * fbytes;
+    if (dataend > (uint64_t)fs.st_size) dataend = fs.st_size;
+    uint64_t total = (dataend - wav->dataChunkDataPos) / fbytes;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    uint64_t from = track->samples_eat;
 
-    if (!audio) return false;
-    struct audioTrack *track = audio->track;
+    mtc_mt_dbg("passthrough from frame %ju", (uintmax_t)track->samples_eat);
 
-    if (track->percent != 0) {
-        drwav_uint64 index = track->tinfo.samples * track->percent;
-        drwav_seek_to_pcm_frame(&wavnode->wav, index);
-    }
+    track->playing = true;
 
-    if (track->media_switch || track->tinfo.channels != channels || track->tinfo.hz != hz) {
-        /* 设置播放参数 */
-        mtc_mt_dbg("set pcm params %d %dHZ", track->tinfo.channels, track->tinfo.hz);
+    int ret = 1;
+    while (track->samples_eat < total) {
+        uint64_t offset = wav->dataChunkDataPos + track->samples_eat * fbytes;
+        uint64_t mapstart = offset & ~(uint64_t)(pagesize - 1);
+        size_t maplen = dataend - mapstart > WAV_MAP_WINDOW ? WAV_MAP_WINDOW : dataend - mapstart;
 
-        switch (snd_pcm_state(audio->pcm)) {
-        case SND_PCM_STATE_RUNNING:
-            snd_pcm_drop(audio->pcm);
-            break;
-        case SND_PCM_STATE_XRUN:
-            snd_pcm_prepare(audio->pcm);
-            break;
-        default:
+        uint8_t *map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, mapstart);
+        if (map == MAP_FAILED) {
+            mtc_mt_warn("mmap %s failure %s", wavnode->base.filename, strerror(errno));
+            ret = track->samples_eat == from ? -1 : 0;
             break;
         }
-        rv = snd_pcm_set_params(audio->pcm,
-                                SND_PCM_FORMAT_S32_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                track->tinfo.channels, track->tinfo.hz, 1, 100000);
-        if (rv < 0) {
-            mtc_mt_err("can't set parameter. %s", snd_strerror(rv));
-            return false;
+        madvise(map, maplen, MADV_SEQUENTIAL);
+
+        /* 本窗口内完整的帧 */
+        uint8_t *pos = map + (offset - mapstart);
+        uint64_t frames = (mapstart + maplen - offset) / fbytes;
+
+        while (frames > 0) {
+            if (audio->act != ACT_NONE) {
+                mtc_mt_dbg("%s while playing", _action_string(audio->act));
+                ret = 0;
+                break;
+            }
+
+            snd_pcm_uframes_t count = frames > WAV_DECODE_SAMPLE ? WAV_DECODE_SAMPLE : frames;
+            snd_pcm_sframes_t rv = outputPCM(audio, pos, count);
+            if (rv < 0) {
+                mtc_mt_warn("write pcm failure %s", snd_strerror(rv));
+                ret = 0;
+                break;
+            }
+
+            pos += rv * fbytes;
+            frames -= rv;
+            track->samples_eat += rv;
+            track->percent = (float)track->samples_eat / track->tinfo.samples;
+            nowPlayingPosition(audio, track->samples_eat);
+            ioPlayProgress(audio);
         }
-        channels = track->tinfo.channels;
-        hz = track->tinfo.hz;
+
+        munmap(map, maplen);
+        if (ret != 1) break;
     }
 
+    close(fd);
+
+    track->playing = false;
+    if (ret == 1) track->percent = 0;
+
+    return ret;
+}
+
+static bool _wav_play(MediaNode *mnode, AudioEntry *audio)
+{
+    MediaNodeWav *wavnode = (MediaNodeWav*)mnode;
+    if (!wavnode) return false;
+
+    if (!audio) return false;
+    struct audioTrack *track = audio->track;
+
+    if (!outputSetup(audio, track->tinfo.channels, track->tinfo.hz, wavnode->wav.bitsPerSample))
+        return false;
+
+    /* 声卡原生支持该格式时映射文件直接输出，比特精确，没有解码和中转拷贝 */
+    snd_pcm_format_t format = _wav_pcm_format(&wavnode->wav);
+    if (format != SND_PCM_FORMAT_UNKNOWN && outputPassthrough(audio, format) &&
+        mdf_get_bool_value(g_config, "audio.passthrough", true)) {
+        int rv = _wav_passthrough(wavnode, audio);
+        if (rv >= 0) return rv == 1;
+    }
+
+    /* PCM 数据定长，直接按帧换算偏移，无需索引 */
+    if (track->samples_eat > 0) drwav_seek_to_pcm_frame(&wavnode->wav, track->samples_eat);
+
     track->playing = true;
+    bool direct = audio->out.direct;
 
-    int samples = 0;
-    while ((samples = drwav_read_pcm_frames_s32(&wavnode->wav, WAV_DECODE_SAMPLE,
-                                                waventry->psamples)) > 0) {
+    drwav_uint64 samples = 0;
+    while (true) {
         if (audio->act != ACT_NONE) {
             mtc_mt_dbg("%s while playing", _action_string(audio->act));
             track->playing = false;
             return false;
         }
 
-        rv = snd_pcm_writei(audio->pcm, waventry->psamples, samples);
-        if (rv == -EPIPE) {
-            mtc_mt_warn("XRUN");
-            snd_pcm_prepare(audio->pcm);
+        /* 尽量直接解码至声卡缓冲区 */
+        snd_pcm_uframes_t frames = WAV_DECODE_SAMPLE;
+        void *buf = direct ? outputBegin(audio, &frames) : outputBuffer(audio, &frames);
+        if (!buf) {
+            track->playing = false;
+            return false;
         }
 
-        track->samples_eat += rv;
-        track->percent = (float)track->samples_eat / track->tinfo.samples;
+        if (audio->out.sformat == SND_PCM_FORMAT_S16_LE)
+            samples = drwav_read_pcm_frames_s16(&wavnode->wav, frames, buf);
+        else samples = drwav_read_pcm_frames_s32(&wavnode->wav, frames, buf);
+
+        snd_pcm_sframes_t rv = direct ? outputCommit(audio, samples) :
+            outputWrite(audio, buf, audio->out.sformat, track->tinfo.channels, samples);
+        if (samples == 0) break;
+
+        if (rv > 0) {
+            track->samples_eat += rv;
+            track->percent = (float)track->samples_eat / track->tinfo.samples;
+            nowPlayingPosition(audio, track->samples_eat);
+            ioPlayProgress(audio);
+        }
     }
 
     /* 播放正常完成 */
@@ -178,14 +268,12 @@ MediaEntryWav media_wav = {
     .base = {
         .type = MEDIA_WAV,
         .name = "WAV",
-        .check = _wav_verify,
         .open          = _wav_open,
+        .id_get        = _wav_id_get,
         .tech_info_get = _wav_get_tinfo,
         .art_info_get  = _wav_get_ainfo,
         .cover_get     = _wav_get_cover,
         .play          = _wav_play,
         .close         = _wav_close,
-    },
-
-    .psamples = {0}
+    }
 };
@@ -0,0 +1,573 @@
+/*
+ * 同步转码缓存
+ * 手机可按 sync.transcode.profiles 中的方案同步有损的精简版本，代替动辄上 GB 的原始文件。
+ * 转码由后台工作线程调用外部编码器（方案中的 command，$1 为源文件，$2 为输出文件，
+ * $3 为起始秒数，$4 为时长秒数，到文件尾时为空）完成，CUE 分轨只截取整轨文件中本曲的部分，
+ * 编码进程 nice 19、SCHED_IDLE、IO idle，不影响播放。
+ * 转码完成后由 pusher 线程调用 transcodeDeliver() 通知等待的手机，断开的手机由 transcodeForget() 移出，
+ * 工作线程从不访问手机节点。
+ * 结果保存在 libroot/.avm/transcode/<方案>/<曲目 ID>.<后缀>，多台手机共用；
+ * 总大小超过 sync.transcode.cache_size（MB）时按最近使用淘汰，使用时间记在文件的修改时间上，重启后依然有效
+ */
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define TC_IOPRIO_IDLE (3 << 13)    /* IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT */
+#define TC_KEYLEN 128
+#define TC_RETRY 3600               /* 秒，编码失败后多久可以再试 */
+
+struct tc_profile {
+    char *name;
+    char *suffix;
+    char *command;
+};
+
+struct tc_entry {
+    char key[TC_KEYLEN];        /* 方案/ID.后缀，即相对缓存目录的文件名 */
+    uint64_t size;
+    struct tc_entry *prev, *next;
+};
+
+struct tc_job {
+    char key[TC_KEYLEN];
+    char id[LEN_DOMMEID];
+    struct tc_profile *profile;
+    char *source;
+    int start;                  /* 毫秒，源文件中的起止，end 为 0 时到文件尾 */
+    int end;
+    char start_arg[16];         /* 编码器的 $3、$4，fork 之前格式化好 */
+    char length_arg[16];
+    int length;                 /* 秒，用于统计编码速度 */
+    bool ok;
+    MLIST *waiters;             /* list of NetBinaryNode*，只在 m_tc_lock 内修改 */
+};
+
+static void (*m_tc_ready)(void *arg, const char *profile, const char *id, const char *filename,
+                          NetBinaryNode *client) = NULL;
+static void (*m_tc_wake)(void *arg) = NULL;
+static void *m_tc_arg = NULL;
+
+static char m_tc_dir[PATH_MAX] = {0};
+static MLIST *m_tc_profiles = NULL;
+static uint64_t m_tc_limit = 0;
+
+static MHASH *m_tc_entries = NULL;      /* key => struct tc_entry* */
+static struct tc_entry *m_tc_head = NULL, *m_tc_tail = NULL;
+static uint64_t m_tc_total = 0;
+
+static MHASH *m_tc_pending = NULL;      /* key => struct tc_job* */
+static MHASH *m_tc_failed = NULL;       /* key => 失败时间，TC_RETRY 内不再重试，直接同步原文件 */
+static MLIST *m_tc_jobs = NULL;
+static MLIST *m_tc_done = NULL;         /* 完成待通知的 struct tc_job* */
+
+static struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t encoded;
+    uint64_t failed;
+    uint64_t audioseconds;
+    double encodeseconds;
+    uint64_t bytesin;
+    uint64_t bytesout;
+} m_tc_stat;
+
+static bool m_tc_running = false;
+static int m_tc_nworker = 0;
+static pthread_t *m_tc_workers = NULL;
+static pthread_mutex_t m_tc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_tc_cond = PTHREAD_COND_INITIALIZER;
+
+static void _tc_profile_free(void *p)
+{
+    struct tc_profile *profile = p;
+    if (!profile) return;
+
+    mos_free(profile->name);
+    mos_free(profile->suffix);
+    mos_free(profile->command);
+    mos_free(profile);
+}
+
+static void _tc_job_free(struct tc_job *job)
+{
+    if (!job) return;
+
+    mos_free(job->source);
+    mlist_destroy(&job->waiters);
+    mos_free(job);
+}
+
+static void _tc_failed_free(void *key, void *val)
+{
+    free(key);
+}
+
+/* 调用者持有 m_tc_lock，失败已超过 TC_RETRY 的移除，可以再试 */
+static bool _tc_failed_recently(const char *key)
+{
+    uintptr_t failtime = (uintptr_t)mhash_lookup(m_tc_failed, (void*)key);
+    if (!failtime) return false;
+
+    if (time(NULL) - (time_t)failtime < TC_RETRY) return true;
+
+    mhash_remove(m_tc_failed, (void*)key);
+    return false;
+}
+
+static struct tc_profile* _tc_profile_find(const char *name)
+{
+    struct tc_profile *profile;
+    MLIST_ITERATE(m_tc_profiles, profile) {
+        if (!strcmp(profile->name, name)) return profile;
+    }
+
+    return NULL;
+}
+
+static void _tc_unlink(struct tc_entry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else m_tc_head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else m_tc_tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void _tc_push_head(struct tc_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = m_tc_head;
+    if (m_tc_head) m_tc_head->prev = entry;
+    m_tc_head = entry;
+    if (!m_tc_tail) m_tc_tail = entry;
+}
+
+static void _tc_add(const char *key, uint64_t size)
+{
+    struct tc_entry *entry = mos_calloc(1, sizeof(struct tc_entry));
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    entry->size = size;
+
+    mhash_insert(m_tc_entries, entry->key, entry);
+    _tc_push_head(entry);
+    m_tc_total += size;
+}
+
+/* 淘汰最久未用的，直至总大小不超过上限（最新的一个始终保留） */
+static void _tc_evict()
+{
+    char filename[PATH_MAX];
+
+    while (m_tc_total > m_tc_limit && m_tc_tail && m_tc_tail != m_tc_head) {
+        struct tc_entry *entry = m_tc_tail;
+
+        snprintf(filename, sizeof(filename), "%s%s", m_tc_dir, entry->key);
+        if (remove(filename) != 0 && errno != ENOENT)
+            mtc_mt_warn("remove %s failure %s", filename, strerror(errno));
+
+        mtc_mt_dbg("evict %s, %ju bytes", entry->key, (uintmax_t)entry->size);
+
+        _tc_unlink(entry);
+        m_tc_total -= entry->size;
+        mhash_remove(m_tc_entries, entry->key);
+        mos_free(entry);
+    }
+}
+
+static int _tc_mtime_compare(const void *a, const void *b)
+{
+    const struct stat *pa = *(struct stat**)a, *pb = *(struct stat**)b;
+
+    if (pa->st_mtime == pb->st_mtime) return 0;
+    return pa->st_mtime < pb->st_mtime ? -1 : 1;
+}
+
+/* 启动时按修改时间恢复各方案目录下缓存文件的使用顺序，清理上次未完成的 .part */
+static void _tc_scan()
+{
+    char dirname[PATH_MAX], filename[PATH_MAX];
+    MLIST *files;
+    mlist_init(&files, free);
+
+    struct tc_profile *profile;
+    MLIST_ITERATE(m_tc_profiles, profile) {
+        snprintf(dirname, sizeof(dirname), "%s%s/", m_tc_dir, profile->name);
+        DIR *pwd = opendir(dirname);
+        if (!pwd) continue;
+
+        struct dirent *dirent;
+        while ((dirent = readdir(pwd)) != NULL) {
+            if (dirent->d_name[0] == '.') continue;
+
+            snprintf(filename, sizeof(filename), "%s%s", dirname, dirent->d_name);
+
+            char *suffix = strrchr(dirent->d_name, '.');
+            if (suffix && !strcmp(suffix, ".part")) {
+                remove(filename);
+                continue;
+            }
+
+            /* struct stat 后面紧跟 key */
+            struct stat *fs = mos_calloc(1, sizeof(struct stat) + TC_KEYLEN);
+            if (stat(filename, fs) != 0 || !S_ISREG(fs->st_mode)) {
+                mos_free(fs);
+                continue;
+            }
+            snprintf((char*)(fs + 1), TC_KEYLEN, "%s/%s", profile->name, dirent->d_name);
+            mlist_append(files, fs);
+        }
+
+        closedir(pwd);
+    }
+
+    mlist_sort(files, _tc_mtime_compare);
+
+    struct stat *fs;
+    MLIST_ITERATE(files, fs) _tc_add((char*)(fs + 1), fs->st_size);
+
+    mlist_destroy(&files);
+
+    mtc_mt_dbg("%u transcoded files in cache, %ju MB", mhash_length(m_tc_entries),
+               (uintmax_t)(m_tc_total >> 20));
+
+    _tc_evict();
+}
+
+/* 调用外部编码器，成功时返回 true */
+static bool _tc_encode(struct tc_job *job, const char *output)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        mtc_mt_err("fork failure %s", strerror(errno));
+        return false;
+    }
+
+    if (pid == 0) {
+        /* fork 与 exec 之间只调用 async-signal-safe 的函数 */
+        struct sched_param param = {.sched_priority = 0};
+        setpriority(PRIO_PROCESS, 0, 19);
+        sched_setscheduler(0, SCHED_IDLE, &param);
+        syscall(SYS_ioprio_set, 1, 0, TC_IOPRIO_IDLE);
+
+        for (int fd = 3; fd < 1024; fd++) close(fd);
+
+        execl("/bin/sh", "sh", "-c", job->profile->command, "sh", job->source, output,
+              job->start_arg, job->length_arg, (char*)NULL);
+        _exit(127);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            mtc_mt_err("waitpid failure %s", strerror(errno));
+            return false;
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        mtc_mt_warn("transcode %s exit with %d", job->source, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return false;
+    }
+
+    return true;
+}
+
+static void* _tc_worker(void *arg)
+{
+    char filename[PATH_MAX], tmpname[PATH_MAX];
+
+    while (m_tc_running) {
+        pthread_mutex_lock(&m_tc_lock);
+        while (m_tc_running && mlist_length(m_tc_jobs) == 0) pthread_cond_wait(&m_tc_cond, &m_tc_lock);
+        struct tc_job *job = m_tc_running ? mlist_popx(m_tc_jobs) : NULL;
+        pthread_mutex_unlock(&m_tc_lock);
+
+        if (!job) continue;
+
+        snprintf(filename, sizeof(filename), "%s%s", m_tc_dir, job->key);
+        snprintf(tmpname, sizeof(tmpname), "%s.part", filename);
+
+        struct stat fs;
+        uint64_t insize = stat(job->source, &fs) == 0 ? fs.st_size : 0, outsize = 0;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        bool ok = _tc_encode(job, tmpname) && stat(tmpname, &fs) == 0 && fs.st_size > 0 &&
+            rename(tmpname, filename) == 0;
+        if (ok) outsize = fs.st_size;
+        else remove(tmpname);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        pthread_mutex_lock(&m_tc_lock);
+
+        mhash_remove(m_tc_pending, job->key);
+        job->ok = ok;
+        if (ok) {
+            _tc_add(job->key, outsize);
+            _tc_evict();
+
+            m_tc_stat.encoded++;
+            m_tc_stat.audioseconds += job->length;
+            m_tc_stat.encodeseconds += elapsed;
+            m_tc_stat.bytesin += insize;
+            m_tc_stat.bytesout += outsize;
+        } else {
+            m_tc_stat.failed++;
+            if (!mhash_lookup(m_tc_failed, job->key)) mhash_insert(m_tc_failed, strdup(job->key), (void*)(uintptr_t)time(NULL));
+        }
+
+        uint64_t lookups = m_tc_stat.hits + m_tc_stat.misses;
+        mtc_mt_dbg("transcode %s %s, %ds audio in %.1fs (%.1fx), %ju => %ju bytes, hit rate %.1f%% of %ju",
+                   job->key, ok ? "done" : "failure", job->length, elapsed,
+                   elapsed > 0 ? job->length / elapsed : 0, (uintmax_t)insize, (uintmax_t)outsize,
+                   lookups ? m_tc_stat.hits * 100.0 / lookups : 0, (uintmax_t)lookups);
+
+        /* 交给 pusher 线程通知等待中的手机 */
+        mlist_append(m_tc_done, job);
+
+        pthread_mutex_unlock(&m_tc_lock);
+
+        m_tc_wake(m_tc_arg);
+    }
+
+    return NULL;
+}
+
+void transcodeInit(const char *libroot,
+                   void (*ready)(void *arg, const char *profile, const char *id, const char *filename,
+                                 NetBinaryNode *client),
+                   void (*wake)(void *arg), void *arg)
+{
+    if (!libroot || !ready || !wake || m_tc_running) return;
+
+    MDF *config = mdf_get_node(g_config, "sync.transcode");
+    MDF *pnode = mdf_get_node(config, "profiles");
+    if (!config || !pnode || !mdf_get_bool_value(config, "enable", true)) return;
+
+    m_tc_ready = ready;
+    m_tc_wake = wake;
+    m_tc_arg = arg;
+    snprintf(m_tc_dir, sizeof(m_tc_dir), "%s.avm/transcode/", libroot);
+    m_tc_limit = (uint64_t)mdf_get_int64_value(config, "cache_size", 4096) << 20;
+
+    mlist_init(&m_tc_profiles, _tc_profile_free);
+    MDF *cnode = mdf_node_child(pnode);
+    while (cnode) {
+        char *suffix = mdf_get_value(cnode, "suffix", NULL);
+        char *command = mdf_get_value(cnode, "command", NULL);
+        if (suffix && command) {
+            struct tc_profile *profile = mos_calloc(1, sizeof(struct tc_profile));
+            profile->name = strdup(mdf_get_name(cnode, NULL));
+            profile->suffix = strdup(suffix);
+            profile->command = strdup(command);
+            mlist_append(m_tc_profiles, profile);
+        } else mtc_mt_warn("transcode profile %s incomplete", mdf_get_name(cnode, NULL));
+
+        cnode = mdf_node_next(cnode);
+    }
+
+    if (mlist_length(m_tc_profiles) == 0) {
+        mlist_destroy(&m_tc_profiles);
+        return;
+    }
+
+    mhash_init(&m_tc_entries, mhash_str_hash, mhash_str_comp, NULL);
+    mhash_init(&m_tc_pending, mhash_str_hash, mhash_str_comp, NULL);
+    mhash_init(&m_tc_failed, mhash_str_hash, mhash_str_comp, _tc_failed_free);
+    mlist_init(&m_tc_jobs, NULL);
+    mlist_init(&m_tc_done, NULL);
+    memset(&m_tc_stat, 0x0, sizeof(m_tc_stat));
+
+    _tc_scan();
+
+    m_tc_running = true;
+    m_tc_nworker = mdf_get_int_value(config, "workers", 1);
+    if (m_tc_nworker < 1) m_tc_nworker = 1;
+    m_tc_workers = mos_calloc(m_tc_nworker, sizeof(pthread_t));
+    for (int i = 0; i < m_tc_nworker; i++) pthread_create(&m_tc_workers[i], NULL, _tc_worker, NULL);
+
+    mtc_mt_dbg("%d transcode profiles, %d workers, cache limit %ju MB",
+               mlist_length(m_tc_profiles), m_tc_nworker, (uintmax_t)(m_tc_limit >> 20));
+}
+
+/* 等待正在进行的转码结束（不再开始新的） */
+void transcodeStop()
+{
+    if (!m_tc_running) return;
+
+    pthread_mutex_lock(&m_tc_lock);
+    m_tc_running = false;
+    pthread_cond_broadcast(&m_tc_cond);
+    pthread_mutex_unlock(&m_tc_lock);
+
+    for (int i = 0; i < m_tc_nworker; i++) pthread_join(m_tc_workers[i], NULL);
+    mos_free(m_tc_workers);
+
+    struct tc_job *job;
+    while ((job = mlist_popx(m_tc_jobs)) != NULL) _tc_job_free(job);
+    mlist_destroy(&m_tc_jobs);
+    while ((job = mlist_popx(m_tc_done)) != NULL) _tc_job_free(job);
+    mlist_destroy(&m_tc_done);
+
+    while (m_tc_head) {
+        struct tc_entry *entry = m_tc_head;
+        m_tc_head = entry->next;
+        mos_free(entry);
+    }
+    m_tc_tail = NULL;
+    m_tc_total = 0;
+
+    mhash_destroy(&m_tc_entries);
+    mhash_destroy(&m_tc_pending);
+    mhash_destroy(&m_tc_failed);
+    mlist_destroy(&m_tc_profiles);
+}
+
+/*
+ * 查询曲目 id 的 profile 转码结果，曲目为源文件中 [start, end) 毫秒的部分，end 为 0 时到文件尾
+ * （CUE 分轨的 id 各不相同，对应整轨文件中的不同区间）
+ * 返回 1：已缓存，filename 为相对 libroot 的文件名
+ * 返回 0：已排队转码，完成后 pusher 线程在 transcodeDeliver() 中通过 ready 回调通知 client
+ * 返回 -1：不转码（未启用、没有该方案、不久前转码失败），应同步原文件
+ */
+int transcodeGet(const char *profile, const char *id, const char *source, int start, int end, int length,
+                 NetBinaryNode *client, char *filename, size_t len)
+{
+    if (!m_tc_running || !profile || !id || !source) return -1;
+
+    struct tc_profile *pprofile = _tc_profile_find(profile);
+    if (!pprofile) {
+        mtc_mt_warn("unknown transcode profile %s", profile);
+        return -1;
+    }
+
+    char key[TC_KEYLEN], pathname[PATH_MAX];
+    snprintf(key, sizeof(key), "%s/%s.%s", pprofile->name, id, pprofile->suffix);
+
+    int ret = -1;
+    pthread_mutex_lock(&m_tc_lock);
+
+    struct tc_entry *entry = mhash_lookup(m_tc_entries, key);
+    if (entry) {
+        m_tc_stat.hits++;
+
+        _tc_unlink(entry);
+        _tc_push_head(entry);
+
+        snprintf(pathname, sizeof(pathname), "%s%s", m_tc_dir, key);
+        utimensat(AT_FDCWD, pathname, NULL, 0);
+
+        snprintf(filename, len, ".avm/transcode/%s", key);
+        ret = 1;
+    } else if (!_tc_failed_recently(key)) {
+        struct tc_job *job = mhash_lookup(m_tc_pending, key);
+        if (!job) {
+            m_tc_stat.misses++;
+
+            snprintf(pathname, sizeof(pathname), "%s%s/", m_tc_dir, pprofile->name);
+            if (!mos_mkdir(pathname, 0755)) {
+                mtc_mt_warn("create directory %s failure", pathname);
+                goto done;
+            }
+
+            job = mos_calloc(1, sizeof(struct tc_job));
+            strncpy(job->key, key, sizeof(job->key) - 1);
+            strncpy(job->id, id, sizeof(job->id) - 1);
+            job->profile = pprofile;
+            job->source = strdup(source);
+            job->start = start;
+            job->end = end > start ? end : 0;
+            snprintf(job->start_arg, sizeof(job->start_arg), "%d.%03d", job->start / 1000, job->start % 1000);
+            if (job->end) {
+                int duration = job->end - job->start;
+                snprintf(job->length_arg, sizeof(job->length_arg), "%d.%03d", duration / 1000, duration % 1000);
+                job->length = duration / 1000;
+            } else job->length = length - job->start / 1000;
+            mlist_init(&job->waiters, NULL);
+
+            mhash_insert(m_tc_pending, job->key, job);
+            mlist_append(m_tc_jobs, job);
+            pthread_cond_signal(&m_tc_cond);
+        }
+
+        if (client && !mlist_search(job->waiters, &client, mlist_ptrcompare)) mlist_append(job->waiters, client);
+        ret = 0;
+    }
+
+done:
+    pthread_mutex_unlock(&m_tc_lock);
+
+    return ret;
+}
+
+/* 通知完成的转码，只在 pusher 线程调用，失败时由 storage 改为同步原文件 */
+void transcodeDeliver()
+{
+    if (!m_tc_done) return;
+
+    char filename[PATH_MAX];
+    MLIST *done;
+    mlist_init(&done, NULL);
+
+    pthread_mutex_lock(&m_tc_lock);
+    struct tc_job *job;
+    while ((job = mlist_popx(m_tc_done)) != NULL) mlist_append(done, job);
+    pthread_mutex_unlock(&m_tc_lock);
+
+    MLIST_ITERATE(done, job) {
+        snprintf(filename, sizeof(filename), ".avm/transcode/%s", job->key);
+
+        NetBinaryNode *client;
+        MLIST_ITERATE(job->waiters, client) {
+            m_tc_ready(m_tc_arg, job->profile->name, job->id, job->ok ? filename : NULL, client);
+        }
+
+        _tc_job_free(job);
+    }
+
+    mlist_destroy(&done);
+}
+
+/* 手机断开，从所有等待列表中移出，须在释放之前、在 pusher 线程调用 */
+void transcodeForget(NetBinaryNode *client)
+{
+    if (!m_tc_pending || !client) return;
+
+    pthread_mutex_lock(&m_tc_lock);
+
+    char *key;
+    struct tc_job *job;
+    MHASH_ITERATE(m_tc_pending, key, job) mlist_delete_item(job->waiters, client, mlist_ptrcompare);
+    MLIST_ITERATE(m_tc_done, job) mlist_delete_item(job->waiters, client, mlist_ptrcompare);
+
+    pthread_mutex_unlock(&m_tc_lock);
+}
+
+/* 编码速度、缓存命中率 */
+void transcodeStat(MDF *node)
+{
+    if (!node) return;
+
+    pthread_mutex_lock(&m_tc_lock);
+
+    uint64_t lookups = m_tc_stat.hits + m_tc_stat.misses;
+
+    mdf_set_bool_value(node, "enable", m_tc_running);
+    mdf_set_int64_value(node, "cached", m_tc_entries ? mhash_length(m_tc_entries) : 0);
+    mdf_set_int64_value(node, "cacheSize", m_tc_total);
+    mdf_set_int64_value(node, "pending", m_tc_jobs ? mlist_length(m_tc_jobs) : 0);
+    mdf_set_int64_value(node, "encoded", m_tc_stat.encoded);
+    mdf_set_int64_value(node, "failed", m_tc_stat.failed);
+    mdf_set_double_value(node, "hitRate", lookups ? (double)m_tc_stat.hits / lookups : 0);
+    mdf_set_double_value(node, "speed", m_tc_stat.encodeseconds > 0 ?
+                         m_tc_stat.audioseconds / m_tc_stat.encodeseconds : 0);
+    mdf_set_double_value(node, "ratio", m_tc_stat.bytesin ?
+                         (double)m_tc_stat.bytesout / m_tc_stat.bytesin : 0);
+
+    pthread_mutex_unlock(&m_tc_lock);
+}
@@ -1,16 +1,108 @@
 #include <reef.h>
 #include <magic.h>
+#include <fcntl.h>
 
 #include "cue.h"
 #include "asset.h"
 
+/*
+ * 先按文件头签名判断项目支持的格式，只读一块文件头，不加锁；
+ * 认不出的文件才交给 libmagic（一个 cookie，全局加锁）
+ */
+#define SNIFF_LEN 1024
+
 static magic_t cookie = NULL;
 static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static const struct {
+    size_t offset;
+    size_t len;
+    const char *magic;
+    ASSET_TYPE type;
+} m_signatures[] = {
+    {0, 3, "ID3",                ASSET_AUDIO},
+    {0, 4, "fLaC",               ASSET_AUDIO},
+    {8, 4, "WAVE",               ASSET_AUDIO},  /* RIFF */
+    {8, 4, "WEBP",               ASSET_IMAGE},  /* RIFF */
+    {0, 3, "\xFF\xD8\xFF",    ASSET_IMAGE},
+    {0, 8, "\x89PNG\r\n\x1A\n", ASSET_IMAGE},
+    {0, 6, "GIF87a",             ASSET_IMAGE},
+    {0, 6, "GIF89a",             ASSET_IMAGE},
+    {0, 0, NULL,                 ASSET_UNKNOWN}
+};
+
+/* 裸 MPEG 音频帧头（没有 ID3 标签的 MP3） */
+static bool _sniff_mpeg(const uint8_t *buf, size_t len)
+{
+    if (len < 4 || buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0) return false;
+
+    int version = (buf[1] >> 3) & 0x3;
+    int layer = (buf[1] >> 1) & 0x3;
+    int bitrate = buf[2] >> 4;
+    int rate = (buf[2] >> 2) & 0x3;
+
+    return version != 1 && layer != 0 && bitrate != 0xF && rate != 3;
+}
+
+/* CUE 脚本：文本（没有 NUL），开头几行中有 CUE 命令 */
+static bool _sniff_cue(const char *filename, const uint8_t *buf, size_t len)
+{
+    static const char *commands[] = {"REM ", "PERFORMER ", "TITLE ", "FILE ", "CATALOG ", "TRACK ", NULL};
+
+    if (!mstr_endwith(filename, ".cue", true) || memchr(buf, 0, len)) return false;
+
+    const char *line = (const char*)buf, *end = (const char*)buf + len;
+    if (len >= 3 && !memcmp(line, "\xEF\xBB\xBF", 3)) line += 3;
+
+    while (line < end) {
+        while (line < end && (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n')) line++;
+
+        for (int i = 0; commands[i]; i++) {
+            size_t clen = strlen(commands[i]);
+            if ((size_t)(end - line) >= clen && !strncasecmp(line, commands[i], clen)) return true;
+        }
+
+        const char *next = memchr(line, '\n', end - line);
+        if (!next) break;
+        line = next + 1;
+    }
+
+    return false;
+}
+
+static ASSET_TYPE _sniff(const char *filename)
+{
+    uint8_t buf[SNIFF_LEN];
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return ASSET_UNKNOWN;
+
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (len <= 0) return ASSET_UNKNOWN;
+
+    for (int i = 0; m_signatures[i].magic; i++) {
+        size_t offset = m_signatures[i].offset;
+        if ((size_t)len >= offset + m_signatures[i].len &&
+            !memcmp(buf + offset, m_signatures[i].magic, m_signatures[i].len)) {
+            if (offset == 8 && memcmp(buf, "RIFF", 4)) continue;
+            return m_signatures[i].type;
+        }
+    }
+
+    if (_sniff_mpeg(buf, len)) return ASSET_AUDIO;
+    if (_sniff_cue(filename, buf, len)) return ASSET_CUE;
+
+    return ASSET_UNKNOWN;
+}
+
 ASSET_TYPE assetType(const char *filename)
 {
     if (!filename) return ASSET_UNKNOWN;
 
+    ASSET_TYPE type = _sniff(filename);
+    if (type != ASSET_UNKNOWN) return type;
+
 #define RETURN(ret)                             \
     do {                                        \
         pthread_mutex_unlock(&m_lock);          \
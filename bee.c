@@ -88,6 +88,10 @@ static void _bee_stop(void *p)
     be->running = false;
     be->stop(be);
 
+    pthread_mutex_lock(&be->op_queue->lock);
+    pthread_cond_signal(&be->op_queue->cond);
+    pthread_mutex_unlock(&be->op_queue->lock);
+
     pthread_join(*(be->op_thread), NULL);
     mos_free(be->op_thread);
     queueFree(be->op_queue);
@@ -98,11 +102,32 @@ static void _bee_stop(void *p)
     mos_free(be);
 }
 
-static void* _worker(void *arg)
+/*
+ * 空闲时清理已断开的用户，调用时不持有 queue->lock（锁顺序：client->lock 与 queue->lock 从不嵌套）
+ * 最后一个离开的 bee 释放用户，是否最后一个须在移除的同一把锁内判断
+ */
+static void _sweep_users(BeeEntry *be)
 {
-    uint8_t idle_count = 0;
-    int rv;
+    NetClientNode *client;
+    MLIST_ITERATE(be->users, client) {
+        if (!client->base.dropped) continue;
+
+        pthread_mutex_lock(&client->lock);
+        mlist_delete_item(client->bees, be, _bee_compare);
+        bool last = mlist_length(client->bees) == 0;
+        pthread_mutex_unlock(&client->lock);
+
+        /* 先置空，删除时不经 _user_destroy，由最后一个离开的 bee 释放 */
+        mlist_set(be->users, _moon_i, NULL);
+        mlist_delete(be->users, _moon_i);
+        _moon_i--;
+
+        if (last) _user_destroy(client);
+    }
+}
 
+static void* _worker(void *arg)
+{
     BeeEntry *be = (BeeEntry*)arg;
     QueueManager *queue = be->op_queue;
 
@@ -112,64 +137,45 @@ static void* _worker(void *arg)
     mtc_mt_dbg("I am your business %s worker No.%d", be->name, be->id);
 
     while (be->running) {
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 1;
-
         pthread_mutex_lock(&queue->lock);
 
-        while (queue->size == 0 &&
-               (rv = pthread_cond_timedwait(&queue->cond, &queue->lock, &timeout)) == ETIMEDOUT) {
-            //mtc_mt_dbg("condwait timeout");
-            timeout.tv_sec += 1;
+        /* 只在有指令、有用户断开、停止时醒来 */
+        while (be->running && queue->size == 0 && !queue->sweep)
+            pthread_cond_wait(&queue->cond, &queue->lock);
 
-            if (++idle_count >= 3) {
-                mtc_mt_noise("check my users in freetime");
-
-                idle_count = 0;
-
-                NetClientNode *client;
-                MLIST_ITERATE(be->users, client) {
-                    if (client->base.dropped) {
-                        pthread_mutex_lock(&client->lock);
-                        mlist_delete_item(client->bees, be, _bee_compare);
-                        mlist_delete(be->users, _moon_i);
-                        pthread_mutex_unlock(&client->lock);
-
-                        _moon_i--;
-                    }
-                }
-            }
-
-            if (!be->running) break;
-        }
+        WAKEUP(WAKE_WORKER);
 
         if (!be->running) {
             pthread_mutex_unlock(&queue->lock);
             break;
         }
 
-        if (queue->size == 0 && rv != 0) {
-            mtc_mt_err("timedwait error %s", strerror(errno));
+        /* 队列中可能还有断开用户的指令，清空后再清理 */
+        if (queue->size == 0) {
+            mtc_mt_noise("check my users in freetime");
+
+            queue->sweep = false;
             pthread_mutex_unlock(&queue->lock);
+
+            /* be->users 只在本线程中修改 */
+            _sweep_users(be);
             continue;
         }
 
-        /* rv == 0 */
         QueueEntry *qentry = queueEntryGet(queue);
         pthread_mutex_unlock(&queue->lock);
 
         if (!qentry) {
-            mtc_mt_warn("timedwait success, but got nothing!");
+            mtc_mt_warn("wakeup, but got nothing!");
             continue;
         }
 
-        idle_count = 0;
-
+        pthread_mutex_lock(&qentry->client->lock);
         if (!mlist_search(qentry->client->bees, &be, _bee_compare)) {
             mlist_append(qentry->client->bees, be);
             mlist_append(be->users, qentry->client);
         }
+        pthread_mutex_unlock(&qentry->client->lock);
 
         be->process(be, qentry);
 
@@ -223,6 +229,36 @@ void beeStop()
     if (g_bees) mlist_destroy(&g_bees);
 }
 
+/*
+ * 标记用户断开，通知其用过的 bee 在空闲时清理
+ * 在 client->lock 内取 bees 快照并置 dropped，此后 client 随时可能被清理释放，不再访问；
+ * 通知 bee 时不持有 client->lock
+ */
+void beeUserDropped(NetClientNode *client)
+{
+    if (!client) return;
+
+    MLIST *bees;
+    mlist_init(&bees, NULL);
+
+    pthread_mutex_lock(&client->lock);
+    BeeEntry *be;
+    MLIST_ITERATE(client->bees, be) mlist_append(bees, be);
+    client->base.dropped = true;
+    pthread_mutex_unlock(&client->lock);
+
+    MLIST_ITERATE(bees, be) {
+        QueueManager *queue = be->op_queue;
+
+        pthread_mutex_lock(&queue->lock);
+        queue->sweep = true;
+        pthread_cond_signal(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    mlist_destroy(&bees);
+}
+
 BeeEntry* beeFind(uint8_t id)
 {
     if (!g_bees) return NULL;
@@ -313,6 +349,7 @@ QueueManager* queueCreate()
     queue->size = 0;
     queue->top = NULL;
     queue->bottom = NULL;
+    queue->sweep = false;
 
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
@@ -14,6 +14,8 @@ typedef enum {
     SYNC_ARTIST_COVER,
     SYNC_ALBUM_COVER,
     SYNC_PONG,
+    SYNC_STREAM,                /* 从指定位置起流式传输曲目，边下边播 */
+    SYNC_TRANSCODE,             /* 曲目按方案转码后的精简版本，见 _storage_transcode.c */
 } SYNC_TYPE;
 
 typedef struct queue_entry {
@@ -33,6 +35,8 @@ typedef struct {
     ssize_t size;
     QueueEntry *top;
     QueueEntry *bottom;
+
+    bool sweep;                 /* 有用户断开，空闲时清理 */
 } QueueManager;
 
 typedef struct {
@@ -66,6 +70,7 @@ typedef struct {
 MERR* beeStart();
 void beeStop();
 BeeEntry* beeFind(uint8_t id);
+void beeUserDropped(NetClientNode *client);
 
 Channel* channelFind(MLIST *channels, const char *name, bool create);
 bool channelEmpty(Channel *slot);
@@ -84,5 +89,7 @@ QueueEntry* queueEntryGet(QueueManager *queue);
 void queueEntryPush(QueueManager *queue, QueueEntry *qe);
 
 void binaryPush(BeeEntry *be, SYNC_TYPE stype, NetBinaryNode *client);
+void binaryDropped(BeeEntry *be);
+void transcodeStat(MDF *node);
 
 #endif  /* ___BEE_H__ */
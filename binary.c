@@ -233,5 +233,5 @@ void binaryDrop(NetBinaryNode *client)
     if (!client->in_business) {
         mos_free(client->buf);
         mos_free(client);
-    }
+    } else binaryDropped(beeFind(FRAME_STORAGE));
 }
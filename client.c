@@ -289,8 +289,6 @@ void clientDrop(NetClientNode *client)
 
     mtc_mt_dbg("drop client %s %p %d", client->id, client, client->base.fd);
 
-    client->base.dropped = true;
-
     epoll_ctl(g_efd, EPOLL_CTL_DEL, client->base.fd, NULL);
     shutdown(client->base.fd, SHUT_RDWR);
     close(client->base.fd);
@@ -306,13 +304,19 @@ void clientDrop(NetClientNode *client)
         }
     }
 
-    if (mlist_length(client->bees) == 0) {
+    /* 用过 bee 的，由 beeUserDropped() 置 dropped，业务线程空闲时释放 */
+    pthread_mutex_lock(&client->lock);
+    bool alone = mlist_length(client->bees) == 0;
+    if (alone) client->base.dropped = true;
+    pthread_mutex_unlock(&client->lock);
+
+    if (alone) {
         mtc_mt_dbg("free user %p", client);
         mlist_destroy(&client->channels);
         mlist_destroy(&client->bees);
         mos_free(client->buf);
         mos_free(client);
-    }
+    } else beeUserDropped(client);
 }
 
 void clientAdd(NetClientNode *client)
@@ -3,6 +3,19 @@
 
 #include "timer.h"
 
+/* 各循环的唤醒次数，空闲时应当不再增长（CMD_HOME_INFO 中查看） */
+typedef enum {
+    WAKE_MAIN = 0,              /* epoll 主循环 */
+    WAKE_TIMER,
+    WAKE_WORKER,                /* 各 bee 的业务线程 */
+    WAKE_PUSHER,
+    WAKE_PLAYER,
+    WAKE_INDEXER,
+    WAKE_MAX
+} WAKEUP_SOURCE;
+
+#define WAKEUP(source) __atomic_add_fetch(&g_wakeups[source], 1, __ATOMIC_RELAXED)
+
 extern MDF *g_config;
 extern MDF *g_runtime;
 extern TimerEntry *g_timers;
@@ -17,5 +30,6 @@ extern bool  g_dumpsend;
 extern bool  g_dumprecv;
 extern const char *g_cpuid;
 extern int g_efd;
+extern uint64_t g_wakeups[WAKE_MAX];
 
 #endif  /* __GLOBAL_H__ */
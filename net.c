@@ -1,5 +1,6 @@
 #include <reef.h>
 
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 
@@ -13,6 +14,7 @@
 #define BROADCAST_PERIOD 1
 
 static pthread_t m_timer;
+static TimerEntry *m_horn = NULL;   /* 广播定时器，有客户端在线时暂停 */
 static bool dad_call_me_back = false;
 
 static void _sig_exit(int sig)
@@ -129,67 +131,92 @@ static bool _broadcast_me(void *data)
     return true;
 }
 
-static void _timer_handler(int fd)
+static time_t _monotonic()
 {
-    uint64_t value;
-    read(fd, &value, sizeof(uint64_t));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    time_t now = time(NULL);
-    if (now <= g_ctime) return;
+    return now.tv_sec;
+}
 
-    //mtc_mt_foo("tick tock");
+/* 执行到期的定时器，返回最近的下次触发时间，0 为没有需要触发的定时器 */
+static time_t _timer_handler()
+{
+    time_t now = _monotonic(), next = 0;
 
-    g_ctime = now;
-    g_elapsed = now - g_starton;
+    g_ctime = time(NULL);
+    g_elapsed = g_ctime - g_starton;
 
     TimerEntry *t = g_timers, *p, *n;
     p = NULL;
     while (t && t->timeout > 0) {
         n = t->next;
 
-        if (t->right_now || (g_elapsed % t->timeout == 0 && !t->pause)) {
-            t->right_now = false;
+        time_t deadline = __atomic_load_n(&t->deadline, __ATOMIC_RELAXED);
+        if (deadline == 0) {
+            deadline = now + t->timeout;
+            __atomic_store_n(&t->deadline, deadline, __ATOMIC_RELAXED);
+        }
+
+        bool rightnow = __atomic_exchange_n(&t->right_now, false, __ATOMIC_SEQ_CST);
+        if (rightnow || (!__atomic_load_n(&t->pause, __ATOMIC_SEQ_CST) && deadline <= now)) {
+            __atomic_store_n(&t->deadline, now + t->timeout, __ATOMIC_RELAXED);
             if (!t->callback(t->data)) {
                 if (p) p->next = n;
                 if (t == g_timers) g_timers = n;
 
                 mos_free(t);
-            } else p = t;
-        } else p = t;
+                t = n;
+                continue;
+            }
+        }
 
+        /* callback 中可能暂停了自己 */
+        deadline = __atomic_load_n(&t->deadline, __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&t->pause, __ATOMIC_SEQ_CST) && (next == 0 || deadline < next)) next = deadline;
+        if (__atomic_load_n(&t->right_now, __ATOMIC_SEQ_CST)) next = now;
+
+        p = t;
         t = n;
     }
+
+    return next;
 }
 
 static void* el_timer(void *arg)
 {
     int timerfd = *(int*)arg;
-
-    fd_set readset;
-    int maxfd = 0, rv;
+    int wakefd = timerWakeFd();
+    uint64_t value;
 
     int loglevel = mtc_level_str2int(mdf_get_value(g_config, "trace.main", "debug"));
     mtc_mt_initf("timer", loglevel, g_log_tostdout ? "-" : "%s/log/timer.log", g_location);
 
     mtc_mt_dbg("I am timer routine with timerfd %d", timerfd);
 
-    while (!dad_call_me_back) {
-        FD_ZERO(&readset);
+    struct pollfd fds[2] = {
+        {.fd = timerfd, .events = POLLIN},
+        {.fd = wakefd,  .events = POLLIN}
+    };
 
-        if (timerfd > 0) {
-            FD_SET(timerfd, &readset);
-            maxfd = timerfd;
+    while (!dad_call_me_back) {
+        /* 单次定时到最近的触发时间，没有时解除定时，只等待唤醒 */
+        struct itimerspec new_value = {.it_interval = {0, 0}, .it_value = {_timer_handler(), 0}};
+        if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
+            mtc_mt_err("timer set time %s", strerror(errno));
+            break;
         }
 
-        struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
-        rv = select(maxfd + 1, &readset, NULL, NULL, &tv);
-
+        int rv = poll(fds, wakefd >= 0 ? 2 : 1, -1);
         if (rv == -1 && errno != EINTR) {
-            mtc_mt_err("select error %s", strerror(errno));
+            mtc_mt_err("poll error %s", strerror(errno));
             break;
-        } else if (rv == 0) continue;
+        }
 
-        if (FD_ISSET(timerfd, &readset)) _timer_handler(timerfd);
+        WAKEUP(WAKE_TIMER);
+
+        if (rv > 0 && (fds[0].revents & POLLIN)) read(timerfd, &value, sizeof(value));
+        if (rv > 0 && (fds[1].revents & POLLIN)) read(wakefd, &value, sizeof(value));
     }
 
     mtc_mt_dbg("timer done");
@@ -287,21 +314,11 @@ MERR* netExposeME()
     g_efd = epoll_create1(0);
     if (g_efd < 0) return merr_raise(MERR_ASSERT, "epoll create failure");
 
-    /* timer fd */
+    /* timer fd，由定时器线程按最近的触发时间单次设置 */
     static int timerfd;
-    timerfd = timerfd_create(CLOCK_REALTIME, 0);
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
     if (timerfd == -1) return merr_raise(MERR_ASSERT, "timer fd create failure");
-
-    struct timespec now;
-    if (clock_gettime(CLOCK_REALTIME, &now) == -1) return merr_raise(MERR_ASSERT, "get time");
-    struct itimerspec new_value;
-    new_value.it_value.tv_sec = now.tv_sec + 1;
-    new_value.it_value.tv_nsec = now.tv_nsec;
-    new_value.it_interval.tv_sec = 1;
-    //new_value.it_interval.tv_nsec = 100000000ul;
-    new_value.it_interval.tv_nsec = 0;
-    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1)
-        return merr_raise(MERR_ASSERT, "timer set time");
+    if (timerWakeFd() < 0) return merr_raise(MERR_ASSERT, "timer wake fd create failure");
 
     pthread_create(&m_timer, NULL, el_timer, &timerfd);
 
@@ -353,6 +370,7 @@ MERR* netExposeME()
     //if(rv == -1) return merr_raise(MERR_ASSERT, "add fd failure");
 
     g_timers = timerAdd(g_timers, BROADCAST_PERIOD, true, nodehorn, _broadcast_me);
+    m_horn = g_timers;
 
     /* fd contrl */
     fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -409,11 +427,15 @@ MERR* netExposeME()
 
     dad_call_me_back = false;
     while (!dad_call_me_back) {
-        int nfd = epoll_wait(g_efd, events, MAXEVENTS, 2000);
+        /* 退出信号会打断 epoll_wait，无需超时 */
+        int nfd = epoll_wait(g_efd, events, MAXEVENTS, -1);
         if (nfd == -1 && errno != EINTR) {
             mtc_mt_err("epoll wait error %s", strerror(errno));
             break;
         }
+
+        WAKEUP(WAKE_MAIN);
+
         for (int i = 0; i < nfd; i++) {
             nitem = events[i].data.ptr;
 
@@ -464,6 +486,9 @@ MERR* netExposeME()
                 break;
             }
         }
+
+        /* 客户端上下线都经过此处 */
+        timerPause(m_horn, clientOn());
     }
 
     /* TODO nitem memory leak */
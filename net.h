@@ -47,6 +47,7 @@ typedef struct _net_binary_node {
     ssize_t recvlen;
 
     bool in_business;
+    uint32_t streamgen;         /* 流式传输代数，递增后进行中的传输即放弃 */
 } NetBinaryNode;
 
 MERR* netExposeME();
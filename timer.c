@@ -1,7 +1,11 @@
 #include <reef.h>
 
+#include <sys/eventfd.h>
+
 #include "timer.h"
 
+static int m_wakefd = -1;
+
 TimerEntry* timerAdd(TimerEntry *entry, int timeout, bool rightnow,
                      void *data, bool (*callback)(void *data))
 {
@@ -9,9 +13,68 @@ TimerEntry* timerAdd(TimerEntry *entry, int timeout, bool rightnow,
     e->timeout = timeout;
     e->right_now = rightnow;
     e->pause = false;
+    e->deadline = 0;
+    e->resumegen = 0;
     e->data = data;
     e->callback = callback;
     e->next = entry;
 
     return e;
 }
+
+int timerWakeFd()
+{
+    if (m_wakefd < 0) m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return m_wakefd;
+}
+
+void timerWake()
+{
+    uint64_t value = 1;
+
+    if (m_wakefd >= 0 && write(m_wakefd, &value, sizeof(value)) != sizeof(value))
+        mtc_mt_warn("wake timer failure %s", strerror(errno));
+}
+
+void timerPause(TimerEntry *entry, bool pause)
+{
+    if (!entry) return;
+
+    if (pause) {
+        __atomic_store_n(&entry->pause, true, __ATOMIC_SEQ_CST);
+        return;
+    }
+
+    /* 先加代数再恢复，与 timerPauseSelf() 的顺序相反，保证恢复不会丢失 */
+    __atomic_add_fetch(&entry->resumegen, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&entry->pause, false, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&entry->deadline, 0, __ATOMIC_RELAXED);
+        timerWake();
+    }
+}
+
+void timerNow(TimerEntry *entry)
+{
+    if (!entry) return;
+
+    __atomic_store_n(&entry->right_now, true, __ATOMIC_SEQ_CST);
+    timerWake();
+}
+
+uint32_t timerResumeGen(TimerEntry *entry)
+{
+    return entry ? __atomic_load_n(&entry->resumegen, __ATOMIC_SEQ_CST) : 0;
+}
+
+void timerPauseSelf(TimerEntry *entry, uint32_t gen)
+{
+    if (!entry) return;
+
+    __atomic_store_n(&entry->pause, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&entry->resumegen, __ATOMIC_SEQ_CST) != gen) {
+        /* 读取状态后被恢复过，撤销暂停 */
+        __atomic_store_n(&entry->pause, false, __ATOMIC_SEQ_CST);
+        timerWake();
+    }
+}
@@ -1,10 +1,15 @@
 #ifndef __TIMER_H__
 #define __TIMER_H__
 
+/*
+ * right_now、pause、deadline、resumegen 会被其他线程修改，需用 __atomic 读写
+ */
 typedef struct _timer_entry {
     int timeout;
     bool right_now;             /* 无需等待timeout, 立即触发，执行后会被置否，需要时请在callback中置真 */
-    bool pause;
+    bool pause;                 /* 暂停的定时器不参与计算下次唤醒时间 */
+    time_t deadline;            /* 下次触发的时间（CLOCK_MONOTONIC 秒），0 为从现在起计时 */
+    uint32_t resumegen;         /* 每次恢复加一，callback 据此判断读取状态后是否被恢复过 */
     void *data;
     bool (*callback)(void *data); /* 返回 false 即为下次不再执行 */
 
@@ -14,4 +19,20 @@ typedef struct _timer_entry {
 TimerEntry* timerAdd(TimerEntry *entry, int timeout, bool rightnow,
                      void *data, bool (*callback)(void *data));
 
+/*
+ * 定时器线程没有固定节拍，只在最近的触发时间或被唤醒时醒来，
+ * 其他线程修改了定时器（恢复、立即触发）后需调用 timerWake()
+ */
+int  timerWakeFd();
+void timerWake();
+void timerPause(TimerEntry *entry, bool pause);
+void timerNow(TimerEntry *entry);
+
+/*
+ * callback 中暂停自己：先用 timerResumeGen() 取得代数再读取判断用的状态，
+ * 此后若有其他线程恢复过定时器，则不暂停
+ */
+uint32_t timerResumeGen(TimerEntry *entry);
+void timerPauseSelf(TimerEntry *entry, uint32_t gen);
+
 #endif  /* __TIMER_H__ */